@@ -0,0 +1,84 @@
+// Compares the tree decoder against the zero-copy decoder on multi-MB inputs.
+// Build with -DBUILD_BENCHMARKS=ON and run ./bencode_bench [iterations].
+
+#include "bencode.hpp"
+#include "bencode_scan.hpp"
+#include "bencode_view.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+using namespace bencode;
+
+// Metainfo-like document: a large file list plus a pieces blob
+static std::string make_metainfo(size_t files, size_t pieces)
+{
+    std::mt19937_64 rng(42);
+    std::string out = "d8:announce31:http://tracker.example/announce4:infod5:filesl";
+    for (size_t i = 0; i < files; ++i)
+    {
+        std::string name = "file_" + std::to_string(i) + ".bin";
+        out += "d6:lengthi" + std::to_string(rng() % 100000000000ULL) + "e4:pathl6:shared" +
+               std::to_string(name.size()) + ":" + name + "ee";
+    }
+    out += "e4:name7:library12:piece lengthi262144e6:pieces" + std::to_string(pieces * 20) + ":";
+    for (size_t i = 0; i < pieces * 20; ++i)
+        out += static_cast<char>(rng());
+    out += "ee";
+    return out;
+}
+
+// Tracker reply with a long dictionary-form peer list
+static std::string make_peer_list(size_t peers)
+{
+    std::mt19937_64 rng(7);
+    std::string out = "d8:intervali1800e5:peersl";
+    for (size_t i = 0; i < peers; ++i)
+    {
+        std::string ip = std::to_string(rng() % 256) + "." + std::to_string(rng() % 256) + "." +
+                         std::to_string(rng() % 256) + "." + std::to_string(rng() % 256);
+        out += "d2:ip" + std::to_string(ip.size()) + ":" + ip + "7:peer id20:" + std::string(20, 'x') +
+               "4:porti" + std::to_string(rng() % 65536) + "ee";
+    }
+    out += "ee";
+    return out;
+}
+
+template <typename F>
+static void run(const char *label, const std::string &input, int iterations, F decode_fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t sink = 0;
+    for (int i = 0; i < iterations; ++i)
+        sink += decode_fn(input);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double mb = static_cast<double>(input.size()) * iterations / (1024.0 * 1024.0);
+    std::cout << "  " << label << ": " << mb / elapsed.count() << " MB/s (" << sink % 10 << ")\n";
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 10;
+    std::cout << "digit kernel: " << scan::active_kernel() << "\n";
+
+    struct Case
+    {
+        const char *name;
+        std::string input;
+    } cases[] = {
+        {"metainfo", make_metainfo(100000, 20000)},
+        {"peer list", make_peer_list(100000)},
+    };
+
+    for (const auto &c : cases)
+    {
+        std::cout << c.name << " (" << c.input.size() / (1024 * 1024) << " MB)\n";
+        run("decode     ", c.input, iterations, [](const std::string &in)
+            { return is_dict(decode(in)) ? size_t(1) : size_t(0); });
+        run("decode_view", c.input, iterations, [](const std::string &in)
+            { return decode_view(in).node_count(); });
+    }
+    return 0;
+}
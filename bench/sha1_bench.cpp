@@ -0,0 +1,45 @@
+// Piece hashing throughput of every SHA-1 backend this CPU supports.
+// Build with -DBUILD_BENCHMARKS=ON and run ./sha1_bench [piece_kib] [pieces].
+
+#include "sha1.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace torrent;
+
+int main(int argc, char **argv)
+{
+    size_t piece_length = (argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256) * 1024;
+    size_t pieces = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 256;
+
+    std::vector<char> data(piece_length * pieces);
+    std::mt19937_64 rng(1);
+    for (auto &c : data)
+        c = static_cast<char>(rng());
+
+    std::vector<const char *> ptrs(pieces);
+    for (size_t i = 0; i < pieces; ++i)
+        ptrs[i] = data.data() + i * piece_length;
+    std::vector<unsigned char> digests(pieces * sha1_digest_size);
+
+    std::cout << "selected backend: " << sha1_backend_name(sha1_backend()) << "\n";
+    for (Sha1Backend backend : {Sha1Backend::OpenSSL, Sha1Backend::ShaNi, Sha1Backend::Avx2, Sha1Backend::Avx512})
+    {
+        if (!sha1_backend_supported(backend))
+        {
+            std::cout << "  " << sha1_backend_name(backend) << ": unsupported\n";
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        sha1_many(backend, ptrs.data(), pieces, piece_length, digests.data());
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        double mb = static_cast<double>(data.size()) / (1024.0 * 1024.0);
+        std::cout << "  " << sha1_backend_name(backend) << ": " << mb / elapsed.count() << " MB/s on one core\n";
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+// Serving 16 KiB blocks over loopback TCP: sendfile() from the file against
+// pread() into a pooled buffer and send(). Reports throughput and payload
+// bytes per second of sender CPU time.
+// Build with -DBUILD_BENCHMARKS=ON and run ./upload_bench [file_mib] [rounds].
+
+#include "buffer_pool.hpp"
+#include "peer_wire.hpp"
+#include "send_queue.hpp"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <netinet/in.h>
+#include <random>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace torrent;
+
+static double thread_cpu_seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A connected loopback TCP pair; the receiving end is drained by a thread
+static void connect_pair(int &sender, int &receiver)
+{
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (::bind(listener, reinterpret_cast<sockaddr *>(&addr), len) < 0 || ::listen(listener, 1) < 0 ||
+        ::getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &len) < 0)
+    {
+        std::perror("listen");
+        std::exit(1);
+    }
+    sender = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (::connect(sender, reinterpret_cast<sockaddr *>(&addr), len) < 0)
+    {
+        std::perror("connect");
+        std::exit(1);
+    }
+    receiver = ::accept(listener, nullptr, nullptr);
+    ::close(listener);
+}
+
+int main(int argc, char **argv)
+{
+    size_t file_length = (argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64) << 20;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 8;
+    const uint32_t block = wire::max_block_size;
+    const size_t pipeline = 16; // blocks queued per flush, as from a pipelined peer
+    file_length -= file_length % block;
+
+    char path[] = "/tmp/upload_benchXXXXXX";
+    int file = ::mkstemp(path);
+    if (file < 0)
+    {
+        std::perror("mkstemp");
+        return 1;
+    }
+    ::unlink(path);
+    {
+        std::vector<char> data(1 << 20);
+        std::mt19937_64 rng(1);
+        for (auto &c : data)
+            c = static_cast<char>(rng());
+        for (size_t done = 0; done < file_length; done += data.size())
+            if (::write(file, data.data(), data.size()) != static_cast<ssize_t>(data.size()))
+            {
+                std::perror("write");
+                return 1;
+            }
+    }
+
+    std::cout << "Serving " << (file_length >> 20) << " MiB x " << rounds << " in " << block / 1024
+              << " KiB blocks\n";
+
+    BufferPool pool(block, pipeline);
+    for (bool zero_copy : {false, true})
+    {
+        int sender, receiver;
+        connect_pair(sender, receiver);
+        uint64_t total = uint64_t(file_length) * rounds;
+        std::thread reader([receiver, total]
+                           {
+            std::vector<char> sink(1 << 20);
+            uint64_t got = 0;
+            while (got < total)
+            {
+                ssize_t n = ::recv(receiver, sink.data(), sink.size(), 0);
+                if (n <= 0)
+                    break;
+                got += static_cast<uint64_t>(n);
+            } });
+
+        SendQueue queue;
+        auto start = std::chrono::steady_clock::now();
+        double cpu_start = thread_cpu_seconds();
+        uint64_t payload = 0;
+        for (int r = 0; r < rounds; ++r)
+        {
+            for (uint64_t offset = 0; offset < file_length;)
+            {
+                for (size_t i = 0; i < pipeline && offset < file_length; ++i, offset += block)
+                {
+                    uint32_t index = static_cast<uint32_t>(offset / block);
+                    if (zero_copy)
+                    {
+                        queue.push_piece(index, 0, {FileRange{file, offset, block}});
+                    }
+                    else
+                    {
+                        BufferPool::Buffer buffer = pool.acquire();
+                        if (::pread(file, buffer.get(), block, static_cast<off_t>(offset)) != block)
+                        {
+                            std::perror("pread");
+                            return 1;
+                        }
+                        queue.push_piece(index, 0, std::move(buffer), block);
+                    }
+                    payload += block;
+                }
+                if (queue.flush(sender) != SendQueue::Result::Done)
+                {
+                    std::perror("send");
+                    return 1;
+                }
+            }
+        }
+        double cpu = thread_cpu_seconds() - cpu_start;
+        ::shutdown(sender, SHUT_WR);
+        reader.join();
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ::close(sender);
+        ::close(receiver);
+
+        double mb = payload / 1e6;
+        std::printf("%-10s %8.1f MB/s  %8.1f MB per CPU second  (%.3f s CPU)\n", zero_copy ? "sendfile" : "buffered",
+                    mb / wall, mb / cpu, cpu);
+    }
+    ::close(file);
+}
@@ -0,0 +1,195 @@
+#ifndef ANNOUNCE_SCHEDULER_HPP
+#define ANNOUNCE_SCHEDULER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "reactor.hpp"
+#include "tracker.hpp"
+#include "udp_tracker.hpp"
+
+namespace torrent {
+
+    struct AnnounceSchedulerConfig {
+        // Used until a tracker says otherwise
+        std::chrono::seconds default_interval{1800};
+        // Re-announces come up to this fraction of the interval early, so
+        // torrents added together drift apart instead of announcing in step
+        double jitter = 0.1;
+        // First announces of newly added torrents are spread over this window
+        std::chrono::milliseconds startup_spread{5000};
+        // After a failure, a tracker is left alone for this long, doubling
+        // with each further failure up to the maximum
+        std::chrono::seconds retry_delay{60};
+        std::chrono::seconds max_retry_delay{3600};
+        // Swarm counts for every torrent on a tracker are refreshed this often,
+        // in multi-torrent scrapes
+        std::chrono::seconds scrape_interval{1800};
+        size_t http_scrape_batch = 50; // info hashes per HTTP scrape URL
+        int numwant = 50;
+        // Threads running blocking HTTP(S) requests
+        size_t http_threads = 2;
+        TrackerClientConfig http;
+        UdpTrackerConfig udp;
+    };
+
+    // Keeps hundreds of torrents announced to their trackers. Torrents are
+    // grouped by tracker: each tracker has one timer for its next due
+    // announce, its failures back off for all of its torrents at once, and
+    // swarm counts come from periodic scrapes covering all of its torrents
+    // in a few requests. Announces honour `interval` and `min interval` and
+    // are spread with jitter so they don't arrive in bursts.
+    //
+    // UDP trackers share one socket on the reactor; HTTP(S) trackers go
+    // through a shared TrackerClient on a small thread pool, with results
+    // handed back to the reactor thread. Handlers run on the reactor thread.
+    class AnnounceScheduler {
+    public:
+        using PeersHandler = std::function<void(const std::string &info_hash, const std::vector<PeerEndpoint> &peers)>;
+        using StatsHandler = std::function<void(const std::string &info_hash, const ScrapeStats &stats)>;
+
+        AnnounceScheduler(Reactor &reactor, std::string peer_id, uint16_t port, AnnounceSchedulerConfig config = {});
+        ~AnnounceScheduler();
+
+        AnnounceScheduler(const AnnounceScheduler &) = delete;
+        AnnounceScheduler &operator=(const AnnounceScheduler &) = delete;
+
+        // Peers not handed out before for that torrent
+        void on_peers(PeersHandler handler) { on_peers_ = std::move(handler); }
+        // Seeders, leechers and downloads, from announces and scrapes.
+        // Announce replies have no download count: `downloaded` is then -1.
+        void on_stats(StatsHandler handler) { on_stats_ = std::move(handler); }
+
+        // Starts announcing a torrent to its http, https and udp trackers;
+        // other URLs are ignored
+        void add_torrent(const std::string &info_hash, const std::vector<std::string> &announce_urls, int64_t left);
+        // Announces `stopped` without waiting for replies and forgets the torrent
+        void remove_torrent(const std::string &info_hash);
+        // Transfer totals for the next announce
+        void update(const std::string &info_hash, int64_t uploaded, int64_t downloaded, int64_t left);
+        // Announces `completed` as soon as each tracker's min interval allows
+        void completed(const std::string &info_hash);
+        // Asks for more peers as soon as each tracker's min interval allows
+        void announce_now(const std::string &info_hash);
+
+        size_t torrents() const { return torrents_.size(); }
+        size_t trackers() const { return trackers_.size(); }
+        uint64_t announces_sent() const { return announces_sent_; }
+        uint64_t scrapes_sent() const { return scrapes_sent_; }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        // What one announce came back with
+        struct AnnounceOutcome {
+            std::string event; // as sent
+            std::string error;
+            bool unreachable = false; // the tracker, not just this torrent, failed
+            int64_t interval = 0;
+            int64_t min_interval = 0;
+            std::string tracker_id;
+            std::vector<PeerEndpoint> peers;
+            bool has_counts = false;
+            ScrapeStats counts;
+        };
+
+        // A torrent as seen by one tracker
+        struct Announce {
+            std::string tracker;
+            Clock::time_point due;
+            Clock::time_point min_until; // earliest the tracker accepts another
+            std::chrono::seconds interval{0};
+            std::string event = "started";
+            std::string tracker_id;
+            bool in_flight = false;
+        };
+
+        struct Torrent {
+            std::string info_hash;
+            int64_t uploaded = 0;
+            int64_t downloaded = 0;
+            int64_t left = 0;
+            std::vector<Announce> announces;
+            PeerSet known;
+        };
+
+        struct Tracker {
+            std::string url;
+            bool udp = false;
+            std::string host;
+            uint16_t port = 0;
+            bool scrapable = true;
+            std::vector<std::string> torrents; // info hashes
+            int failures = 0;
+            Clock::time_point blocked_until;
+            Reactor::TimerId timer = 0;
+            Clock::time_point timer_at;
+            Reactor::TimerId scrape_timer = 0;
+        };
+
+        Tracker *tracker_for(const std::string &url);
+        void reschedule(Tracker &tracker);
+        void run_tracker(const std::string &url);
+        void send_announce(Tracker &tracker, Torrent &torrent, Announce &announce);
+        void on_announced(const std::string &url, const std::string &info_hash, AnnounceOutcome outcome);
+        void tracker_failed(Tracker &tracker);
+        void schedule_scrape(Tracker &tracker, Clock::duration delay);
+        void scrape(const std::string &url);
+        void on_scraped(const std::string &url, const std::vector<std::string> &hashes,
+                        const std::vector<ScrapeStats> &stats, const std::string &error);
+        Announce *find_announce(Torrent &torrent, const std::string &url);
+        void kick(const std::string &info_hash, const char *event);
+        Clock::duration jittered(Clock::duration interval);
+        Clock::duration backoff(int failures);
+
+        struct HttpJob {
+            std::function<std::function<void()>()> work;
+            bool stopped = false; // a stopped announce, still sent on shutdown
+        };
+
+        // Runs `work` on an HTTP thread; the function it returns then runs
+        // on the reactor thread
+        void run_http(std::function<std::function<void()>()> work, bool stopped = false);
+        void http_loop();
+        void drain_completions();
+
+        Reactor &reactor_;
+        std::string peer_id_;
+        uint16_t port_;
+        AnnounceSchedulerConfig config_;
+        std::mt19937 rng_;
+
+        std::unordered_map<std::string, Torrent> torrents_;
+        std::unordered_map<std::string, Tracker> trackers_; // by announce URL
+
+        UdpTracker udp_;
+        TrackerClient http_;
+
+        std::mutex http_mutex_;
+        std::condition_variable http_cv_;
+        std::deque<HttpJob> http_jobs_;
+        std::condition_variable http_idle_cv_; // http_jobs_ ran dry
+        std::vector<std::function<void()>> completions_;
+        bool stopping_ = false;
+        int wake_fd_ = -1; // eventfd telling the reactor completions are waiting
+        std::vector<std::thread> http_threads_;
+
+        uint64_t announces_sent_ = 0;
+        uint64_t scrapes_sent_ = 0;
+
+        PeersHandler on_peers_;
+        StatsHandler on_stats_;
+    };
+
+}
+
+#endif // ANNOUNCE_SCHEDULER_HPP
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <charconv>
 #include <map>
 #include <variant>
 #include <memory>
@@ -38,6 +40,17 @@ namespace bencode
     // Encode BencodeValue into a bencoded string
     std::string encode(const BencodeValue &value);
 
+    // Exact number of bytes encode() produces for value
+    size_t encoded_size(const BencodeValue &value);
+
+    // Append the encoding of value to out, growing the buffer only once
+    void encode_append(const BencodeValue &value, std::string &out);
+
+    // Write the encoding of value through an output iterator (e.g. a char*
+    // with room for encoded_size(value) bytes). Returns the end of the output.
+    template <typename OutputIt>
+    OutputIt encode_to(const BencodeValue &value, OutputIt out);
+
     
 
     // Pretty-print the value (for debugging)
@@ -54,7 +67,62 @@ namespace bencode
     const std::string &as_string(const BencodeValue &val);
     const std::vector<std::shared_ptr<Bencode>>&as_list(const BencodeValue &val);
     const std::map<std::string, std::shared_ptr<Bencode>> &as_dict(const BencodeValue &val);
-    
+
+    // ----------------- Encoder internals -----------------
+    namespace detail
+    {
+        template <typename OutputIt>
+        OutputIt write_int(int64_t val, OutputIt out)
+        {
+            char digits[24];
+            auto result = std::to_chars(digits, digits + sizeof(digits), val);
+            return std::copy(digits, result.ptr, out);
+        }
+
+        template <typename OutputIt>
+        OutputIt write_string(const std::string &str, OutputIt out)
+        {
+            out = write_int(static_cast<int64_t>(str.size()), out);
+            *out++ = ':';
+            return std::copy(str.begin(), str.end(), out);
+        }
+    }
+
+    template <typename OutputIt>
+    OutputIt encode_to(const BencodeValue &value, OutputIt out)
+    {
+        if (auto *num = std::get_if<int64_t>(&value))
+        {
+            *out++ = 'i';
+            out = detail::write_int(*num, out);
+            *out++ = 'e';
+        }
+        else if (auto *str = std::get_if<std::string>(&value))
+        {
+            out = detail::write_string(*str, out);
+        }
+        else if (auto *list = std::get_if<std::vector<std::shared_ptr<Bencode>>>(&value))
+        {
+            *out++ = 'l';
+            for (const auto &item : *list)
+            {
+                out = encode_to(item->value, out);
+            }
+            *out++ = 'e';
+        }
+        else if (auto *dict = std::get_if<std::map<std::string, std::shared_ptr<Bencode>>>(&value))
+        {
+            *out++ = 'd';
+            for (const auto &[key, item] : *dict)
+            {
+                out = detail::write_string(key, out);
+                out = encode_to(item->value, out);
+            }
+            *out++ = 'e';
+        }
+        return out;
+    }
+
 }
 
 #endif // BENCODE_HPP
@@ -0,0 +1,29 @@
+#ifndef BENCODE_SCAN_HPP
+#define BENCODE_SCAN_HPP
+
+#include <cstdint>
+
+namespace bencode
+{
+    namespace scan
+    {
+
+        struct DigitRun
+        {
+            const char *end;  // first byte past the digits
+            uint64_t value;   // parsed value (meaningless if overflow)
+            bool overflow;    // run does not fit in uint64_t
+        };
+
+        // Parses the run of ASCII digits starting at p. Uses a vectorized kernel
+        // chosen once at runtime (SSE4.1, SSE2, or scalar), which finds the end
+        // of the run and converts all digits at once instead of byte by byte.
+        DigitRun parse_digits(const char *p, const char *end);
+
+        // Name of the kernel parse_digits dispatches to
+        const char *active_kernel();
+
+    }
+}
+
+#endif // BENCODE_SCAN_HPP
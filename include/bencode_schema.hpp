@@ -0,0 +1,235 @@
+#ifndef BENCODE_SCHEMA_HPP
+#define BENCODE_SCHEMA_HPP
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Binds bencoded dictionaries straight into C++ structs, without building a
+// tree first. A struct is made decodable by specializing Schema<T>:
+//
+//     template <>
+//     struct bencode::Schema<Peer>
+//     {
+//         static constexpr auto fields = std::make_tuple(
+//             bencode::required("ip", &Peer::ip),
+//             bencode::optional("port", &Peer::port));
+//     };
+//
+//     Peer peer = bencode::decode_as<Peer>(input);
+//
+// Unknown keys are skipped without allocating, and a missing required key
+// throws std::runtime_error naming the key.
+
+namespace bencode
+{
+
+    // Captures the encoded bytes of a value without interpreting it. Borrows
+    // from the input buffer.
+    struct RawValue
+    {
+        std::string_view bytes;
+    };
+
+    // A decoded value together with the encoded bytes it came from
+    template <typename T>
+    struct Spanned
+    {
+        T value{};
+        std::string_view raw;
+    };
+
+    template <typename T, typename M>
+    struct Field
+    {
+        std::string_view key;
+        M T::*member;
+        bool required;
+    };
+
+    template <typename T, typename M>
+    constexpr Field<T, M> required(std::string_view key, M T::*member)
+    {
+        return Field<T, M>{key, member, true};
+    }
+
+    template <typename T, typename M>
+    constexpr Field<T, M> optional(std::string_view key, M T::*member)
+    {
+        return Field<T, M>{key, member, false};
+    }
+
+    // Specialize with a `static constexpr auto fields` tuple of Field
+    template <typename T>
+    struct Schema;
+
+    // ----------------- Reader -----------------
+    // Forward-only cursor over a bencoded buffer
+    class Reader
+    {
+    public:
+        explicit Reader(std::string_view input)
+            : begin_(input.data()), p_(input.data()), end_(input.data() + input.size())
+        {
+        }
+
+        const char *position() const { return p_; }
+        bool at_end() const { return p_ == end_; }
+
+        // Next byte without consuming it (throws at end of input)
+        char peek() const;
+
+        // Consumes c or throws
+        void expect(char c);
+
+        // Consumes a container terminator if it is next
+        bool consume_end();
+
+        int64_t read_int();
+        std::string_view read_string();
+
+        // Skips over one value of any type and returns its encoded bytes
+        std::string_view skip();
+
+        // Container nesting bookkeeping, shared by every reader overload
+        void enter();
+        void leave() { --depth_; }
+
+    private:
+        const char *begin_;
+        const char *p_;
+        const char *end_;
+        size_t depth_ = 0;
+    };
+
+    // ----------------- Value readers -----------------
+    void read_value(Reader &r, int64_t &out);
+    void read_value(Reader &r, std::string &out);
+    void read_value(Reader &r, std::string_view &out);
+    void read_value(Reader &r, RawValue &out);
+
+    template <typename T>
+    void read_value(Reader &r, std::optional<T> &out);
+    template <typename T>
+    void read_value(Reader &r, Spanned<T> &out);
+    template <typename T>
+    void read_value(Reader &r, std::vector<T> &out);
+    template <typename V>
+    void read_value(Reader &r, std::map<std::string, V> &out);
+    template <typename T, typename = decltype(Schema<T>::fields)>
+    void read_value(Reader &r, T &out);
+
+    namespace detail
+    {
+        template <typename T, typename Fields, size_t... I>
+        bool read_field(Reader &r, T &out, std::string_view key, const Fields &fields,
+                        uint64_t &seen, std::index_sequence<I...>)
+        {
+            bool matched = false;
+            auto try_field = [&](const auto &field, uint64_t bit)
+            {
+                if (matched || field.key != key)
+                    return;
+                read_value(r, out.*(field.member));
+                seen |= bit;
+                matched = true;
+            };
+            (try_field(std::get<I>(fields), uint64_t(1) << I), ...);
+            return matched;
+        }
+
+        template <typename Fields, size_t... I>
+        void check_required(const Fields &fields, uint64_t seen, std::index_sequence<I...>)
+        {
+            auto check = [&](const auto &field, uint64_t bit)
+            {
+                if (field.required && !(seen & bit))
+                    throw std::runtime_error("Missing required field: " + std::string(field.key));
+            };
+            (check(std::get<I>(fields), uint64_t(1) << I), ...);
+        }
+    }
+
+    template <typename T>
+    void read_value(Reader &r, std::optional<T> &out)
+    {
+        read_value(r, out.emplace());
+    }
+
+    template <typename T>
+    void read_value(Reader &r, Spanned<T> &out)
+    {
+        const char *start = r.position();
+        read_value(r, out.value);
+        out.raw = std::string_view(start, r.position() - start);
+    }
+
+    template <typename T>
+    void read_value(Reader &r, std::vector<T> &out)
+    {
+        r.expect('l');
+        r.enter();
+        out.clear();
+        while (!r.consume_end())
+        {
+            read_value(r, out.emplace_back());
+        }
+        r.leave();
+    }
+
+    template <typename V>
+    void read_value(Reader &r, std::map<std::string, V> &out)
+    {
+        r.expect('d');
+        r.enter();
+        out.clear();
+        while (!r.consume_end())
+        {
+            std::string_view key = r.read_string();
+            read_value(r, out[std::string(key)]);
+        }
+        r.leave();
+    }
+
+    template <typename T, typename>
+    void read_value(Reader &r, T &out)
+    {
+        constexpr auto &fields = Schema<T>::fields;
+        constexpr size_t count = std::tuple_size_v<std::decay_t<decltype(fields)>>;
+        static_assert(count <= 64, "Schema supports at most 64 fields");
+        using Indices = std::make_index_sequence<count>;
+
+        r.expect('d');
+        r.enter();
+        uint64_t seen = 0;
+        while (!r.consume_end())
+        {
+            std::string_view key = r.read_string();
+            if (!detail::read_field(r, out, key, fields, seen, Indices{}))
+                r.skip();
+        }
+        r.leave();
+
+        detail::check_required(fields, seen, Indices{});
+    }
+
+    // Decodes input directly into T
+    template <typename T>
+    T decode_as(std::string_view input)
+    {
+        Reader r(input);
+        T out{};
+        read_value(r, out);
+        return out;
+    }
+
+}
+
+#endif // BENCODE_SCHEMA_HPP
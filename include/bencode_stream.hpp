@@ -0,0 +1,117 @@
+#ifndef BENCODE_STREAM_HPP
+#define BENCODE_STREAM_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bencode.hpp"
+
+namespace bencode
+{
+
+    // Receives events from a StreamParser. String values are delivered in
+    // pieces as they arrive: begin_string() announces the length, then
+    // string_data() is called once per chunk, then end_string().
+    class StreamHandler
+    {
+    public:
+        virtual ~StreamHandler() = default;
+
+        virtual void begin_dict() {}
+        virtual void begin_list() {}
+        virtual void end() {} // closes the innermost dict or list
+
+        virtual void key(std::string_view /*key*/) {}
+        virtual void integer(int64_t /*value*/) {}
+
+        virtual void begin_string(size_t /*length*/) {}
+        virtual void string_data(std::string_view /*data*/) {}
+        virtual void end_string() {}
+    };
+
+    // Resumable push parser. Feed it bytes as they come off the socket; it
+    // keeps only a container stack and never buffers string payloads
+    // (dictionary keys are the only thing it may copy, when split across chunks).
+    class StreamParser
+    {
+    public:
+        explicit StreamParser(StreamHandler &handler);
+
+        // Consumes bytes and fires events. Stops once a complete top-level
+        // value has been parsed and returns the number of bytes consumed, so
+        // trailing data (e.g. a ut_metadata block) is left to the caller.
+        // Throws std::runtime_error on malformed input.
+        size_t feed(const char *data, size_t len);
+        size_t feed(std::string_view data) { return feed(data.data(), data.size()); }
+
+        // True once a complete top-level value has been parsed
+        bool done() const { return state_ == State::Done; }
+
+        // Throws if the input ended in the middle of a value
+        void finish() const;
+
+        // Current nesting depth
+        size_t depth() const { return stack_.size(); }
+
+        // Prepares the parser for a new document
+        void reset();
+
+    private:
+        enum class State : uint8_t
+        {
+            Value,
+            Int,
+            Length,
+            StringBody,
+            KeyBody,
+            Done
+        };
+
+        void start_value(char c);
+        void value_done();
+
+        StreamHandler &handler_;
+        State state_ = State::Value;
+        std::vector<char> stack_; // 'l' list, 'k' dict awaiting key, 'v' dict awaiting value
+        bool negative_ = false;
+        bool has_digits_ = false;
+        bool length_is_key_ = false;
+        uint64_t number_ = 0;
+        uint64_t remaining_ = 0;
+        std::string key_buf_;
+    };
+
+    // Handler that assembles the events into an owning BencodeValue tree
+    class ValueBuilder : public StreamHandler
+    {
+    public:
+        void begin_dict() override;
+        void begin_list() override;
+        void end() override;
+        void key(std::string_view key) override;
+        void integer(int64_t value) override;
+        void begin_string(size_t length) override;
+        void string_data(std::string_view data) override;
+        void end_string() override;
+
+        // The completed value (valid once the parser reports done())
+        BencodeValue &result() { return result_; }
+
+    private:
+        struct Frame
+        {
+            BencodeValue container;
+            std::string key; // pending key when container is a dict
+        };
+
+        void add(BencodeValue value);
+
+        BencodeValue result_;
+        std::vector<Frame> stack_;
+        std::string string_;
+    };
+
+}
+
+#endif // BENCODE_STREAM_HPP
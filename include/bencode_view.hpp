@@ -0,0 +1,109 @@
+#ifndef BENCODE_VIEW_HPP
+#define BENCODE_VIEW_HPP
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "bencode.hpp"
+
+namespace bencode
+{
+
+    enum class NodeType : uint8_t
+    {
+        Int,
+        String,
+        List,
+        Dict
+    };
+
+    // One decoded value. Strings and raw spans borrow from the input buffer.
+    struct Node
+    {
+        NodeType type = NodeType::Int;
+        int64_t integer = 0;
+        std::string_view string; // payload of a String node
+        std::string_view raw;    // exact encoded bytes of this value
+        uint32_t first = 0;      // first child slot (List: items, Dict: entries)
+        uint32_t count = 0;      // number of children
+    };
+
+    struct DictEntry
+    {
+        std::string_view key;
+        uint32_t value;
+    };
+
+    class Document;
+
+    // Cheap handle onto a node inside a Document. A default constructed view
+    // is "missing" and is what find() returns for absent keys.
+    class View
+    {
+    public:
+        View() = default;
+        View(const Document *doc, uint32_t index) : doc_(doc), index_(index) {}
+
+        explicit operator bool() const { return doc_ != nullptr; }
+
+        NodeType type() const;
+        bool is_int() const { return type() == NodeType::Int; }
+        bool is_string() const { return type() == NodeType::String; }
+        bool is_list() const { return type() == NodeType::List; }
+        bool is_dict() const { return type() == NodeType::Dict; }
+
+        // Getters (throw std::runtime_error if wrong type)
+        int64_t as_int() const;
+        std::string_view as_string() const;
+
+        // Encoded bytes of this value exactly as they appeared in the input
+        std::string_view raw() const;
+
+        // Number of list items or dictionary entries
+        size_t size() const;
+
+        // List item by position
+        View operator[](size_t i) const;
+
+        // Dictionary entries by position (in sorted key order)
+        std::string_view key_at(size_t i) const;
+        View value_at(size_t i) const;
+
+        // Dictionary lookup by key (binary search), returns a missing view if absent
+        View find(std::string_view key) const;
+
+    private:
+        const Node &node() const;
+
+        const Document *doc_ = nullptr;
+        uint32_t index_ = 0;
+    };
+
+    // Arena holding every node of a decoded document. List items and
+    // dictionary entries are stored as contiguous runs, dictionaries sorted by
+    // key. The input buffer must outlive the Document.
+    class Document
+    {
+    public:
+        View root() const { return nodes_.empty() ? View() : View(this, 0); }
+        size_t node_count() const { return nodes_.size(); }
+
+    private:
+        friend class View;
+        friend Document decode_view(std::string_view input);
+        class Parser;
+
+        std::vector<Node> nodes_;
+        std::vector<uint32_t> items_;
+        std::vector<DictEntry> entries_;
+    };
+
+    // Decode without copying: strings are views into `input`
+    Document decode_view(std::string_view input);
+
+    // Build an owning BencodeValue tree from a view
+    BencodeValue to_value(const View &view);
+
+}
+
+#endif // BENCODE_VIEW_HPP
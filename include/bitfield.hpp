@@ -0,0 +1,75 @@
+#ifndef BITFIELD_HPP
+#define BITFIELD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace torrent {
+
+    // A piece bitfield packed into 64-bit words. Bits run MSB-first as on
+    // the wire, so each word is just eight wire bytes loaded big-endian.
+    // Spare bits past the end are always zero.
+    class Bitfield {
+    public:
+        Bitfield() = default;
+        explicit Bitfield(size_t bits, bool value = false);
+
+        // From a bitfield message payload; throws if the length is wrong
+        static Bitfield from_bytes(std::string_view bytes, size_t bits);
+        std::string to_bytes() const;
+
+        size_t size() const { return bits_; }
+        size_t count() const { return count_; }
+        bool all() const { return count_ == bits_; }
+        bool none() const { return count_ == 0; }
+
+        bool test(size_t i) const { return (words_[i >> 6] >> (63 - (i & 63))) & 1; }
+        bool operator[](size_t i) const { return test(i); }
+        // Both return whether the bit changed
+        bool set(size_t i);
+        bool reset(size_t i);
+        void set_all();
+        void reset_all();
+
+        const uint64_t *words() const { return words_.data(); }
+        size_t num_words() const { return words_.size(); }
+
+        bool operator==(const Bitfield &other) const { return bits_ == other.bits_ && words_ == other.words_; }
+        bool operator!=(const Bitfield &other) const { return !(*this == other); }
+
+        // Calls fn(index) for every set bit, in order
+        template <typename Fn>
+        void for_each_set(Fn fn) const
+        {
+            for (size_t w = 0; w < words_.size(); ++w)
+            {
+                uint64_t word = words_[w];
+                while (word)
+                {
+                    int lead = __builtin_clzll(word);
+                    fn(w * 64 + size_t(lead));
+                    word &= ~(uint64_t(1) << (63 - lead));
+                }
+            }
+        }
+
+    private:
+        std::vector<uint64_t> words_;
+        size_t bits_ = 0;
+        size_t count_ = 0;
+    };
+
+    // Pieces `theirs` has that `ours` lacks, the basis of interest. Both use
+    // a popcount or AVX2 kernel chosen once at runtime.
+    size_t count_missing(const Bitfield &ours, const Bitfield &theirs);
+    bool has_missing(const Bitfield &ours, const Bitfield &theirs);
+
+    // Name of the kernel the two functions above dispatch to
+    const char *bitfield_kernel();
+
+}
+
+#endif // BITFIELD_HPP
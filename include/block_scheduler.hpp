@@ -0,0 +1,173 @@
+#ifndef BLOCK_SCHEDULER_HPP
+#define BLOCK_SCHEDULER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "bitfield.hpp"
+#include "peer_session.hpp"
+#include "peer_wire.hpp"
+#include "piece_picker.hpp"
+#include "reactor.hpp"
+#include "storage.hpp"
+#include "torrent_parser.hpp"
+
+namespace torrent {
+
+    struct SchedulerConfig {
+        uint32_t block_size = wire::max_block_size;
+        // Requests kept in flight per peer: starts at the minimum and follows
+        // the peer's bandwidth-delay product from there
+        size_t min_queue_depth = 4;
+        size_t max_queue_depth = 500;
+        // Outstanding data is kept at this multiple of the measured BDP, so
+        // the estimate can keep growing while the link still has room
+        double bdp_gain = 2.0;
+        // A request times out after this multiple of the smoothed block
+        // latency, but never sooner than the floor
+        double timeout_multiple = 4.0;
+        std::chrono::milliseconds min_request_timeout{5000};
+        // How often rates are sampled and timeouts checked
+        std::chrono::milliseconds tick_interval{500};
+    };
+
+    // Downloads a v1 torrent's pieces in 16 KiB blocks from any number of
+    // peer sessions. Each unchoked peer gets a pipeline of requests whose
+    // depth tracks its measured rate times its minimum block latency; blocks
+    // that time out or are rejected go back to the pool for any peer to
+    // fetch. Peers that choke us under the fast extension are still asked
+    // for the pieces they allow fast. New pieces are chosen rarest first.
+    // Blocks are assembled in the Storage cache and each completed piece is
+    // checked against its SHA-1 before Storage may write it; no new piece is
+    // started while the cache is full. Once Storage reports a write error,
+    // the piece in hand is dropped, no more blocks are requested and the
+    // owner hears of it through on_storage_error.
+    //
+    // The scheduler doesn't own sessions or their callbacks; the owner
+    // forwards them:
+    //
+    //     session.on_state_change([&](PeerSession &s) { scheduler.peer_state_changed(s); });
+    //     session.on_message([&](PeerSession &s, const wire::Message &m) { scheduler.handle(s, m); });
+    //
+    // Sessions that close are dropped automatically; one destroyed while
+    // still open must be removed first. Everything runs on the reactor thread.
+    class BlockScheduler {
+    public:
+        using PieceHandler = std::function<void(uint32_t index)>;
+        using FailureHandler = std::function<void(uint32_t index)>;
+        using StorageErrorHandler = std::function<void(const std::string &error)>;
+
+        BlockScheduler(Reactor &reactor, const TorrentMetadata &metadata, Storage &storage,
+                       SchedulerConfig config = {});
+        ~BlockScheduler();
+
+        BlockScheduler(const BlockScheduler &) = delete;
+        BlockScheduler &operator=(const BlockScheduler &) = delete;
+
+        // A verified piece, committed to storage
+        void on_piece(PieceHandler handler) { on_piece_ = std::move(handler); }
+        // A piece whose hash didn't match; its blocks are fetched again
+        void on_hash_failure(FailureHandler handler) { on_failure_ = std::move(handler); }
+        // Storage failed to write; downloading stops. Called once.
+        void on_storage_error(StorageErrorHandler handler) { on_storage_error_ = std::move(handler); }
+
+        // Pieces already on disk, e.g. from a Verifier run
+        void mark_have(uint32_t index);
+
+        void add_peer(PeerSession &session);
+        // Returns the peer's outstanding blocks to the pool
+        void remove_peer(PeerSession &session);
+
+        void peer_state_changed(PeerSession &session);
+        void handle(PeerSession &session, const wire::Message &msg);
+
+        size_t num_pieces() const { return picker_.num_pieces(); }
+        size_t pieces_done() const { return picker_.have().count(); }
+        bool complete() const { return picker_.complete(); }
+        bool has_piece(uint32_t index) const { return index < num_pieces() && picker_.have().test(index); }
+        // The storage error that stopped downloading, empty if none
+        const std::string &storage_error() const { return storage_error_; }
+        const PiecePicker &picker() const { return picker_; }
+
+        // Current pipeline depth and outstanding requests for a peer
+        size_t queue_depth(const PeerSession &session) const;
+        size_t outstanding(const PeerSession &session) const;
+        // Smoothed download rate from a peer, in bytes per second
+        double download_rate(const PeerSession &session) const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        enum class BlockState : uint8_t { Free, Requested, Received };
+
+        struct PartialPiece {
+            std::vector<BlockState> blocks;
+            size_t received = 0;
+        };
+
+        struct Request {
+            uint32_t piece;
+            uint32_t block;
+            Clock::time_point sent;
+        };
+
+        struct Peer {
+            std::deque<Request> requests; // in the order sent
+            size_t depth = 0;
+            double rate = 0;                  // bytes per second, smoothed
+            uint64_t bytes_since_tick = 0;
+            double srtt = 0;                  // smoothed block latency, seconds
+            double min_rtt = 0;               // windowed minimum, seconds
+            Clock::time_point min_rtt_stamp;
+            Bitfield counted; // what the picker has been told this peer has
+            bool seed = false;
+        };
+
+        uint32_t piece_size(uint32_t index) const;
+        uint32_t block_count(uint32_t index) const;
+        uint32_t block_length(uint32_t index, uint32_t block) const;
+
+        static bool may_request(const PeerSession &session);
+        void fill(PeerSession &session, Peer &peer);
+        bool pick(const PeerSession &session, uint32_t &piece, uint32_t &block);
+        bool pick_allowed_fast(const PeerSession &session, uint32_t &piece, uint32_t &block);
+        bool start_piece(uint32_t index);
+        void on_block(Peer &peer, const wire::Message &msg);
+        void on_reject(Peer &peer, const wire::Message &msg);
+        void finish_piece(uint32_t index);
+        void abandon_piece(uint32_t index);
+        void storage_failed(const std::string &error);
+        void drop_requests(Peer &peer);
+        void count_peer(PeerSession &session, Peer &peer);
+        void uncount_peer(Peer &peer);
+        void release(uint32_t piece, uint32_t block);
+        void update_depth(Peer &peer);
+        void tick();
+
+        Reactor &reactor_;
+        Storage &storage_;
+        SchedulerConfig config_;
+        int64_t total_length_;
+        uint32_t piece_length_;
+        std::string hashes_;
+
+        PiecePicker picker_;
+        std::unordered_map<uint32_t, PartialPiece> partial_;
+        std::unordered_map<PeerSession *, Peer> peers_;
+
+        Clock::time_point last_tick_;
+        Reactor::TimerId tick_timer_ = 0;
+
+        PieceHandler on_piece_;
+        FailureHandler on_failure_;
+        StorageErrorHandler on_storage_error_;
+        std::string storage_error_;
+    };
+
+}
+
+#endif // BLOCK_SCHEDULER_HPP
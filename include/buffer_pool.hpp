@@ -0,0 +1,43 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace torrent {
+
+    // Fixed-size buffers recycled instead of allocated per use. A buffer
+    // goes back to the pool when its handle is destroyed, even if the pool
+    // itself is gone by then.
+    class BufferPool {
+        struct State {
+            size_t buffer_size;
+            size_t max_free;
+            std::mutex mutex;
+            std::vector<std::unique_ptr<char[]>> free;
+        };
+
+    public:
+        struct Release {
+            std::shared_ptr<State> state;
+            void operator()(char *p) const;
+        };
+        using Buffer = std::unique_ptr<char[], Release>;
+
+        // Keeps at most max_free idle buffers around
+        BufferPool(size_t buffer_size, size_t max_free);
+
+        Buffer acquire();
+
+        size_t buffer_size() const { return state_->buffer_size; }
+        size_t idle() const;
+
+    private:
+        std::shared_ptr<State> state_;
+    };
+
+}
+
+#endif // BUFFER_POOL_HPP
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+
+// Extension protocol handshake (BEP 10), sent as extended message id 0
+struct ExtensionHandshake
+{
+    std::map<std::string, int64_t> extensions; // "m": extension name -> message id
+    int64_t listen_port = 0;                   // "p"
+    std::string client;                        // "v"
+    std::string your_ip;                       // "yourip"
+    int64_t request_queue = 0;                 // "reqq"
+    int64_t metadata_size = 0;                 // "metadata_size" (ut_metadata)
+};
+
+// Decodes the bencoded handshake payload
+ExtensionHandshake parse_extension_handshake(std::string_view payload);
+
+// Encodes a handshake payload, omitting fields left at their defaults
+std::string encode_extension_handshake(const ExtensionHandshake &handshake);
@@ -0,0 +1,73 @@
+#ifndef FILE_LAYOUT_HPP
+#define FILE_LAYOUT_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "torrent_parser.hpp"
+
+namespace torrent {
+
+    // A stretch of an open file
+    struct FileRange {
+        int fd;
+        uint64_t offset;
+        size_t length;
+    };
+
+    // Where a torrent's payload lives on disk. Pieces see the files as one
+    // byte stream in torrent order; this maps stream offsets back to files.
+    class FileLayout {
+    public:
+        struct File {
+            std::string path;
+            uint64_t offset; // within the stream
+            uint64_t length;
+            bool pad;        // BEP 47 pad file: zeros, never stored
+        };
+
+        // save_path is the directory holding the torrent's content, i.e. the
+        // single file or top-level directory named after the torrent. Path
+        // components from the torrent are checked so they can't climb out.
+        FileLayout(const TorrentMetadata &metadata, const std::string &save_path);
+
+        // Every file in torrent order, empty ones included
+        const std::vector<File> &files() const { return files_; }
+        uint64_t total_length() const { return total_length_; }
+        uint64_t piece_length() const { return piece_length_; }
+        uint64_t num_pieces() const { return num_pieces_; }
+
+        uint64_t piece_offset(uint32_t piece) const { return uint64_t(piece) * piece_length_; }
+        uint32_t piece_size(uint32_t piece) const;
+
+        // Index of the file holding stream byte `offset`
+        size_t file_at(uint64_t offset) const;
+
+        // Calls fn(file_index, file_offset, length) for each file region
+        // covering [offset, offset + length), pad files included
+        template <typename Fn>
+        void for_each_span(uint64_t offset, uint64_t length, Fn fn) const
+        {
+            uint64_t end = offset + length;
+            for (size_t i = length ? file_at(offset) : files_.size(); offset < end; ++i)
+            {
+                const File &file = files_[i];
+                if (file.length == 0)
+                    continue;
+                uint64_t stop = std::min(end, file.offset + file.length);
+                fn(i, offset - file.offset, stop - offset);
+                offset = stop;
+            }
+        }
+
+    private:
+        std::vector<File> files_;
+        uint64_t total_length_ = 0;
+        uint64_t piece_length_ = 0;
+        uint64_t num_pieces_ = 0;
+    };
+
+}
+
+#endif // FILE_LAYOUT_HPP
@@ -0,0 +1,76 @@
+#ifndef HASH_CACHE_HPP
+#define HASH_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace torrent {
+
+    // Persists the SHA1 piece digests of files so unchanged data is never
+    // hashed twice. There is one small binary file per (path, piece length),
+    // trusted only while the file's size, mtime, inode and device still match
+    // what was recorded. Writes made through invalidate() keep an entry alive
+    // and re-hash just the pieces they touched.
+    class HashCache {
+    public:
+        explicit HashCache(std::string directory);
+
+        // Digests of the file's pieces, concatenated in piece order. Served
+        // from the cache when the file is unchanged, re-hashing only
+        // invalidated pieces; otherwise the whole file is hashed and recorded.
+        // With `cancel`, hashing stops soon after it's set: the pieces done so
+        // far are recorded and an empty string is returned.
+        std::string piece_hashes(const std::string &path, int64_t piece_length, unsigned workers = 0,
+                                 const std::atomic<bool> *cancel = nullptr);
+
+        // Records that [offset, offset + length) of a file was just rewritten
+        // (call after the write). The file's new size and mtime are adopted,
+        // so changes made behind the cache's back between the last lookup and
+        // this call go unnoticed.
+        void invalidate(const std::string &path, uint64_t offset, uint64_t length);
+
+        // Drops every entry for the file
+        void erase(const std::string &path);
+
+        const std::string &directory() const { return directory_; }
+
+    private:
+        struct Identity {
+            uint64_t size = 0;
+            int64_t mtime_ns = 0;
+            uint64_t inode = 0;
+            uint64_t device = 0;
+
+            bool operator==(const Identity &other) const;
+        };
+
+        struct Entry {
+            Identity identity;
+            uint64_t piece_length = 0;
+            std::vector<uint8_t> dirty; // one bit per piece
+            std::string digests;
+        };
+
+        static std::optional<Identity> identify(const std::string &path);
+        std::string key_prefix(const std::string &path) const;
+        std::string entry_path(const std::string &path, int64_t piece_length) const;
+        std::vector<std::string> entries_for(const std::string &path) const;
+
+        static std::optional<Entry> load(const std::string &file);
+        static bool save(const std::string &file, const Entry &entry);
+
+        std::string directory_;
+        std::mutex mutex_;
+    };
+
+    // Cache shared by the creator: $XDG_CACHE_HOME/bitlite/hashes, falling back
+    // to ~/.cache/bitlite/hashes. nullptr when neither can be created.
+    HashCache *default_hash_cache();
+
+}
+
+#endif // HASH_CACHE_HPP
@@ -0,0 +1,78 @@
+#ifndef MERKLE_HPP
+#define MERKLE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace torrent {
+
+    // BitTorrent v2 (BEP 52) hashes every file as a binary SHA-256 merkle tree
+    // whose leaves are 16 KiB blocks. The final block may be short; leaves past
+    // the end of the file are all-zero hashes up to the next power of two.
+    constexpr size_t merkle_block_size = 16384;
+
+    using Sha256Digest = std::array<unsigned char, 32>;
+
+    Sha256Digest sha256(const void *data, size_t length);
+
+    // Root of a subtree of 2^level zero leaves
+    const Sha256Digest &merkle_pad(unsigned level);
+
+    // Root over `count` leaves padded with zero leaves to `width`, a power of
+    // two no smaller than count
+    Sha256Digest merkle_root(const Sha256Digest *leaves, size_t count, size_t width);
+
+    // Checks one block against a root. proof holds the sibling hashes from the
+    // leaf level upwards, as carried by BEP 52 hash messages.
+    bool verify_block(std::string_view block, size_t index, const std::vector<Sha256Digest> &proof,
+                      const Sha256Digest &root);
+
+    // Checks a piece against its `piece layers` entry. The last piece of a file
+    // may be short; its missing blocks count as zero leaves.
+    bool verify_piece(std::string_view piece, int64_t piece_length, const Sha256Digest &expected);
+
+    // Builds a file's tree while it streams past. Only one partial block and
+    // one pending node per tree level are held, plus the piece layer output.
+    class MerkleTreeBuilder {
+    public:
+        // piece_length must be a power of two of at least one block
+        explicit MerkleTreeBuilder(int64_t piece_length);
+
+        void update(const char *data, size_t length);
+
+        // Completes the tree and returns the file's `pieces root`. Empty
+        // files have no root and return an all-zero digest.
+        Sha256Digest finish();
+
+        // Concatenated piece-level hashes, available after finish(). Empty for
+        // files no larger than one piece, which have no `piece layers` entry.
+        const std::string &piece_layer() const { return layer_; }
+
+        uint64_t length() const { return length_; }
+
+    private:
+        struct Node {
+            Sha256Digest hash;
+            unsigned level;
+        };
+
+        void push(const Sha256Digest &leaf);
+        void add(Node node);
+
+        std::vector<Node> stack_;
+        std::string layer_;
+        std::vector<char> block_;
+        size_t block_used_ = 0;
+        unsigned piece_level_;
+        int64_t piece_length_;
+        uint64_t leaves_ = 0;
+        uint64_t length_ = 0;
+    };
+
+}
+
+#endif // MERKLE_HPP
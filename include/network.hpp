@@ -31,6 +31,13 @@ std::string generate_peer_id();
 
 int connect_to_peer_http(const std::string& ip, int port);
 
+// The 68-byte BitTorrent handshake: pstrlen, pstr, reserved, info_hash, peer_id.
+// `fast_extension` sets the reserved bit offering BEP 6.
+std::array<uint8_t, 68> build_handshake(const std::string &info_hash, const std::string &peer_id,
+                                        bool fast_extension = false);
+
+// Blocking handshake for the helpers below, which only speak BEP 3, so no
+// extension bits are offered
 void send_handshake(int sockfd, const std::string &info_hash, const std::string &peer_id);
 
 bool receive_handshake(int sockfd);
@@ -0,0 +1,189 @@
+#ifndef PEER_SESSION_HPP
+#define PEER_SESSION_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bitfield.hpp"
+#include "buffer_pool.hpp"
+#include "file_layout.hpp"
+#include "peer_wire.hpp"
+#include "reactor.hpp"
+#include "send_queue.hpp"
+
+namespace torrent {
+
+    struct PeerSessionConfig {
+        // From the start of the connect until the peer's handshake arrives
+        std::chrono::milliseconds handshake_timeout{10000};
+        // How long to wait for a bitfield or have before deciding on interest anyway
+        std::chrono::milliseconds interested_timeout{5000};
+        // From declaring interest until the peer unchokes us
+        std::chrono::milliseconds unchoke_timeout{30000};
+        std::chrono::milliseconds keepalive_interval{120000};
+        // Longest message accepted: a 16 KiB block plus headers, or the bitfield
+        uint32_t max_message = (1 << 17);
+        // Offer the fast extension (BEP 6): have all / have none, explicit
+        // rejects, suggestions, and pieces allowed while choked
+        bool fast_extension = true;
+    };
+
+    // One outgoing peer connection driven by a Reactor. The session walks
+    // through connect, handshake, interest and unchoke on its own, each step
+    // guarded by a timer, and never blocks the reactor thread.
+    //
+    // Callbacks run on the reactor thread. They must not destroy the session
+    // directly; Reactor::post() the destruction instead.
+    class PeerSession {
+    public:
+        enum class State {
+            Connecting,       // non-blocking connect in flight
+            Handshaking,      // our handshake sent, waiting for theirs
+            AwaitingBitfield, // handshake done, learning what the peer has
+            Idle,             // the peer has nothing we lack; we may still upload to it
+            Interested,       // interest declared, waiting to be unchoked
+            Unchoked,         // the peer accepts requests
+            Closed
+        };
+
+        using StateHandler = std::function<void(PeerSession &)>;
+        // Piece blocks and bitfields are views into the receive ring, valid only
+        // for the duration of the call
+        using MessageHandler = std::function<void(PeerSession &, const wire::Message &)>;
+
+        PeerSession(Reactor &reactor, std::string ip, uint16_t port, std::string info_hash, std::string peer_id,
+                    size_t num_pieces, PeerSessionConfig config = {});
+        ~PeerSession();
+
+        PeerSession(const PeerSession &) = delete;
+        PeerSession &operator=(const PeerSession &) = delete;
+
+        void on_state_change(StateHandler handler) { on_state_ = std::move(handler); }
+        // Every message after the handshake except keep-alives, once the session
+        // has applied it
+        void on_message(MessageHandler handler) { on_message_ = std::move(handler); }
+
+        // Starts the connect; failures show up as a transition to Closed
+        void start();
+
+        // Pieces we have. Interest is then declared only while the peer has
+        // a piece we lack, and withdrawn once it has none; without this the
+        // session is interested in every peer. The bitfield must outlive the
+        // session; call update_interest() after it changes.
+        void set_our_pieces(const Bitfield &ours);
+        void update_interest();
+
+        // Queues a length-prefixed message; sent as soon as the socket allows
+        void send(uint8_t id, std::string_view payload = {});
+        void request_block(uint32_t index, uint32_t begin, uint32_t length);
+        void cancel_block(uint32_t index, uint32_t begin, uint32_t length);
+        // Serves a block, straight from the files or from a filled buffer.
+        // File descriptors in the ranges must stay open until it's sent.
+        void send_piece(uint32_t index, uint32_t begin, const std::vector<FileRange> &ranges);
+        void send_piece(uint32_t index, uint32_t begin, BufferPool::Buffer buffer, size_t length);
+        // Withdraws a block not yet started, for the peer's cancel
+        bool cancel_piece(uint32_t index, uint32_t begin, uint32_t length);
+        // Chokes or unchokes the peer; choking drops unstarted blocks other
+        // than those of pieces allowed fast, and rejects them under the fast
+        // extension
+        void set_choking(bool choking);
+
+        // Tells the peer what we have, right after the handshake: have all or
+        // have none under the fast extension, a bitfield otherwise (left out
+        // when empty, as BEP 3 allows). Called earlier, it is sent once the
+        // peer's handshake shows which applies. The fast extension requires
+        // one of them, so have none goes out by itself if nothing was sent
+        // by the time the handshake's state handler returns.
+        void send_have_set(const Bitfield &have);
+        // Fast extension messages; no-ops when it wasn't negotiated
+        void reject_request(uint32_t index, uint32_t begin, uint32_t length);
+        void suggest_piece(uint32_t index);
+        // Lets the peer request the piece even while we choke it
+        void allow_fast(uint32_t index);
+
+        // While corked, sends only queue; uncorking writes them out together
+        void cork() { ++corked_; }
+        void uncork();
+
+        void close(const std::string &reason);
+
+        State state() const { return state_; }
+        const std::string &error() const { return error_; }
+        const std::string &ip() const { return ip_; }
+        uint16_t port() const { return port_; }
+        const std::string &info_hash() const { return info_hash_; }
+        const std::string &remote_peer_id() const { return remote_peer_id_; }
+        const Bitfield &bitfield() const { return bitfield_; }
+        bool peer_choking() const { return peer_choking_; }
+        bool peer_interested() const { return peer_interested_; }
+        bool am_choking() const { return am_choking_; }
+        bool am_interested() const { return am_interested_; }
+        const SendQueue &send_queue() const { return send_queue_; }
+        // Both sides offered the fast extension
+        bool fast_extension() const { return fast_; }
+        // Pieces the peer lets us request while it chokes us
+        const std::vector<uint32_t> &allowed_fast() const { return allowed_fast_; }
+        // Whether we let the peer request the piece while we choke it
+        bool granted_fast(uint32_t index) const;
+
+    private:
+        void on_events(uint32_t events);
+        void on_connected();
+        void flush();
+        void receive();
+        void process();
+        bool handle_handshake(const wire::Handshake &handshake);
+        void handle_message(const wire::Message &msg);
+        void decide_interest();
+        void declare_interest();
+        void lose_interest();
+        void write_have_set(const Bitfield &have);
+        void set_state(State state);
+        void arm(Reactor::TimerId &timer, std::chrono::milliseconds delay, const char *reason);
+        void disarm(Reactor::TimerId &timer);
+        void schedule_keepalive();
+
+        Reactor &reactor_;
+        std::string ip_;
+        uint16_t port_;
+        std::string info_hash_;
+        std::string peer_id_;
+        PeerSessionConfig config_;
+
+        int fd_ = -1;
+        State state_ = State::Connecting;
+        std::string error_;
+
+        wire::Decoder decoder_;
+        SendQueue send_queue_;
+        int corked_ = 0;
+
+        std::string remote_peer_id_;
+        Bitfield bitfield_;
+        bool peer_choking_ = true;
+        bool peer_interested_ = false;
+        bool am_choking_ = true;
+        bool am_interested_ = false;
+        const Bitfield *ours_ = nullptr;
+        bool fast_ = false;
+        bool sent_have_set_ = false;
+        bool have_pending_ = false; // send_have_set() called before the handshake
+        Bitfield pending_have_;
+        std::vector<uint32_t> allowed_fast_;
+        std::vector<uint32_t> granted_fast_;
+
+        Reactor::TimerId step_timer_ = 0; // the current state's deadline
+        Reactor::TimerId keepalive_timer_ = 0;
+
+        StateHandler on_state_;
+        MessageHandler on_message_;
+    };
+
+    const char *peer_state_name(PeerSession::State state);
+
+}
+
+#endif // PEER_SESSION_HPP
@@ -0,0 +1,151 @@
+#ifndef PEER_WIRE_HPP
+#define PEER_WIRE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace torrent {
+namespace wire {
+
+    // BEP 3 message ids, plus the fast extension's (BEP 6). Ids outside this
+    // list (extensions) are passed through undecoded.
+    enum class MessageType : uint8_t {
+        Choke = 0,
+        Unchoke = 1,
+        Interested = 2,
+        NotInterested = 3,
+        Have = 4,
+        Bitfield = 5,
+        Request = 6,
+        Piece = 7,
+        Cancel = 8,
+        Port = 9,
+        SuggestPiece = 0x0D,
+        HaveAll = 0x0E,
+        HaveNone = 0x0F,
+        RejectRequest = 0x10,
+        AllowedFast = 0x11,
+    };
+
+    constexpr size_t handshake_size = 68;
+    constexpr uint32_t max_block_size = 16384;
+
+    // Reserved handshake bit announcing the fast extension
+    constexpr size_t fast_extension_byte = 7;
+    constexpr uint8_t fast_extension_bit = 0x04;
+
+    struct Handshake {
+        std::string_view reserved;  // 8 bytes of extension bits
+        std::string_view info_hash; // 20 bytes
+        std::string_view peer_id;   // 20 bytes
+
+        bool fast_extension() const
+        {
+            return reserved.size() == 8 && (uint8_t(reserved[fast_extension_byte]) & fast_extension_bit);
+        }
+    };
+
+    // One decoded message. The views point into the receive ring and stay
+    // valid until the decoder is asked for the next message.
+    struct Message {
+        bool keep_alive = false;
+        uint8_t id = 0;
+        uint32_t index = 0;  // have, request, piece, cancel, and the fast extension's
+        uint32_t begin = 0;  // request, piece, cancel, reject
+        uint32_t length = 0; // request, cancel, reject; block size for piece
+        uint16_t port = 0;   // port (DHT)
+        std::string_view payload; // bitfield bits, piece block, or an unknown message's body
+
+        MessageType type() const { return static_cast<MessageType>(id); }
+    };
+
+    // Byte ring mapped twice back to back in virtual memory, so every span of
+    // readable or writable bytes is contiguous however it wraps. That lets a
+    // single recv() fill all free space and lets messages be read in place.
+    class RingBuffer {
+    public:
+        // Capacity is rounded up to whole pages
+        explicit RingBuffer(size_t min_capacity);
+        ~RingBuffer();
+
+        RingBuffer(const RingBuffer &) = delete;
+        RingBuffer &operator=(const RingBuffer &) = delete;
+
+        size_t capacity() const { return capacity_; }
+        size_t readable() const { return static_cast<size_t>(tail_ - head_); }
+        size_t writable() const { return capacity_ - readable(); }
+
+        const char *read_ptr() const { return base_ + (head_ % capacity_); }
+        char *write_ptr() { return base_ + (tail_ % capacity_); }
+
+        void consume(size_t n) { head_ += n; }
+        void commit(size_t n) { tail_ += n; }
+
+    private:
+        char *base_ = nullptr;
+        size_t capacity_ = 0;
+        uint64_t head_ = 0;
+        uint64_t tail_ = 0;
+    };
+
+    // Frames peer wire messages out of a per-connection ring buffer
+    class Decoder {
+    public:
+        enum class FillResult {
+            Drained, // the socket has nothing more for now (EAGAIN)
+            Full,    // the ring filled up; decode, then fill again
+            Closed,  // orderly shutdown by the peer
+            Error    // errno is set
+        };
+
+        // max_message caps the length prefix accepted; the ring is sized to
+        // hold a few maximal messages at once
+        explicit Decoder(uint32_t max_message = (1 << 17));
+
+        // Reads everything the socket has, up to the free space in the ring
+        FillResult fill(int fd);
+
+        // Appends bytes by hand (tests, or data arriving another way). Returns
+        // how many fitted.
+        size_t feed(std::string_view data);
+
+        // The 68-byte handshake that opens every connection, once complete.
+        // Throws on a foreign protocol string.
+        std::optional<Handshake> next_handshake();
+
+        // The next complete message, if one has arrived. Releases the
+        // previous message's bytes. Throws on malformed messages.
+        std::optional<Message> next();
+
+        size_t buffered() const { return ring_.readable() - pending_; }
+
+    private:
+        RingBuffer ring_;
+        uint32_t max_message_;
+        size_t pending_ = 0; // bytes of the last returned message, released on the next call
+    };
+
+    // Encoders append one framed message to `out`
+    void write_keep_alive(std::string &out);
+    void write_message(std::string &out, MessageType type); // choke .. not interested, have all, have none
+    void write_have(std::string &out, uint32_t index);
+    void write_bitfield(std::string &out, std::string_view bits);
+    void write_request(std::string &out, uint32_t index, uint32_t begin, uint32_t length);
+    void write_cancel(std::string &out, uint32_t index, uint32_t begin, uint32_t length);
+    void write_port(std::string &out, uint16_t port);
+    void write_suggest_piece(std::string &out, uint32_t index);
+    void write_reject_request(std::string &out, uint32_t index, uint32_t begin, uint32_t length);
+    void write_allowed_fast(std::string &out, uint32_t index);
+    void write_piece(std::string &out, uint32_t index, uint32_t begin, std::string_view block);
+    // Just the header of a piece message, for blocks sent straight from disk
+    void write_piece_header(std::string &out, uint32_t index, uint32_t begin, uint32_t block_length);
+    // Any message by id, for extensions
+    void write_raw(std::string &out, uint8_t id, std::string_view payload);
+
+}
+}
+
+#endif // PEER_WIRE_HPP
@@ -0,0 +1,47 @@
+#ifndef PIECE_HASHER_HPP
+#define PIECE_HASHER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace torrent {
+
+    // Worker count used when 0 is requested: one per hardware thread
+    unsigned default_hash_workers();
+
+    // Splits [data, data + size) into piece_length pieces and writes their SHA1
+    // digests, in piece order, to out (20 bytes per piece). Pieces are hashed in
+    // place on up to `workers` threads; the calling thread is one of them.
+    void hash_pieces(const char *data, size_t size, int64_t piece_length, char *out, unsigned workers = 0);
+
+    // Same as above, returning the concatenated digests
+    std::string hash_pieces(const char *data, size_t size, int64_t piece_length, unsigned workers = 0);
+
+    // Streams a file through FileSource in constant memory and hashes its
+    // pieces as above. Returns the concatenated digests in piece order.
+    std::string hash_file_pieces(const std::string &path, int64_t piece_length, unsigned workers = 0);
+
+    // Hashes several files as one continuous stream, pieces spanning file
+    // boundaries, without concatenating them in memory. total_length is the
+    // sum of the file sizes and only sizes the read-ahead buffers.
+    std::string hash_files_pieces(const std::vector<std::string> &paths, uint64_t total_length,
+                                  int64_t piece_length, unsigned workers = 0);
+
+    // Hashes of one file of a v2 (BEP 52) or hybrid torrent
+    struct FileHashes {
+        std::string pieces_root; // 32-byte merkle root, empty for empty files
+        std::string piece_layer; // piece-level merkle hashes, empty unless the file spans several pieces
+        std::string pieces;      // v1 SHA1 digests, hybrid torrents only
+    };
+
+    // Streams a file once, building its merkle tree and, when `v1` is set,
+    // its SHA1 pieces alongside. pad_last zero-fills the last v1 piece to full
+    // length, matching the BEP 47 pad file that follows it in a hybrid torrent.
+    FileHashes hash_file_v2(const std::string &path, int64_t piece_length, bool v1, bool pad_last,
+                            unsigned workers = 0);
+
+}
+
+#endif // PIECE_HASHER_HPP
@@ -0,0 +1,80 @@
+#ifndef PIECE_PICKER_HPP
+#define PIECE_PICKER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include "bitfield.hpp"
+
+namespace torrent {
+
+    // Rarest-first piece selection. Every piece we still want sits in a
+    // doubly linked list for its availability count, so a have, a new peer
+    // or a lost peer moves each affected piece between neighbouring lists in
+    // O(1), and the rarest pieces are always at the front of the lowest
+    // non-empty list. Seeds are counted once rather than per piece, so they
+    // come and go in O(1) too; other peers cost O(pieces they have).
+    //
+    // Picking for a seed takes the head of the lowest non-empty list in
+    // O(1). For other peers it costs O(min(wanted pieces, pieces they have)):
+    // the lists are walked until a piece the peer has turns up, unless going
+    // through the peer's own pieces is shorter.
+    //
+    // Ties are broken by linking pieces at a random end of their list, so
+    // peers running the same picker don't all chase the same piece.
+    class PiecePicker {
+    public:
+        explicit PiecePicker(size_t num_pieces, uint64_t seed = 0);
+
+        size_t num_pieces() const { return avail_.size(); }
+
+        // ----- Availability -----
+        void add_seed() { ++seeds_; }
+        void remove_seed();
+        void add_peer(const Bitfield &bits);
+        void remove_peer(const Bitfield &bits);
+        void add_have(uint32_t index);
+        void remove_have(uint32_t index);
+        // Copies of the piece among connected peers, seeds included
+        uint32_t availability(uint32_t index) const { return avail_[index] + seeds_; }
+        uint32_t seeds() const { return seeds_; }
+
+        // ----- Our side -----
+        // Downloading pieces are skipped by pick() until finished or aborted
+        void mark_downloading(uint32_t index);
+        void abort_download(uint32_t index);
+        void mark_have(uint32_t index);
+        const Bitfield &have() const { return have_; }
+        bool complete() const { return have_.all(); }
+
+        // Whether the peer has anything we lack
+        bool interested_in(const Bitfield &peer) const { return has_missing(have_, peer); }
+
+        // The rarest piece the peer has that we want and haven't started
+        std::optional<uint32_t> pick(const Bitfield &peer) const;
+
+    private:
+        enum class Status : uint8_t { Wanted, Downloading, Have };
+
+        void link(uint32_t index);
+        void unlink(uint32_t index);
+        void raise(uint32_t index);
+        void lower(uint32_t index);
+        bool coin();
+
+        std::vector<uint32_t> avail_; // per piece, seeds excluded
+        std::vector<int32_t> prev_;
+        std::vector<int32_t> next_;
+        std::vector<Status> status_;
+        std::vector<int32_t> head_;   // per availability count
+        std::vector<int32_t> tail_;
+        Bitfield have_;
+        uint32_t seeds_ = 0;
+        size_t listed_; // pieces still Wanted, i.e. in the lists
+        uint64_t rng_;
+    };
+
+}
+
+#endif // PIECE_PICKER_HPP
@@ -0,0 +1,81 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace torrent {
+
+    // Single-threaded event loop over edge-triggered epoll, with one-shot
+    // timers. Every callback runs on the thread that calls run(), so handlers
+    // need no locking. Because readiness is edge-triggered, a handler must
+    // read or write until EAGAIN before returning.
+    class Reactor {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using IoHandler = std::function<void(uint32_t events)>;
+        using TimerId = uint64_t;
+
+        Reactor();
+        ~Reactor();
+
+        Reactor(const Reactor &) = delete;
+        Reactor &operator=(const Reactor &) = delete;
+
+        // Watches fd for `events` (EPOLLIN, EPOLLOUT, ...); EPOLLET is implied.
+        // The reactor doesn't own the descriptor; remove() it before closing.
+        void add(int fd, uint32_t events, IoHandler handler);
+        void remove(int fd);
+
+        // Runs fn once after delay. Cancelling a fired or unknown timer is a no-op.
+        TimerId schedule(Clock::duration delay, std::function<void()> fn);
+        void cancel(TimerId id);
+
+        // Runs fn after the current round of events, e.g. to destroy the
+        // object whose handler is running
+        void post(std::function<void()> fn);
+
+        // Dispatches events until stop() is called or nothing is left to wait for
+        void run();
+        // One round: waits up to `timeout` for events, then runs due timers
+        void poll(Clock::duration timeout);
+        void stop() { stopped_ = true; }
+
+        size_t watched() const { return handlers_.size(); }
+
+    private:
+        struct Watch {
+            uint32_t generation;
+            std::shared_ptr<IoHandler> handler; // kept alive while it runs, even if removed
+        };
+
+        struct Timer {
+            Clock::time_point deadline;
+            TimerId id;
+            bool operator>(const Timer &other) const
+            {
+                return deadline != other.deadline ? deadline > other.deadline : id > other.id;
+            }
+        };
+
+        void run_timers();
+        void run_posted();
+
+        int epoll_fd_ = -1;
+        uint32_t generation_ = 0;
+        std::unordered_map<int, Watch> handlers_;
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+        std::unordered_map<TimerId, std::function<void()>> timer_fns_; // pending timers only
+        TimerId next_timer_ = 1;
+        std::vector<std::function<void()>> posted_;
+        bool stopped_ = false;
+    };
+
+}
+
+#endif // REACTOR_HPP
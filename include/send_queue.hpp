@@ -0,0 +1,90 @@
+#ifndef SEND_QUEUE_HPP
+#define SEND_QUEUE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "buffer_pool.hpp"
+#include "file_layout.hpp"
+
+namespace torrent {
+
+    // Outgoing bytes for one socket, in order. Small messages are coalesced
+    // into shared byte chunks; piece payloads are queued either as ranges of
+    // open files, sent with sendfile() so they never enter userspace, or as
+    // pooled buffers. Headers in front of a file range go out with MSG_MORE
+    // so they share a segment with the payload behind them.
+    class SendQueue {
+    public:
+        enum class Result {
+            Done,    // everything queued has been sent
+            Blocked, // the socket is full; try again on EPOLLOUT
+            Error    // errno is set
+        };
+
+        // Where framed messages are appended with the wire encoders
+        std::string &bytes();
+        // Queues bytes ahead of everything else, such as a handshake behind
+        // messages queued before the connect finished. Only valid while
+        // nothing has been sent.
+        void prepend(std::string_view data);
+
+        // A piece message: its header, then the block from files or memory.
+        // Identified by (index, begin, length) so it can be cancelled.
+        void push_piece(uint32_t index, uint32_t begin, const std::vector<FileRange> &ranges);
+        void push_piece(uint32_t index, uint32_t begin, BufferPool::Buffer buffer, size_t length);
+
+        // Drops a queued piece message none of which has been sent yet
+        bool cancel_piece(uint32_t index, uint32_t begin, uint32_t length);
+        // A piece message's block, as the peer requested it
+        struct Block {
+            uint32_t index, begin, length;
+        };
+
+        // Drops every piece message not yet started, listing them in
+        // `cancelled` if given. Blocks of the pieces in `keep` stay queued.
+        size_t cancel_pieces(std::vector<Block> *cancelled = nullptr, const std::vector<uint32_t> *keep = nullptr);
+
+        Result flush(int fd);
+        void clear();
+
+        bool empty() const { return chunks_.empty(); }
+        size_t queued_pieces() const { return queued_pieces_; }
+        // Payload bytes that went out by sendfile and by copy
+        uint64_t bytes_sent_zero_copy() const { return bytes_zero_copy_; }
+        uint64_t bytes_sent_copied() const { return bytes_copied_; }
+
+    private:
+        enum class Kind : uint8_t { Bytes, File, Buffer };
+
+        struct Chunk {
+            Kind kind = Kind::Bytes;
+            std::string bytes;         // Bytes
+            FileRange file{-1, 0, 0};  // File
+            BufferPool::Buffer buffer; // Buffer
+            size_t length = 0;         // File and Buffer
+            size_t sent = 0;
+            // Set on the header chunk of a piece message; its payload
+            // chunks follow it
+            bool piece = false;
+            uint32_t index = 0, begin = 0, block_length = 0;
+            size_t payload_chunks = 0;
+            bool payload = false; // a file or buffer chunk carrying a block
+        };
+
+        size_t chunk_size(const Chunk &chunk) const;
+        Chunk &piece_header(uint32_t index, uint32_t begin, uint32_t length, size_t payload_chunks);
+        void pop_front();
+
+        std::deque<Chunk> chunks_;
+        size_t queued_pieces_ = 0;
+        uint64_t bytes_zero_copy_ = 0;
+        uint64_t bytes_copied_ = 0;
+    };
+
+}
+
+#endif // SEND_QUEUE_HPP
@@ -0,0 +1,39 @@
+#ifndef SHA1_HPP
+#define SHA1_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace torrent {
+
+    // SHA-1 engines. The multi-buffer backends hash several equal-length
+    // buffers at once, one per SIMD lane, which is what piece hashing needs.
+    enum class Sha1Backend {
+        OpenSSL, // one buffer at a time through libcrypto
+        ShaNi,   // x86 SHA extensions, one buffer at a time
+        Avx2,    // 8 lanes
+        Avx512   // 16 lanes
+    };
+
+    constexpr size_t sha1_digest_size = 20;
+
+    // Backend picked once at startup from the CPU's features
+    Sha1Backend sha1_backend();
+
+    bool sha1_backend_supported(Sha1Backend backend);
+    const char *sha1_backend_name(Sha1Backend backend);
+
+    // Buffers hashed together by a backend (1 for single-buffer ones)
+    size_t sha1_lanes(Sha1Backend backend);
+
+    // Hashes one buffer
+    void sha1_digest(const void *data, size_t length, unsigned char *out);
+
+    // Hashes `count` buffers of the same length, writing digests to
+    // out + i * sha1_digest_size
+    void sha1_many(const char *const *data, size_t count, size_t length, unsigned char *out);
+    void sha1_many(Sha1Backend backend, const char *const *data, size_t count, size_t length, unsigned char *out);
+
+}
+
+#endif // SHA1_HPP
@@ -0,0 +1,53 @@
+#ifndef SIGPIPE_GUARD_HPP
+#define SIGPIPE_GUARD_HPP
+
+#include <pthread.h>
+#include <csignal>
+#include <ctime>
+
+namespace torrent {
+
+    // Writes that can't pass MSG_NOSIGNAL (OpenSSL's write(), sendfile())
+    // raise SIGPIPE on a connection the peer has reset, and the default
+    // action kills the process. This blocks it for the calling thread and
+    // swallows one that became pending meanwhile, so the write just fails
+    // with EPIPE.
+    class SigpipeGuard {
+    public:
+        SigpipeGuard()
+        {
+            sigset_t pending;
+            sigpending(&pending);
+            was_pending_ = sigismember(&pending, SIGPIPE);
+            sigset_t block;
+            sigemptyset(&block);
+            sigaddset(&block, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &block, &old_);
+        }
+
+        ~SigpipeGuard()
+        {
+            sigset_t pending;
+            sigpending(&pending);
+            if (!was_pending_ && sigismember(&pending, SIGPIPE))
+            {
+                sigset_t sigpipe;
+                sigemptyset(&sigpipe);
+                sigaddset(&sigpipe, SIGPIPE);
+                timespec zero{};
+                sigtimedwait(&sigpipe, nullptr, &zero);
+            }
+            pthread_sigmask(SIG_SETMASK, &old_, nullptr);
+        }
+
+        SigpipeGuard(const SigpipeGuard &) = delete;
+        SigpipeGuard &operator=(const SigpipeGuard &) = delete;
+
+    private:
+        sigset_t old_;
+        bool was_pending_;
+    };
+
+}
+
+#endif // SIGPIPE_GUARD_HPP
@@ -0,0 +1,118 @@
+#ifndef STORAGE_HPP
+#define STORAGE_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "file_layout.hpp"
+#include "torrent_parser.hpp"
+
+namespace torrent {
+
+    struct StorageConfig {
+        // Bound on piece buffers held in memory: pieces being downloaded,
+        // verified pieces not yet written, and pieces being written
+        size_t cache_bytes = 64 << 20;
+        // Verified pieces are left to accumulate until this much is dirty, so
+        // neighbours can go out together in one pwritev
+        size_t flush_bytes = 16 << 20;
+        // Reserve every file's full size on disk up front
+        bool preallocate = true;
+    };
+
+    // Downloaded data on its way to disk. Blocks land in a per-piece buffer
+    // inside a bounded write-back cache; a piece that passes its hash check
+    // becomes dirty, and a writer thread later takes all dirty pieces at
+    // once, merges runs of adjacent pieces and writes each run with one
+    // pwritev per file it touches. Nothing unverified ever reaches the disk.
+    //
+    // The owner calls everything but read() from one thread; read() may be
+    // called from any thread.
+    class Storage {
+    public:
+        Storage(const TorrentMetadata &metadata, std::string save_path, StorageConfig config = {});
+        // Writes out whatever is dirty. Errors at this point are lost; call
+        // flush() first to see them.
+        ~Storage();
+
+        Storage(const Storage &) = delete;
+        Storage &operator=(const Storage &) = delete;
+
+        const FileLayout &layout() const { return layout_; }
+
+        // Claims a buffer for a piece about to be downloaded. False if the
+        // cache has no room yet; dirty pieces are pushed to the writer so a
+        // later attempt can succeed.
+        bool begin_piece(uint32_t piece);
+        // Copies a block into its piece's buffer
+        void write_block(uint32_t piece, uint32_t begin, std::string_view data);
+        // The assembled piece, for hashing
+        std::string_view piece_data(uint32_t piece) const;
+        // Hash passed: the piece is queued for writing
+        void commit_piece(uint32_t piece);
+        // Hash failed or the download was abandoned: the buffer is dropped
+        void discard_piece(uint32_t piece);
+
+        // Reads payload data, from the cache where it's newer than the disk.
+        // Returns the bytes read, short at the end of the torrent or where
+        // files are missing.
+        size_t read(uint32_t piece, uint32_t begin, char *out, size_t length);
+        // Where a block sits on disk, for sending straight from the files.
+        // False if the block isn't only on disk: it's still in the cache,
+        // covers a pad file, or runs past the end or into a missing file.
+        // The descriptors stay owned by the Storage.
+        bool locate(uint32_t piece, uint32_t begin, size_t length, std::vector<FileRange> &out);
+
+        // Writes all dirty pieces and waits for them. Throws the first write
+        // error the writer thread hit.
+        void flush();
+        // flush(), then fdatasync every file
+        void sync();
+
+        size_t cached_bytes() const;
+        size_t dirty_bytes() const;
+
+    private:
+        enum class PieceState { Downloading, Dirty, Writing };
+
+        struct CachedPiece {
+            std::unique_ptr<char[]> data;
+            uint32_t size;
+            PieceState state;
+        };
+
+        void create_files();
+        int file_descriptor(size_t file, bool create);
+        void schedule_flush();
+        void writer_loop();
+        void write_run(uint64_t offset, const std::vector<std::pair<const char *, size_t>> &chunks);
+        void check_error();
+
+        FileLayout layout_;
+        StorageConfig config_;
+
+        std::vector<int> fds_; // -1 until opened
+        std::mutex fd_mutex_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable cv_;
+        std::map<uint32_t, CachedPiece> cache_; // ordered so runs are easy to find
+        size_t cached_bytes_ = 0;
+        size_t dirty_bytes_ = 0;
+        std::vector<uint32_t> queued_; // handed to the writer, in piece order
+        bool writing_ = false;
+        bool stopping_ = false;
+        std::string error_;
+
+        std::thread writer_;
+    };
+
+}
+
+#endif // STORAGE_HPP
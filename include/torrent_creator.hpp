@@ -9,16 +9,39 @@
 
 namespace torrent {
 
+    // Metadata formats a torrent can be created in
+    enum class TorrentVersion {
+        V1,     // SHA1 `pieces` (BEP 3)
+        V2,     // per-file SHA-256 merkle trees (BEP 52)
+        Hybrid  // both, readable by v1 and v2 clients
+    };
+
+    struct FileEntry {
+        std::vector<std::string> path; // components below the torrent's root directory
+        int64_t length;
+        std::string pieces_root; // v2 merkle root, empty for empty files
+        bool pad = false;        // BEP 47 padding, listed in v1 `files` only
+    };
+
     struct TorrentFile {
         std::string announce;  // Not required for offline mode
         std::string file_name;
-        int64_t file_length;
+        int64_t file_length;   // total of all files for multi-file torrents
         std::string piece_hashes;
         int64_t piece_length;
+        std::vector<FileEntry> files; // empty for single-file torrents
+        TorrentVersion version = TorrentVersion::V1;
+        std::string pieces_root;      // v2 single-file torrents
+        std::map<std::string, std::string> piece_layers; // v2: pieces root -> piece layer
     };
 
-    // Reads file content and splits into fixed size chunks, returns SHA1 concatenated hash string
-    std::string compute_piece_hashes(const std::string& file_path, int64_t piece_length = 16384);
+    // Lists the regular files below a directory in torrent order (sorted by path)
+    std::vector<FileEntry> list_directory_files(const std::string &directory);
+
+    // Reads file content and splits into fixed size chunks, returns SHA1 concatenated hash string.
+    // Pieces are hashed on `workers` threads (0 = one per core). Results go
+    // through the default hash cache, so unchanged files aren't read again.
+    std::string compute_piece_hashes(const std::string& file_path, int64_t piece_length = 16384, unsigned workers = 0);
 
     // Creates a .torrent dictionary in bencode format
     std::map<std::string, std::shared_ptr<bencode::Bencode>> create_torrent_dict(const TorrentFile& file);
@@ -32,8 +55,16 @@ namespace torrent {
     // Computes the SHA1 hash of a vector of characters
     std::string sha1_hash(const std::vector<char> &data);
 
-    // Creates a .torrent dictionary in bencode format and returns the encoded string
-    std::string create_torrent(const std::string &input_file, const std::string &announce_url, int piece_length);
+    // Computes the SHA1 hash of a byte range in place
+    std::string sha1_hash(const char *data, size_t size);
+
+    // Creates a .torrent dictionary in bencode format and returns the encoded string.
+    // A directory becomes a multi-file torrent whose pieces run across file
+    // boundaries. Pieces are hashed on `workers` threads (0 = one per core).
+    // v2 and hybrid torrents need a power-of-two piece length of at least 16 KiB;
+    // every file is read once for both hash formats.
+    std::string create_torrent(const std::string &input_file, const std::string &announce_url, int piece_length,
+                               unsigned workers = 0, TorrentVersion version = TorrentVersion::V1);
 
 }
 
@@ -0,0 +1,77 @@
+#ifndef TORRENT_INDEX_HPP
+#define TORRENT_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace torrent {
+
+    // One torrent as stored in the index. The views point into the mapped
+    // index file and stay valid as long as the TorrentIndex does.
+    struct IndexedTorrent {
+        std::string_view info_hash; // 20 bytes
+        std::string_view name;
+        std::string_view announce;
+        int64_t length;
+        int64_t piece_length;
+        std::string_view pieces;    // concatenated 20-byte SHA1 digests
+        std::string_view source;    // .torrent file name within the directory
+    };
+
+    // Read-only, memory-mapped summary of a directory of .torrent files,
+    // sorted by info-hash. Opening it costs one mmap and a bounds check of the
+    // record tables, however many torrents it holds.
+    class TorrentIndex {
+    public:
+        TorrentIndex() = default;
+
+        // Maps an existing index file; throws if it is missing or malformed
+        explicit TorrentIndex(const std::string &index_path);
+
+        TorrentIndex(TorrentIndex &&other) noexcept;
+        TorrentIndex &operator=(TorrentIndex &&other) noexcept;
+        ~TorrentIndex();
+
+        TorrentIndex(const TorrentIndex &) = delete;
+        TorrentIndex &operator=(const TorrentIndex &) = delete;
+
+        // Parses every .torrent file in `directory` on `workers` threads
+        // (0 = one per core) and writes the index. Files that fail to parse
+        // are remembered as such and left out.
+        static void build(const std::string &directory, const std::string &index_path, unsigned workers = 0);
+
+        // Maps the index if it still matches the directory (same file names,
+        // sizes and mtimes). Otherwise rebuilds it, re-parsing only the
+        // .torrent files that were added or changed.
+        static TorrentIndex load(const std::string &directory, const std::string &index_path, unsigned workers = 0);
+
+        size_t size() const;
+        IndexedTorrent operator[](size_t i) const;
+
+        // Binary search by the 20-byte info-hash
+        std::optional<IndexedTorrent> find(std::string_view info_hash) const;
+
+    private:
+        struct Header;
+        struct TorrentRecord;
+        struct SourceRecord;
+
+        static void write(const std::string &directory, const std::string &index_path, unsigned workers,
+                          const TorrentIndex *previous);
+        bool matches(const std::string &directory) const;
+        std::string_view blob(uint64_t offset, uint64_t length) const;
+        void unmap();
+
+        const char *map_ = nullptr;
+        size_t map_size_ = 0;
+        const Header *header_ = nullptr;
+        const TorrentRecord *torrents_ = nullptr;
+        const SourceRecord *sources_ = nullptr;
+    };
+
+}
+
+#endif // TORRENT_INDEX_HPP
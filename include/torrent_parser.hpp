@@ -1,25 +1,45 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <map>
 #include <memory>
+#include <vector>
 #include "bencode.hpp"
 #include "file_manager.hpp"
 
 using namespace bencode;
 
+struct TorrentFileInfo {
+    std::vector<std::string> path; // components below the torrent's root directory
+    int64_t length = 0;
+    std::string attr;        // BEP 47 flags, "p" for pad files
+    std::string pieces_root; // v2 only: SHA-256 merkle root (32 bytes), empty for empty files
+};
+
 class TorrentMetadata {
 public:
     std::string announce;
     std::string name;
     int64_t pieceLength;
     std::string pieces;
-    int64_t length = 0;
+    int64_t length = 0;   // total of all files for multi-file torrents
+    std::vector<TorrentFileInfo> files; // empty for single-file torrents
+    std::string infoHash; // SHA1 of the raw info dictionary (20 bytes), truncated SHA-256 for v2-only
+
+    // BitTorrent v2 (BEP 52), set for v2 and hybrid torrents
+    int64_t metaVersion = 1;
+    std::vector<TorrentFileInfo> fileTree;           // files in tree order, with their merkle roots
+    std::map<std::string, std::string> pieceLayers;  // pieces root -> concatenated piece hashes
+    std::string infoHashV2; // SHA-256 of the raw info dictionary (32 bytes)
 
     void print() const;
 };
 
 class TorrentParser {
 public:
+    // Parses the metadata and computes the info-hash in one pass over the file
     static std::shared_ptr<TorrentMetadata> parse(const std::string& filepath);
+    static std::shared_ptr<TorrentMetadata> parse_content(std::string_view content);
     static std::string parse_and_calculate_info_hash(const std::string& filepath);
 };
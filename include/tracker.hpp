@@ -0,0 +1,223 @@
+#pragma once
+
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "bencode_schema.hpp"
+
+// Decoded announce reply. The raw peer fields borrow from the response body.
+struct AnnounceResponse
+{
+    std::string failure_reason;
+    std::string warning_message;
+    int64_t interval = 0;
+    int64_t min_interval = 0;
+    std::string tracker_id;
+    int64_t complete = 0;
+    int64_t incomplete = 0;
+    bencode::RawValue peers;  // compact string or list of dictionaries
+    bencode::RawValue peers6; // compact IPv6 string
+};
+
+// Decodes a bencoded announce reply body straight into AnnounceResponse
+AnnounceResponse parse_announce_response(std::string_view body);
+
+// A peer address as 18 packed bytes. IPv4 addresses are stored IPv4-mapped
+// (::ffff:a.b.c.d) so both families share one layout.
+struct PeerEndpoint
+{
+    uint8_t ip[16];
+    uint16_t port; // host byte order
+
+    bool is_v4() const;
+    std::string address() const; // dotted quad or IPv6 text
+
+    bool operator==(const PeerEndpoint &other) const
+    {
+        return port == other.port && std::memcmp(ip, other.ip, sizeof(ip)) == 0;
+    }
+};
+
+struct PeerEndpointHash
+{
+    size_t operator()(const PeerEndpoint &peer) const;
+};
+
+// Peers already handed out, so re-announces only yield new ones
+class PeerSet
+{
+public:
+    // False if the peer was already known
+    bool insert(const PeerEndpoint &peer) { return peers_.insert(peer).second; }
+    bool erase(const PeerEndpoint &peer) { return peers_.erase(peer) != 0; }
+    bool contains(const PeerEndpoint &peer) const { return peers_.count(peer) != 0; }
+    size_t size() const { return peers_.size(); }
+    void reserve(size_t n) { peers_.reserve(n); }
+    void clear() { peers_.clear(); }
+
+private:
+    std::unordered_set<PeerEndpoint, PeerEndpointHash> peers_;
+};
+
+// Appends the peers in a compact string: 6 bytes each (BEP 23) or, with
+// `ipv6`, 18 bytes each (BEP 7). Peers in `known` are skipped and new ones
+// are added to it; pass null to keep duplicates. Returns how many were added.
+size_t parse_compact_peers(std::string_view compact, bool ipv6, PeerSet *known, std::vector<PeerEndpoint> &out);
+
+// Appends the peers of an announce reply, from `peers` in either compact
+// or dictionary form and from `peers6`, skipping those in `known` like
+// parse_compact_peers. Dictionary entries whose ip isn't a literal address
+// are skipped.
+size_t collect_peers(const AnnounceResponse &response, PeerSet *known, std::vector<PeerEndpoint> &out);
+
+// A complete HTTP/1.x response split in place. `body` points into the raw
+// response unless it was chunked, in which case it's reassembled in the
+// scratch string given to split_http_response.
+struct HttpResponseView
+{
+    int status = 0;
+    std::string_view headers; // header lines, without the status line
+    std::string_view body;
+};
+
+// Splits a whole response as read off the socket, e.g. the result of
+// send_http_request. Throws std::runtime_error if it's malformed or cut short.
+HttpResponseView split_http_response(std::string_view raw, std::string &scratch);
+
+// What we tell the tracker on each announce
+struct AnnounceRequest
+{
+    std::string info_hash; // 20 raw bytes
+    std::string peer_id;
+    uint16_t port = 0;
+    int64_t uploaded = 0;
+    int64_t downloaded = 0;
+    int64_t left = 0;
+    std::string event;      // started, stopped, completed, or empty
+    int numwant = -1;       // tracker default when negative
+    std::string tracker_id; // echoed back if a previous reply set one
+};
+
+// One torrent's swarm counts from a scrape
+struct ScrapeStats
+{
+    int64_t complete = 0;   // seeders
+    int64_t downloaded = 0; // completed downloads so far
+    int64_t incomplete = 0; // leechers
+};
+
+// The scrape URL belonging to an http(s) announce URL (BEP 48), or empty
+// if the tracker can't be scraped: the last path component must start with
+// "announce"
+std::string scrape_url(const std::string &announce_url);
+
+struct HttpResponse
+{
+    int status = 0;
+    std::vector<std::pair<std::string, std::string>> headers; // names lowercased
+    std::string body;
+
+    // Value of the first header with this lowercase name, empty if absent
+    std::string_view header(std::string_view name) const;
+};
+
+struct TrackerClientConfig
+{
+    // How long a resolved tracker address is reused
+    std::chrono::seconds dns_ttl{300};
+    // Applies to the connect and to each send and receive
+    std::chrono::milliseconds timeout{15000};
+    // Kept-alive connections unused for longer are closed instead of reused;
+    // trackers tend to drop them after a minute or so anyway
+    std::chrono::seconds idle_timeout{50};
+    // Check tracker certificates against the system trust store
+    bool verify_certificates = true;
+    size_t max_response = 8 << 20;
+};
+
+// Thrown by TrackerClient when the tracker can't be reached at all: its
+// host doesn't resolve, no connection can be made, or it stops answering.
+// Other failures are plain std::runtime_error.
+class TrackerUnreachable : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// HTTP(S) client for tracker announces, meant to be shared by every torrent.
+// Connections are kept alive and reused per host, HTTPS connections share
+// one SSL_CTX and resume earlier TLS sessions, and resolved addresses are
+// cached. Requests block the calling thread; several threads may use one
+// client at once.
+class TrackerClient
+{
+public:
+    explicit TrackerClient(TrackerClientConfig config = {});
+    ~TrackerClient();
+
+    TrackerClient(const TrackerClient &) = delete;
+    TrackerClient &operator=(const TrackerClient &) = delete;
+
+    // GET on an http or https host. A kept-alive connection the server
+    // closed in the meantime is retried once on a fresh one. Throws
+    // TrackerUnreachable on DNS, connect and timeout errors, and
+    // std::runtime_error on other network, TLS or protocol errors.
+    HttpResponse get(const std::string &scheme, const std::string &host, int port, const std::string &target);
+
+    // Announces to an http(s) tracker URL. `body` receives the reply, which
+    // the response's peer fields borrow from. Throws on HTTP errors as well.
+    AnnounceResponse announce(const std::string &announce_url, const AnnounceRequest &request, std::string &body);
+
+    // Scrapes several torrents in one request. Torrents the tracker doesn't
+    // know are missing from the result. Throws if the tracker has no scrape
+    // URL or refuses.
+    std::map<std::string, ScrapeStats> scrape(const std::string &announce_url, const std::vector<std::string> &info_hashes);
+
+    // Closes every idle connection and forgets cached addresses
+    void reset();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Address
+    {
+        sockaddr_storage addr;
+        socklen_t len;
+    };
+
+    struct CachedAddresses
+    {
+        std::vector<Address> addresses;
+        Clock::time_point expires;
+    };
+
+    struct Connection;
+
+    std::unique_ptr<Connection> take_idle(const std::string &key);
+    std::unique_ptr<Connection> open(const std::string &key, bool tls, const std::string &host, int port);
+    std::vector<Address> resolve(const std::string &host, int port);
+    void forget_address(const std::string &host, int port);
+    bool read_response(Connection &conn, HttpResponse &response, bool &reusable);
+    size_t receive(Connection &conn);
+    static int on_new_session(SSL *ssl, SSL_SESSION *session);
+
+    TrackerClientConfig config_;
+    SSL_CTX *ctx_ = nullptr;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::vector<std::unique_ptr<Connection>>> idle_;
+    std::unordered_map<std::string, CachedAddresses> dns_;
+    std::unordered_map<std::string, SSL_SESSION *> sessions_; // by host and port
+};
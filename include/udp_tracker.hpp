@@ -0,0 +1,189 @@
+#ifndef UDP_TRACKER_HPP
+#define UDP_TRACKER_HPP
+
+#include <sys/socket.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "reactor.hpp"
+#include "tracker.hpp"
+
+namespace torrent {
+
+    struct UdpTrackerConfig {
+        // BEP 15 waits 15 * 2^n seconds for a reply before retransmitting,
+        // for n from 0 up to 8, then gives up
+        std::chrono::milliseconds initial_timeout{15000};
+        int max_retransmits = 8;
+        // How long a tracker accepts a connection ID after issuing it
+        std::chrono::seconds connection_id_lifetime{60};
+        // How long a resolved tracker address, or a failed lookup, is reused
+        std::chrono::seconds dns_ttl{300};
+    };
+
+    struct UdpAnnounceResult {
+        std::string error; // the tracker's error message, or why it never answered
+        bool unreachable = false; // no reply at all, or the host didn't resolve
+        int64_t interval = 0;
+        int64_t leechers = 0;
+        int64_t seeders = 0;
+        // Compact peers: 6 bytes each from trackers reached over IPv4, 18
+        // bytes each (BEP 15's IPv6 form) from trackers reached over IPv6
+        std::string peers;
+        bool ipv6 = false;
+    };
+
+    struct UdpScrapeResult {
+        std::string error;
+        bool unreachable = false;
+        std::vector<ScrapeStats> stats; // in the order the info hashes were given
+    };
+
+    // BEP 15 tracker client. Announces and scrapes for any number of
+    // torrents and trackers share one non-blocking UDP socket on the
+    // reactor. Each tracker's connection ID is cached while it's valid, so
+    // a typical announce is one datagram each way; lost datagrams are
+    // retransmitted with exponential backoff. Host names are resolved on a
+    // helper thread, so a slow DNS server never stalls the reactor.
+    //
+    // Handlers run on the reactor thread and may start new requests, but
+    // must not destroy the UdpTracker directly.
+    class UdpTracker {
+    public:
+        using RequestId = uint64_t;
+        using AnnounceHandler = std::function<void(const UdpAnnounceResult &)>;
+        using ScrapeHandler = std::function<void(const UdpScrapeResult &)>;
+
+        // Most info hashes a scrape datagram can carry
+        static constexpr size_t max_scrape_hashes = 74;
+
+        UdpTracker(Reactor &reactor, UdpTrackerConfig config = {});
+        ~UdpTracker();
+
+        UdpTracker(const UdpTracker &) = delete;
+        UdpTracker &operator=(const UdpTracker &) = delete;
+
+        // `announce_url` is a udp:// URL. Requests to a tracker whose host
+        // is still being resolved wait for it; failures, including a host
+        // that didn't resolve within the last dns_ttl, are reported through
+        // the handler.
+        RequestId announce(const std::string &announce_url, const AnnounceRequest &request, AnnounceHandler handler);
+        RequestId announce(const std::string &host, uint16_t port, const AnnounceRequest &request,
+                           AnnounceHandler handler);
+        // At most max_scrape_hashes 20-byte info hashes
+        RequestId scrape(const std::string &host, uint16_t port, const std::vector<std::string> &info_hashes,
+                         ScrapeHandler handler);
+
+        // Drops a request without calling its handler
+        void cancel(RequestId id);
+
+        size_t pending() const { return requests_.size(); }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        enum class Action : uint32_t { Connect = 0, Announce = 1, Scrape = 2, Error = 3 };
+
+        struct Tracker {
+            std::string host;
+            uint16_t port = 0;
+            sockaddr_storage addr{};
+            socklen_t addr_len = 0;
+            // When the last lookup finished; unset until the first one, and
+            // again once the tracker stops answering
+            std::optional<Clock::time_point> resolved;
+            bool ipv6 = false;
+            bool resolving = false;
+            std::string resolve_error; // why the last lookup failed, if it did
+
+            uint64_t connection_id = 0;
+            Clock::time_point connected; // when connection_id was issued
+            bool has_connection = false;
+
+            // The connect exchange in flight, if any
+            uint32_t connect_transaction = 0;
+            int connect_attempt = 0;
+            Reactor::TimerId connect_timer = 0;
+            std::deque<RequestId> waiting; // requests held until resolved and connected
+        };
+
+        // A finished lookup, handed from the resolver thread to the reactor
+        struct Resolved {
+            std::string key;
+            sockaddr_storage addr{};
+            socklen_t addr_len = 0;
+            bool ipv6 = false;
+            std::string error;
+        };
+
+        struct Request {
+            std::string tracker;
+            Action action;
+            std::string body; // everything after the transaction ID
+            size_t num_hashes = 0;
+            uint32_t transaction = 0;
+            int attempt = 0;
+            Reactor::TimerId timer = 0;
+            AnnounceHandler on_announce;
+            ScrapeHandler on_scrape;
+        };
+
+        RequestId submit(const std::string &host, uint16_t port, Request request);
+        Tracker &tracker(const std::string &key);
+        void resolve(Tracker &tracker);
+        void resolver_loop();
+        Resolved lookup(const std::string &key) const;
+        void drain_resolved();
+        void on_resolved(const Resolved &result);
+        bool connection_valid(const Tracker &tracker) const;
+        void connect(Tracker &tracker);
+        void send_request(RequestId id);
+        void send_packet(const Tracker &tracker, uint64_t connection_id, Action action, uint32_t transaction,
+                         const std::string &body);
+        Reactor::Clock::duration backoff(int attempt) const;
+        void on_readable();
+        void on_datagram(const char *data, size_t size, const sockaddr_storage &from, socklen_t from_len);
+        void on_connect_timeout(const std::string &key);
+        void on_request_timeout(RequestId id);
+        void fail_tracker(Tracker &tracker, const std::string &error, bool unreachable);
+        void finish(RequestId id, const std::string &error, bool unreachable, const char *data = nullptr, size_t size = 0);
+        uint32_t new_transaction();
+
+        Reactor &reactor_;
+        UdpTrackerConfig config_;
+        int fd_ = -1;
+        bool dual_stack_ = false; // fd_ is AF_INET6 taking IPv4-mapped addresses too
+        std::mt19937 rng_;
+        uint32_t key_; // identifies us to trackers across IP changes
+
+        std::unordered_map<std::string, Tracker> trackers_; // by host:port
+        std::unordered_map<RequestId, Request> requests_;
+        // Transaction IDs in flight, to the request (or, for connects, the
+        // tracker key) they belong to
+        std::unordered_map<uint32_t, RequestId> transactions_;
+        std::unordered_map<uint32_t, std::string> connects_;
+        RequestId next_id_ = 1;
+
+        // Lookups run on one thread, started on first use; results come
+        // back through resolved_ and wake_fd_
+        std::mutex resolver_mutex_;
+        std::condition_variable resolver_cv_;
+        std::deque<std::string> lookups_; // tracker keys
+        std::vector<Resolved> resolved_;
+        bool stopping_ = false;
+        int wake_fd_ = -1;
+        std::thread resolver_;
+    };
+
+}
+
+#endif // UDP_TRACKER_HPP
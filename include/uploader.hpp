@@ -0,0 +1,97 @@
+#ifndef UPLOADER_HPP
+#define UPLOADER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bitfield.hpp"
+#include "buffer_pool.hpp"
+#include "file_layout.hpp"
+#include "peer_session.hpp"
+#include "peer_wire.hpp"
+#include "storage.hpp"
+
+namespace torrent {
+
+    struct UploadConfig {
+        // Send blocks from the files with sendfile(). Turn off when something
+        // has to see every byte on its way out, such as stream encryption;
+        // blocks are then copied through pooled buffers.
+        bool zero_copy = true;
+        // Requests a peer may have queued with us; more are ignored
+        size_t max_queued_requests = 250;
+        // Idle copy buffers kept for reuse
+        size_t pool_buffers = 64;
+        // Pieces from each peer's allowed fast set (BEP 6) it may fetch
+        // before we unchoke it; only pieces we have are offered
+        size_t allowed_fast = 10;
+    };
+
+    // The canonical allowed fast set of BEP 6: up to `count` distinct pieces
+    // derived from the info hash and the peer's network (the /24 of an IPv4
+    // address, the /48 of an IPv6 one), so reconnecting from elsewhere in
+    // that network doesn't earn a new set
+    std::vector<uint32_t> allowed_fast_set(const std::string &ip, std::string_view info_hash, uint32_t num_pieces,
+                                           size_t count);
+
+    // Serves block requests from peers we have unchoked. A block that is
+    // fully on disk goes out as a piece header followed by sendfile() from
+    // the files it spans, so the payload never crosses into userspace; one
+    // still in the write-back cache, or crossing a pad file, is copied into
+    // a pooled buffer instead.
+    //
+    // Like BlockScheduler it doesn't own sessions; the owner forwards the
+    // handshake and messages:
+    //
+    //     session.on_state_change([&](PeerSession &s) {
+    //         if (s.state() == PeerSession::State::AwaitingBitfield)
+    //             uploader.greet(s);
+    //     });
+    //     session.on_message([&](PeerSession &s, const wire::Message &m) { uploader.handle(s, m); });
+    //
+    // `have` is the set of verified pieces, e.g. BlockScheduler's picker's.
+    // The Storage must outlive every session it served. Everything runs on
+    // the reactor thread.
+    class Uploader {
+    public:
+        Uploader(Storage &storage, const Bitfield &have, UploadConfig config = {});
+
+        Uploader(const Uploader &) = delete;
+        Uploader &operator=(const Uploader &) = delete;
+
+        // Sends the peer our pieces and, under the fast extension, its
+        // allowed fast set, and has the session declare interest only when
+        // the peer has pieces we lack. Call once the handshake is done.
+        void greet(PeerSession &session);
+
+        // Acts on requests and cancels; other messages are ignored. Requests
+        // that can't be served are rejected under the fast extension.
+        void handle(PeerSession &session, const wire::Message &msg);
+
+        // Payload bytes handed to sessions, and how many went by copy
+        uint64_t bytes_served() const { return bytes_served_; }
+        uint64_t bytes_copied() const { return bytes_copied_; }
+        // Requests ignored or rejected: choked, over the queue limit, or
+        // unreadable
+        uint64_t requests_dropped() const { return requests_dropped_; }
+
+    private:
+        void serve(PeerSession &session, const wire::Message &msg);
+        void drop(PeerSession &session, const wire::Message &msg);
+
+        Storage &storage_;
+        const Bitfield &have_;
+        UploadConfig config_;
+        BufferPool pool_;
+        std::vector<FileRange> ranges_; // reused by every locate
+
+        uint64_t bytes_served_ = 0;
+        uint64_t bytes_copied_ = 0;
+        uint64_t requests_dropped_ = 0;
+    };
+
+}
+
+#endif // UPLOADER_HPP
@@ -0,0 +1,106 @@
+#ifndef VERIFIER_HPP
+#define VERIFIER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "torrent_parser.hpp"
+
+namespace torrent {
+
+    // Checks payload data on disk against a torrent's v1 piece hashes.
+    //
+    // A pool of I/O threads preads batches of consecutive pieces (crossing
+    // file boundaries, with BEP 47 pad files read as zeros) into a bounded set
+    // of buffers while hash workers check the filled ones, several pieces at a
+    // time through the multi-buffer SHA-1 engine. Missing or short files just
+    // fail the pieces they cover.
+    //
+    // A single-file torrent is checked against the digests in the default
+    // HashCache instead, so an unchanged file isn't read at all and one we
+    // wrote to is re-hashed only where it was invalidated.
+    class Verifier {
+    public:
+        // save_path is the directory holding the torrent's content, i.e. the
+        // single file or top-level directory named after the torrent
+        Verifier(const TorrentMetadata &metadata, std::string save_path, unsigned io_threads = 4,
+                 unsigned hash_workers = 0);
+        ~Verifier();
+
+        Verifier(const Verifier &) = delete;
+        Verifier &operator=(const Verifier &) = delete;
+
+        // Verifies every piece and returns the have-bitfield in wire order
+        // (BEP 3: piece 0 is the high bit of the first byte)
+        std::vector<uint8_t> run();
+
+        // Stops the current run early, or the next one if none is going;
+        // unchecked pieces are reported missing. Cleared as run() returns.
+        void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+        // Progress, readable from any thread while run() is going
+        uint64_t total_pieces() const { return total_pieces_; }
+        uint64_t pieces_checked() const { return pieces_checked_.load(std::memory_order_relaxed); }
+        uint64_t pieces_valid() const { return pieces_valid_.load(std::memory_order_relaxed); }
+        uint64_t bytes_read() const { return bytes_read_.load(std::memory_order_relaxed); }
+        double throughput() const; // bytes per second since run() started
+
+    private:
+        struct Segment {
+            std::string path;
+            uint64_t offset; // within the torrent's byte stream
+            uint64_t length;
+            bool pad;
+        };
+
+        struct Batch {
+            uint64_t first_piece = 0;
+            size_t pieces = 0;
+            size_t length = 0;
+            std::vector<char> data;
+            std::vector<uint8_t> readable; // per piece
+        };
+
+        bool check_cached();
+        void read_all();
+        void read_loop();
+        void hash_loop();
+        void read_batch(Batch &batch);
+        int file_descriptor(size_t segment);
+
+        std::string pieces_; // 20-byte SHA1 digests in piece order
+        int64_t piece_length_;
+        uint64_t total_length_ = 0;
+        uint64_t total_pieces_ = 0;
+        size_t batch_pieces_;
+        uint64_t total_batches_;
+        unsigned io_threads_;
+        unsigned hash_workers_;
+
+        std::vector<Segment> segments_;
+        std::vector<int> fds_; // -2 until first opened, -1 if the open failed
+        std::mutex fd_mutex_;
+
+        std::vector<Batch> buffers_;
+        std::vector<Batch *> free_;
+        std::deque<Batch *> ready_;
+        size_t readers_left_ = 0;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+
+        std::vector<uint8_t> valid_; // per piece
+        std::atomic<uint64_t> next_batch_{0};
+        std::atomic<bool> cancelled_{false};
+        std::atomic<uint64_t> pieces_checked_{0};
+        std::atomic<uint64_t> pieces_valid_{0};
+        std::atomic<uint64_t> bytes_read_{0};
+        std::atomic<int64_t> started_ns_{0}; // steady clock
+    };
+
+}
+
+#endif // VERIFIER_HPP
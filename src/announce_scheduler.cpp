@@ -0,0 +1,613 @@
+#include "announce_scheduler.hpp"
+#include "network.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace torrent
+{
+    // Announces falling due this close together go out on one timer
+    static constexpr auto coalesce_window = std::chrono::milliseconds(50);
+
+    AnnounceScheduler::AnnounceScheduler(Reactor &reactor, std::string peer_id, uint16_t port,
+                                         AnnounceSchedulerConfig config)
+        : reactor_(reactor), peer_id_(std::move(peer_id)), port_(port), config_(config),
+          rng_(std::random_device{}()), udp_(reactor, config.udp), http_(config.http)
+    {
+        if (peer_id_.size() != 20)
+            throw std::runtime_error("Peer ID must be 20 bytes");
+
+        wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd_ < 0)
+            throw std::runtime_error(std::string("Failed to create eventfd: ") + std::strerror(errno));
+        reactor_.add(wake_fd_, EPOLLIN, [this](uint32_t)
+                     { drain_completions(); });
+    }
+
+    AnnounceScheduler::~AnnounceScheduler()
+    {
+        {
+            // Trackers still get the stopped announces remove_torrent
+            // queued, for as long as one request may take; anything else
+            // pending is dropped
+            std::unique_lock<std::mutex> lock(http_mutex_);
+            http_jobs_.erase(std::remove_if(http_jobs_.begin(), http_jobs_.end(), [](const HttpJob &job)
+                                            { return !job.stopped; }),
+                             http_jobs_.end());
+            http_idle_cv_.wait_for(lock, config_.http.timeout, [this]
+                                   { return http_jobs_.empty(); });
+            stopping_ = true;
+            http_jobs_.clear();
+        }
+        http_cv_.notify_all();
+        for (auto &thread : http_threads_)
+            thread.join();
+
+        for (auto &[url, tracker] : trackers_)
+        {
+            if (tracker.timer)
+                reactor_.cancel(tracker.timer);
+            if (tracker.scrape_timer)
+                reactor_.cancel(tracker.scrape_timer);
+        }
+        reactor_.remove(wake_fd_);
+        ::close(wake_fd_);
+    }
+
+    // ----------------- Torrents -----------------
+
+    void AnnounceScheduler::add_torrent(const std::string &info_hash, const std::vector<std::string> &announce_urls,
+                                        int64_t left)
+    {
+        if (info_hash.size() != 20)
+            throw std::runtime_error("Info hash must be 20 bytes");
+
+        Torrent &torrent = torrents_[info_hash];
+        torrent.info_hash = info_hash;
+        torrent.left = left;
+
+        // One draw per torrent: its trackers hear about it together, but
+        // torrents added in one go are spread over the window
+        auto spread = std::chrono::duration_cast<Clock::duration>(config_.startup_spread);
+        std::uniform_int_distribution<Clock::rep> dist(0, std::max<Clock::rep>(spread.count(), 0));
+        Clock::time_point first = Clock::now() + Clock::duration(dist(rng_));
+
+        for (const auto &url : announce_urls)
+        {
+            if (find_announce(torrent, url))
+                continue;
+            Tracker *tracker = tracker_for(url);
+            if (!tracker)
+                continue;
+
+            Announce announce;
+            announce.tracker = url;
+            announce.due = first;
+            torrent.announces.push_back(std::move(announce));
+            tracker->torrents.push_back(info_hash);
+
+            // Announces bring counts of their own, so the first scrape can wait
+            if (tracker->scrapable && !tracker->scrape_timer)
+                schedule_scrape(*tracker, config_.scrape_interval);
+            reschedule(*tracker);
+        }
+    }
+
+    void AnnounceScheduler::remove_torrent(const std::string &info_hash)
+    {
+        auto it = torrents_.find(info_hash);
+        if (it == torrents_.end())
+            return;
+        Torrent &torrent = it->second;
+
+        AnnounceRequest request;
+        request.info_hash = info_hash;
+        request.peer_id = peer_id_;
+        request.port = port_;
+        request.uploaded = torrent.uploaded;
+        request.downloaded = torrent.downloaded;
+        request.left = torrent.left;
+        request.event = "stopped";
+        request.numwant = 0;
+
+        for (const Announce &announce : torrent.announces)
+        {
+            auto t = trackers_.find(announce.tracker);
+            if (t == trackers_.end())
+                continue;
+            Tracker &tracker = t->second;
+            auto &hashes = tracker.torrents;
+            hashes.erase(std::remove(hashes.begin(), hashes.end(), info_hash), hashes.end());
+
+            // A tracker that never had us in its swarm needn't hear we left
+            if (announce.interval.count() > 0)
+            {
+                request.tracker_id = announce.tracker_id;
+                ++announces_sent_;
+                if (tracker.udp)
+                {
+                    udp_.announce(tracker.host, tracker.port, request, nullptr);
+                }
+                else
+                {
+                    std::string url = tracker.url;
+                    run_http([this, url, request]() -> std::function<void()>
+                             {
+                        try
+                        {
+                            std::string body;
+                            http_.announce(url, request, body);
+                        }
+                        catch (const std::exception &)
+                        {
+                        }
+                        return nullptr; }, true);
+                }
+            }
+
+            if (hashes.empty())
+            {
+                if (tracker.timer)
+                    reactor_.cancel(tracker.timer);
+                if (tracker.scrape_timer)
+                    reactor_.cancel(tracker.scrape_timer);
+                trackers_.erase(t);
+            }
+        }
+        torrents_.erase(it);
+    }
+
+    void AnnounceScheduler::update(const std::string &info_hash, int64_t uploaded, int64_t downloaded, int64_t left)
+    {
+        auto it = torrents_.find(info_hash);
+        if (it == torrents_.end())
+            return;
+        it->second.uploaded = uploaded;
+        it->second.downloaded = downloaded;
+        it->second.left = left;
+    }
+
+    void AnnounceScheduler::completed(const std::string &info_hash)
+    {
+        auto it = torrents_.find(info_hash);
+        if (it != torrents_.end())
+            it->second.left = 0;
+        kick(info_hash, "completed");
+    }
+
+    void AnnounceScheduler::announce_now(const std::string &info_hash)
+    {
+        kick(info_hash, nullptr);
+    }
+
+    // Brings a torrent's announces forward; reschedule() still holds them
+    // back until each tracker's min interval has passed
+    void AnnounceScheduler::kick(const std::string &info_hash, const char *event)
+    {
+        auto it = torrents_.find(info_hash);
+        if (it == torrents_.end())
+            return;
+        Clock::time_point now = Clock::now();
+        for (Announce &announce : it->second.announces)
+        {
+            // An unanswered `started` stays the event; the tracker needs it first
+            if (event && announce.event != "started")
+                announce.event = event;
+            announce.due = std::min(announce.due, now);
+            auto t = trackers_.find(announce.tracker);
+            if (t != trackers_.end())
+                reschedule(t->second);
+        }
+    }
+
+    AnnounceScheduler::Announce *AnnounceScheduler::find_announce(Torrent &torrent, const std::string &url)
+    {
+        for (Announce &announce : torrent.announces)
+            if (announce.tracker == url)
+                return &announce;
+        return nullptr;
+    }
+
+    // ----------------- Trackers -----------------
+
+    AnnounceScheduler::Tracker *AnnounceScheduler::tracker_for(const std::string &url)
+    {
+        auto it = trackers_.find(url);
+        if (it != trackers_.end())
+            return &it->second;
+
+        auto parts = split_announce_url(url); // protocol, host, port, path
+        if (parts[0] != "udp" && parts[0] != "http" && parts[0] != "https")
+            return nullptr;
+
+        Tracker tracker;
+        tracker.url = url;
+        tracker.udp = parts[0] == "udp";
+        tracker.host = parts[1];
+        tracker.port = static_cast<uint16_t>(std::stoi(parts[2]));
+        tracker.scrapable = tracker.udp || !scrape_url(url).empty();
+        return &trackers_.emplace(url, std::move(tracker)).first->second;
+    }
+
+    // Arms the tracker's timer for its earliest announce that may go out
+    void AnnounceScheduler::reschedule(Tracker &tracker)
+    {
+        Clock::time_point next = Clock::time_point::max();
+        for (const auto &hash : tracker.torrents)
+        {
+            Announce *announce = find_announce(torrents_.at(hash), tracker.url);
+            if (announce && !announce->in_flight)
+                next = std::min(next, std::max(announce->due, announce->min_until));
+        }
+
+        if (next == Clock::time_point::max())
+        {
+            if (tracker.timer)
+                reactor_.cancel(tracker.timer);
+            tracker.timer = 0;
+            return;
+        }
+        next = std::max(next, tracker.blocked_until);
+        if (tracker.timer && tracker.timer_at == next)
+            return;
+        if (tracker.timer)
+            reactor_.cancel(tracker.timer);
+
+        std::string url = tracker.url;
+        tracker.timer_at = next;
+        tracker.timer = reactor_.schedule(std::max(next - Clock::now(), Clock::duration::zero()), [this, url]
+                                          { run_tracker(url); });
+    }
+
+    void AnnounceScheduler::run_tracker(const std::string &url)
+    {
+        auto it = trackers_.find(url);
+        if (it == trackers_.end())
+            return;
+        Tracker &tracker = it->second;
+        tracker.timer = 0;
+
+        Clock::time_point now = Clock::now();
+        if (now >= tracker.blocked_until)
+        {
+            // A tracker that has been failing gets one announce at a time
+            // until it answers again
+            bool probing = tracker.failures > 0;
+            if (probing)
+                for (const auto &hash : tracker.torrents)
+                {
+                    Announce *announce = find_announce(torrents_.at(hash), url);
+                    if (announce && announce->in_flight)
+                        return;
+                }
+
+            Clock::time_point horizon = now + coalesce_window;
+            for (const auto &hash : tracker.torrents)
+            {
+                Torrent &torrent = torrents_.at(hash);
+                Announce *announce = find_announce(torrent, url);
+                if (announce && !announce->in_flight && announce->due <= horizon && announce->min_until <= now)
+                {
+                    send_announce(tracker, torrent, *announce);
+                    if (probing)
+                        break;
+                }
+            }
+        }
+        reschedule(tracker);
+    }
+
+    void AnnounceScheduler::send_announce(Tracker &tracker, Torrent &torrent, Announce &announce)
+    {
+        AnnounceRequest request;
+        request.info_hash = torrent.info_hash;
+        request.peer_id = peer_id_;
+        request.port = port_;
+        request.uploaded = torrent.uploaded;
+        request.downloaded = torrent.downloaded;
+        request.left = torrent.left;
+        request.event = announce.event;
+        request.numwant = config_.numwant;
+        request.tracker_id = announce.tracker_id;
+
+        // An event raised while this one is out is sent after it
+        announce.event.clear();
+        announce.in_flight = true;
+        ++announces_sent_;
+
+        std::string url = tracker.url;
+        std::string hash = torrent.info_hash;
+        if (tracker.udp)
+        {
+            udp_.announce(tracker.host, tracker.port, request,
+                          [this, url, hash, event = request.event](const UdpAnnounceResult &result)
+                          {
+                              AnnounceOutcome outcome;
+                              outcome.event = event;
+                              outcome.error = result.error;
+                              outcome.unreachable = result.unreachable;
+                              if (result.error.empty())
+                              {
+                                  outcome.interval = result.interval;
+                                  parse_compact_peers(result.peers, result.ipv6, nullptr, outcome.peers);
+                                  outcome.has_counts = true;
+                                  outcome.counts.complete = result.seeders;
+                                  outcome.counts.incomplete = result.leechers;
+                              }
+                              on_announced(url, hash, std::move(outcome));
+                          });
+            return;
+        }
+
+        run_http([this, url, hash, request]() -> std::function<void()>
+                 {
+            AnnounceOutcome outcome;
+            outcome.event = request.event;
+            try
+            {
+                std::string body;
+                AnnounceResponse response = http_.announce(url, request, body);
+                if (!response.failure_reason.empty())
+                {
+                    outcome.error = response.failure_reason;
+                }
+                else
+                {
+                    outcome.interval = response.interval;
+                    outcome.min_interval = response.min_interval;
+                    outcome.tracker_id = response.tracker_id;
+                    collect_peers(response, nullptr, outcome.peers);
+                    outcome.has_counts = true;
+                    outcome.counts.complete = response.complete;
+                    outcome.counts.incomplete = response.incomplete;
+                }
+            }
+            catch (const TrackerUnreachable &e)
+            {
+                outcome.error = e.what();
+                outcome.unreachable = true;
+            }
+            catch (const std::exception &e)
+            {
+                // An HTTP error status or a malformed reply: the tracker is
+                // up, so it's treated like a failure reason
+                outcome.error = e.what();
+            }
+            return [this, url, hash, outcome = std::move(outcome)]() mutable
+            { on_announced(url, hash, std::move(outcome)); }; });
+    }
+
+    void AnnounceScheduler::on_announced(const std::string &url, const std::string &info_hash,
+                                         AnnounceOutcome outcome)
+    {
+        auto t = trackers_.find(url);
+        auto it = torrents_.find(info_hash);
+        if (t == trackers_.end() || it == torrents_.end())
+            return;
+        Tracker &tracker = t->second;
+        Torrent &torrent = it->second;
+        Announce *announce = find_announce(torrent, url);
+        if (!announce)
+            return;
+        announce->in_flight = false;
+
+        Clock::time_point now = Clock::now();
+        std::vector<PeerEndpoint> fresh;
+        if (outcome.unreachable)
+        {
+            // Holds back every torrent on the tracker, not just this one
+            if (announce->event.empty() || outcome.event == "started")
+                announce->event = outcome.event;
+            tracker_failed(tracker);
+        }
+        else if (!outcome.error.empty())
+        {
+            // The tracker works but refused this torrent; ask again much later
+            tracker.failures = 0;
+            if (announce->event.empty() || outcome.event == "started")
+                announce->event = outcome.event;
+            auto interval = announce->interval.count() > 0 ? announce->interval : config_.default_interval;
+            announce->due = now + jittered(interval);
+        }
+        else
+        {
+            tracker.failures = 0;
+            tracker.blocked_until = {};
+            announce->interval = outcome.interval > 0 ? std::chrono::seconds(outcome.interval)
+                                                      : config_.default_interval;
+            announce->min_until = now + std::chrono::seconds(std::max<int64_t>(outcome.min_interval, 0));
+            announce->due = std::max(now + jittered(announce->interval), announce->min_until);
+            // A pending event goes out as soon as the tracker allows
+            if (!announce->event.empty())
+                announce->due = announce->min_until;
+            if (!outcome.tracker_id.empty())
+                announce->tracker_id = std::move(outcome.tracker_id);
+
+            fresh.reserve(outcome.peers.size());
+            for (const PeerEndpoint &peer : outcome.peers)
+                if (torrent.known.insert(peer))
+                    fresh.push_back(peer);
+        }
+        reschedule(tracker);
+
+        // Handlers may add or remove torrents, so nothing above is touched
+        // past here
+        if (!fresh.empty() && on_peers_)
+            on_peers_(info_hash, fresh);
+        if (outcome.error.empty() && outcome.has_counts && on_stats_)
+        {
+            // Announce replies carry no download count; keep the scraped one
+            outcome.counts.downloaded = -1;
+            on_stats_(info_hash, outcome.counts);
+        }
+    }
+
+    void AnnounceScheduler::tracker_failed(Tracker &tracker)
+    {
+        ++tracker.failures;
+        tracker.blocked_until = Clock::now() + backoff(tracker.failures);
+    }
+
+    // ----------------- Scrapes -----------------
+
+    void AnnounceScheduler::schedule_scrape(Tracker &tracker, Clock::duration delay)
+    {
+        std::string url = tracker.url;
+        tracker.scrape_timer = reactor_.schedule(jittered(delay), [this, url]
+                                                 { scrape(url); });
+    }
+
+    // One request per batch of torrents on the tracker, whatever their number
+    void AnnounceScheduler::scrape(const std::string &url)
+    {
+        auto it = trackers_.find(url);
+        if (it == trackers_.end())
+            return;
+        Tracker &tracker = it->second;
+        tracker.scrape_timer = 0;
+        if (!tracker.scrapable)
+            return;
+
+        Clock::time_point now = Clock::now();
+        if (now < tracker.blocked_until)
+        {
+            schedule_scrape(tracker, tracker.blocked_until - now);
+            return;
+        }
+
+        size_t batch = tracker.udp ? UdpTracker::max_scrape_hashes : std::max<size_t>(config_.http_scrape_batch, 1);
+        for (size_t first = 0; first < tracker.torrents.size(); first += batch)
+        {
+            size_t last = std::min(first + batch, tracker.torrents.size());
+            std::vector<std::string> hashes(tracker.torrents.begin() + first, tracker.torrents.begin() + last);
+            ++scrapes_sent_;
+            if (tracker.udp)
+            {
+                udp_.scrape(tracker.host, tracker.port, hashes,
+                            [this, url, hashes](const UdpScrapeResult &result)
+                            { on_scraped(url, hashes, result.stats, result.error); });
+                continue;
+            }
+            run_http([this, url, hashes = std::move(hashes)]() -> std::function<void()>
+                     {
+                std::vector<std::string> found;
+                std::vector<ScrapeStats> stats;
+                std::string error;
+                try
+                {
+                    auto files = http_.scrape(url, hashes);
+                    for (auto &[hash, counts] : files)
+                    {
+                        found.push_back(hash);
+                        stats.push_back(counts);
+                    }
+                }
+                catch (const std::exception &e)
+                {
+                    error = e.what();
+                }
+                return [this, url, found = std::move(found), stats = std::move(stats), error = std::move(error)]
+                { on_scraped(url, found, stats, error); }; });
+        }
+        schedule_scrape(tracker, config_.scrape_interval);
+    }
+
+    void AnnounceScheduler::on_scraped(const std::string &url, const std::vector<std::string> &hashes,
+                                       const std::vector<ScrapeStats> &stats, const std::string &error)
+    {
+        if (!error.empty() || !on_stats_)
+            return;
+        for (size_t i = 0; i < hashes.size() && i < stats.size(); ++i)
+        {
+            // The torrent may have left the tracker while the scrape was out
+            auto it = torrents_.find(hashes[i]);
+            if (it != torrents_.end() && find_announce(it->second, url))
+                on_stats_(hashes[i], stats[i]);
+        }
+    }
+
+    // ----------------- Timing -----------------
+
+    AnnounceScheduler::Clock::duration AnnounceScheduler::jittered(Clock::duration interval)
+    {
+        std::uniform_real_distribution<double> dist(0.0, std::clamp(config_.jitter, 0.0, 1.0));
+        return std::chrono::duration_cast<Clock::duration>(interval * (1.0 - dist(rng_)));
+    }
+
+    AnnounceScheduler::Clock::duration AnnounceScheduler::backoff(int failures)
+    {
+        Clock::duration delay = config_.retry_delay;
+        for (int i = 1; i < failures && delay < config_.max_retry_delay; ++i)
+            delay *= 2;
+        return jittered(std::min<Clock::duration>(delay, config_.max_retry_delay));
+    }
+
+    // ----------------- HTTP threads -----------------
+
+    void AnnounceScheduler::run_http(std::function<std::function<void()>()> work, bool stopped)
+    {
+        {
+            std::lock_guard<std::mutex> lock(http_mutex_);
+            http_jobs_.push_back(HttpJob{std::move(work), stopped});
+        }
+        // Started on first use, so UDP-only sessions run no threads
+        if (http_threads_.empty())
+            for (size_t i = 0; i < std::max<size_t>(config_.http_threads, 1); ++i)
+                http_threads_.emplace_back([this]
+                                           { http_loop(); });
+        http_cv_.notify_one();
+    }
+
+    void AnnounceScheduler::http_loop()
+    {
+        for (;;)
+        {
+            std::function<std::function<void()>()> job;
+            {
+                std::unique_lock<std::mutex> lock(http_mutex_);
+                http_cv_.wait(lock, [this]
+                              { return stopping_ || !http_jobs_.empty(); });
+                if (stopping_)
+                    return;
+                job = std::move(http_jobs_.front().work);
+                http_jobs_.pop_front();
+                if (http_jobs_.empty())
+                    http_idle_cv_.notify_all();
+            }
+
+            std::function<void()> done = job();
+            if (!done)
+                continue;
+            {
+                std::lock_guard<std::mutex> lock(http_mutex_);
+                if (stopping_)
+                    return;
+                completions_.push_back(std::move(done));
+            }
+            uint64_t one = 1;
+            [[maybe_unused]] ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+        }
+    }
+
+    void AnnounceScheduler::drain_completions()
+    {
+        // Reset the counter before taking the batch, so a completion queued
+        // after the swap raises a fresh edge
+        uint64_t count;
+        while (::read(wake_fd_, &count, sizeof(count)) > 0)
+        {
+        }
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lock(http_mutex_);
+            ready.swap(completions_);
+        }
+        for (auto &fn : ready)
+            fn();
+    }
+
+}
@@ -53,40 +53,66 @@ namespace bencode
     }
 
     // ----------------- Encoder -----------------
-    std::string encode(const BencodeValue &value)
+    static size_t digit_count(int64_t val)
     {
-        std::ostringstream oss;
+        uint64_t mag = val < 0 ? 0 - static_cast<uint64_t>(val) : static_cast<uint64_t>(val);
+        size_t count = val < 0 ? 2 : 1;
+        while (mag >= 10)
+        {
+            mag /= 10;
+            ++count;
+        }
+        return count;
+    }
+
+    static size_t string_size(const std::string &str)
+    {
+        return digit_count(static_cast<int64_t>(str.size())) + 1 + str.size();
+    }
 
+    size_t encoded_size(const BencodeValue &value)
+    {
         if (is_int(value))
         {
-            oss << 'i' << as_int(value) << 'e';
+            return digit_count(as_int(value)) + 2;
         }
         else if (is_string(value))
         {
-            const auto &str = as_string(value);
-            oss << str.length() << ':' << str;
+            return string_size(as_string(value));
         }
         else if (is_list(value))
         {
-            oss << 'l';
+            size_t size = 2;
             for (const auto &item : as_list(value))
             {
-                oss << encode(item->value);
+                size += encoded_size(item->value);
             }
-            oss << 'e';
+            return size;
         }
         else if (is_dict(value))
         {
-            oss << 'd';
+            size_t size = 2;
             for (const auto &[key, item] : as_dict(value))
             {
-                oss << key.length() << ':' << key;
-                oss << encode(item->value);
+                size += string_size(key) + encoded_size(item->value);
             }
-            oss << 'e';
+            return size;
         }
+        return 0;
+    }
 
-        return oss.str();
+    void encode_append(const BencodeValue &value, std::string &out)
+    {
+        size_t offset = out.size();
+        out.resize(offset + encoded_size(value));
+        encode_to(value, &out[offset]);
+    }
+
+    std::string encode(const BencodeValue &value)
+    {
+        std::string out;
+        encode_append(value, out);
+        return out;
     }
 
     // ----------------- Decoder -----------------
@@ -0,0 +1,162 @@
+#include "bencode_scan.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCODE_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace bencode
+{
+    namespace scan
+    {
+
+        using Kernel = DigitRun (*)(const char *, const char *);
+
+        // ----------------- Scalar -----------------
+        static DigitRun parse_scalar(const char *p, const char *end)
+        {
+            uint64_t val = 0;
+            bool overflow = false;
+            while (p != end && *p >= '0' && *p <= '9')
+            {
+                uint64_t d = uint64_t(*p - '0');
+                if (val > (UINT64_MAX - d) / 10)
+                    overflow = true;
+                val = val * 10 + d;
+                ++p;
+            }
+            return DigitRun{p, val, overflow};
+        }
+
+#ifdef BENCODE_SCAN_X86
+        // Converts n (1..8) digits at p, which must have 8 readable bytes
+        static uint64_t swar_digits(const char *p, size_t n)
+        {
+            uint64_t chunk;
+            std::memcpy(&chunk, p, sizeof(chunk));
+            chunk -= 0x3030303030303030ULL;
+            // Drop the bytes past the run, leaving leading zero digits
+            chunk <<= (8 - n) * 8;
+            chunk = (chunk * 10 + (chunk >> 8)) & 0x00FF00FF00FF00FFULL;
+            chunk = (chunk * 100 + (chunk >> 16)) & 0x0000FFFF0000FFFFULL;
+            chunk = (chunk * 10000 + (chunk >> 32)) & 0x00000000FFFFFFFFULL;
+            return chunk;
+        }
+
+        // Bitmask of the digit bytes in a 16 byte block
+        static inline unsigned digit_mask(__m128i block)
+        {
+            __m128i ge0 = _mm_cmpeq_epi8(_mm_max_epu8(block, _mm_set1_epi8('0')), block);
+            __m128i le9 = _mm_cmpeq_epi8(_mm_min_epu8(block, _mm_set1_epi8('9')), block);
+            return static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(ge0, le9)));
+        }
+
+        // Length of the digit run at the start of the block (16 if it fills the block)
+        static inline size_t run_length(unsigned mask)
+        {
+            unsigned stop = ~mask & 0xFFFFu;
+            return stop ? static_cast<size_t>(__builtin_ctz(stop)) : 16;
+        }
+
+        // ----------------- SSE2 -----------------
+        static DigitRun parse_sse2(const char *p, const char *end)
+        {
+            if (end - p < 16)
+                return parse_scalar(p, end);
+
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            size_t n = run_length(digit_mask(block));
+            // Runs that fill the block would need more than 16 digits anyway
+            if (n == 16)
+                return parse_scalar(p, end);
+            if (n == 0)
+                return DigitRun{p, 0, false};
+
+            uint64_t val = n <= 8 ? swar_digits(p, n)
+                                  : swar_digits(p, n - 8) * 100000000ULL + swar_digits(p + n - 8, 8);
+            return DigitRun{p + n, val, false};
+        }
+
+        // ----------------- SSE4.1 -----------------
+        __attribute__((target("sse4.1,ssse3")))
+        static DigitRun parse_sse41(const char *p, const char *end)
+        {
+            if (end - p < 16)
+                return parse_scalar(p, end);
+
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            size_t n = run_length(digit_mask(block));
+            if (n == 16)
+                return parse_scalar(p, end);
+            if (n == 0)
+                return DigitRun{p, 0, false};
+
+            // Right-align the n digits in the register, zero filling on the left
+            const __m128i iota = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+            __m128i shuffle = _mm_add_epi8(iota, _mm_set1_epi8(static_cast<char>(n - 16)));
+            __m128i digits = _mm_shuffle_epi8(_mm_sub_epi8(block, _mm_set1_epi8('0')), shuffle);
+
+            // Combine pairwise: 16 x 1 digit -> 8 x 2 -> 4 x 4 -> 2 x 8
+            __m128i pairs = _mm_maddubs_epi16(digits, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1));
+            __m128i quads = _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+            __m128i packed = _mm_packus_epi32(quads, quads);
+            __m128i octets = _mm_madd_epi16(packed, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+
+            uint64_t high = static_cast<uint32_t>(_mm_cvtsi128_si32(octets));
+            uint64_t low = static_cast<uint32_t>(_mm_extract_epi32(octets, 1));
+            return DigitRun{p + n, high * 100000000ULL + low, false};
+        }
+#endif
+
+        static Kernel select_kernel(const char **name)
+        {
+#ifdef BENCODE_SCAN_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3"))
+            {
+                *name = "sse4.1";
+                return parse_sse41;
+            }
+#if defined(__x86_64__)
+            // SSE2 is part of the x86-64 baseline
+            *name = "sse2";
+            return parse_sse2;
+#else
+            if (__builtin_cpu_supports("sse2"))
+            {
+                *name = "sse2";
+                return parse_sse2;
+            }
+#endif
+#endif
+            *name = "scalar";
+            return parse_scalar;
+        }
+
+        struct Dispatch
+        {
+            const char *name;
+            Kernel kernel;
+
+            Dispatch() { kernel = select_kernel(&name); }
+        };
+
+        static const Dispatch &dispatch()
+        {
+            static const Dispatch instance;
+            return instance;
+        }
+
+        DigitRun parse_digits(const char *p, const char *end)
+        {
+            return dispatch().kernel(p, end);
+        }
+
+        const char *active_kernel()
+        {
+            return dispatch().name;
+        }
+
+    }
+}
@@ -0,0 +1,144 @@
+#include "bencode_schema.hpp"
+#include "bencode_scan.hpp"
+#include <limits>
+
+namespace bencode
+{
+
+    static constexpr size_t max_depth = 512;
+
+    // ----------------- Reader -----------------
+    char Reader::peek() const
+    {
+        if (p_ == end_)
+            throw std::runtime_error("Unexpected end of input");
+        return *p_;
+    }
+
+    void Reader::expect(char c)
+    {
+        if (peek() != c)
+            throw std::runtime_error(std::string("Expected '") + c + "' at offset " + std::to_string(p_ - begin_));
+        ++p_;
+    }
+
+    bool Reader::consume_end()
+    {
+        if (peek() != 'e')
+            return false;
+        ++p_;
+        return true;
+    }
+
+    void Reader::enter()
+    {
+        if (++depth_ > max_depth)
+            throw std::runtime_error("Nesting too deep");
+    }
+
+    int64_t Reader::read_int()
+    {
+        expect('i');
+
+        bool negative = false;
+        if (p_ != end_ && *p_ == '-')
+        {
+            negative = true;
+            ++p_;
+        }
+
+        const uint64_t limit = negative ? uint64_t(std::numeric_limits<int64_t>::max()) + 1
+                                        : uint64_t(std::numeric_limits<int64_t>::max());
+        const char *digits = p_;
+        auto run = scan::parse_digits(p_, end_);
+        if (run.overflow || run.value > limit)
+            throw std::runtime_error("Integer out of range");
+        uint64_t val = run.value;
+        p_ = run.end;
+        if (p_ == end_)
+            throw std::runtime_error("Unterminated integer");
+        if (p_ == digits || *p_ != 'e')
+            throw std::runtime_error("Invalid integer");
+        ++p_; // skip 'e'
+
+        return negative ? int64_t(0 - val) : int64_t(val);
+    }
+
+    std::string_view Reader::read_string()
+    {
+        char c = peek();
+        if (c < '0' || c > '9')
+            throw std::runtime_error("Expected string at offset " + std::to_string(p_ - begin_));
+
+        auto run = scan::parse_digits(p_, end_);
+        p_ = run.end;
+        if (p_ == end_ || *p_ != ':')
+            throw std::runtime_error("Invalid string format");
+        ++p_; // skip ':'
+        if (run.overflow || uint64_t(end_ - p_) < run.value)
+            throw std::runtime_error("Not enough characters for string");
+        uint64_t len = run.value;
+
+        std::string_view str(p_, static_cast<size_t>(len));
+        p_ += len;
+        return str;
+    }
+
+    std::string_view Reader::skip()
+    {
+        // Iterative so that skipping deeply nested junk can't blow the stack
+        const char *start = p_;
+        size_t depth = 0;
+        do
+        {
+            char c = peek();
+            if (c == 'i')
+            {
+                read_int();
+            }
+            else if (c >= '0' && c <= '9')
+            {
+                read_string();
+            }
+            else if (c == 'l' || c == 'd')
+            {
+                ++p_;
+                ++depth;
+            }
+            else if (c == 'e' && depth > 0)
+            {
+                ++p_;
+                --depth;
+            }
+            else
+            {
+                throw std::runtime_error(std::string("Unknown type: ") + c);
+            }
+        } while (depth > 0);
+
+        return std::string_view(start, p_ - start);
+    }
+
+    // ----------------- Value readers -----------------
+    void read_value(Reader &r, int64_t &out)
+    {
+        out = r.read_int();
+    }
+
+    void read_value(Reader &r, std::string &out)
+    {
+        std::string_view str = r.read_string();
+        out.assign(str.data(), str.size());
+    }
+
+    void read_value(Reader &r, std::string_view &out)
+    {
+        out = r.read_string();
+    }
+
+    void read_value(Reader &r, RawValue &out)
+    {
+        out.bytes = r.skip();
+    }
+
+}
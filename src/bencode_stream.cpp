@@ -0,0 +1,307 @@
+#include "bencode_stream.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace bencode
+{
+
+    static constexpr size_t max_depth = 512;
+    static constexpr uint64_t max_key_length = 4096;
+    // Anything longer than this cannot be a real payload and most likely
+    // means we are parsing garbage
+    static constexpr uint64_t max_string_length = uint64_t(1) << 40;
+
+    static bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // ----------------- StreamParser -----------------
+    StreamParser::StreamParser(StreamHandler &handler) : handler_(handler)
+    {
+    }
+
+    void StreamParser::reset()
+    {
+        state_ = State::Value;
+        stack_.clear();
+        key_buf_.clear();
+    }
+
+    void StreamParser::finish() const
+    {
+        if (state_ != State::Done)
+            throw std::runtime_error("Unexpected end of input");
+    }
+
+    void StreamParser::value_done()
+    {
+        state_ = State::Value;
+        if (stack_.empty())
+            state_ = State::Done;
+        else if (stack_.back() == 'v')
+            stack_.back() = 'k';
+    }
+
+    void StreamParser::start_value(char c)
+    {
+        char top = stack_.empty() ? 0 : stack_.back();
+
+        if (top == 'k')
+        {
+            if (c == 'e')
+            {
+                stack_.pop_back();
+                handler_.end();
+                value_done();
+                return;
+            }
+            if (!is_digit(c))
+                throw std::runtime_error("Invalid dictionary key");
+            length_is_key_ = true;
+            number_ = uint64_t(c - '0');
+            state_ = State::Length;
+            return;
+        }
+
+        if (c == 'e')
+        {
+            if (top != 'l')
+                throw std::runtime_error(top == 'v' ? "Missing dictionary value" : "Unexpected end marker");
+            stack_.pop_back();
+            handler_.end();
+            value_done();
+            return;
+        }
+
+        if (c == 'i')
+        {
+            negative_ = false;
+            has_digits_ = false;
+            number_ = 0;
+            state_ = State::Int;
+        }
+        else if (is_digit(c))
+        {
+            length_is_key_ = false;
+            number_ = uint64_t(c - '0');
+            state_ = State::Length;
+        }
+        else if (c == 'l' || c == 'd')
+        {
+            if (stack_.size() >= max_depth)
+                throw std::runtime_error("Nesting too deep");
+            if (c == 'l')
+            {
+                stack_.push_back('l');
+                handler_.begin_list();
+            }
+            else
+            {
+                stack_.push_back('k');
+                handler_.begin_dict();
+            }
+        }
+        else
+        {
+            throw std::runtime_error(std::string("Unknown type: ") + c);
+        }
+    }
+
+    size_t StreamParser::feed(const char *data, size_t len)
+    {
+        const char *p = data;
+        const char *end = data + len;
+
+        while (p != end && state_ != State::Done)
+        {
+            switch (state_)
+            {
+            case State::Value:
+                start_value(*p++);
+                break;
+
+            case State::Int:
+            {
+                char c = *p++;
+                if (is_digit(c))
+                {
+                    const uint64_t limit = negative_ ? uint64_t(std::numeric_limits<int64_t>::max()) + 1
+                                                     : uint64_t(std::numeric_limits<int64_t>::max());
+                    uint64_t d = uint64_t(c - '0');
+                    if (number_ > (limit - d) / 10)
+                        throw std::runtime_error("Integer out of range");
+                    number_ = number_ * 10 + d;
+                    has_digits_ = true;
+                }
+                else if (c == '-' && !negative_ && !has_digits_)
+                {
+                    negative_ = true;
+                }
+                else if (c == 'e' && has_digits_)
+                {
+                    handler_.integer(negative_ ? int64_t(0 - number_) : int64_t(number_));
+                    value_done();
+                }
+                else
+                {
+                    throw std::runtime_error("Invalid integer");
+                }
+                break;
+            }
+
+            case State::Length:
+            {
+                char c = *p++;
+                if (is_digit(c))
+                {
+                    number_ = number_ * 10 + uint64_t(c - '0');
+                    if (number_ > max_string_length)
+                        throw std::runtime_error("String too long");
+                    break;
+                }
+                if (c != ':')
+                    throw std::runtime_error("Invalid string format");
+
+                remaining_ = number_;
+                if (length_is_key_)
+                {
+                    if (remaining_ > max_key_length)
+                        throw std::runtime_error("Dictionary key too long");
+                    key_buf_.clear();
+                    state_ = State::KeyBody;
+                    if (remaining_ == 0)
+                    {
+                        handler_.key(std::string_view());
+                        stack_.back() = 'v';
+                        state_ = State::Value;
+                    }
+                }
+                else
+                {
+                    handler_.begin_string(static_cast<size_t>(remaining_));
+                    state_ = State::StringBody;
+                    if (remaining_ == 0)
+                    {
+                        handler_.end_string();
+                        value_done();
+                    }
+                }
+                break;
+            }
+
+            case State::StringBody:
+            {
+                size_t n = static_cast<size_t>(std::min<uint64_t>(remaining_, uint64_t(end - p)));
+                handler_.string_data(std::string_view(p, n));
+                p += n;
+                remaining_ -= n;
+                if (remaining_ == 0)
+                {
+                    handler_.end_string();
+                    value_done();
+                }
+                break;
+            }
+
+            case State::KeyBody:
+            {
+                size_t n = static_cast<size_t>(std::min<uint64_t>(remaining_, uint64_t(end - p)));
+                if (key_buf_.empty() && n == remaining_)
+                {
+                    // Whole key is in this chunk, hand it out without copying
+                    handler_.key(std::string_view(p, n));
+                    p += n;
+                    remaining_ = 0;
+                }
+                else
+                {
+                    key_buf_.append(p, n);
+                    p += n;
+                    remaining_ -= n;
+                    if (remaining_ == 0)
+                    {
+                        handler_.key(key_buf_);
+                        key_buf_.clear();
+                    }
+                }
+                if (remaining_ == 0)
+                {
+                    stack_.back() = 'v';
+                    state_ = State::Value;
+                }
+                break;
+            }
+
+            case State::Done:
+                break;
+            }
+        }
+
+        return static_cast<size_t>(p - data);
+    }
+
+    // ----------------- ValueBuilder -----------------
+    void ValueBuilder::add(BencodeValue value)
+    {
+        if (stack_.empty())
+        {
+            result_ = std::move(value);
+            return;
+        }
+
+        Frame &top = stack_.back();
+        auto item = std::make_shared<Bencode>(Bencode{std::move(value)});
+        if (auto *list = std::get_if<std::vector<std::shared_ptr<Bencode>>>(&top.container))
+            list->push_back(std::move(item));
+        else
+            std::get<std::map<std::string, std::shared_ptr<Bencode>>>(top.container)[top.key] = std::move(item);
+    }
+
+    void ValueBuilder::begin_dict()
+    {
+        stack_.push_back(Frame{std::map<std::string, std::shared_ptr<Bencode>>{}, {}});
+    }
+
+    void ValueBuilder::begin_list()
+    {
+        stack_.push_back(Frame{std::vector<std::shared_ptr<Bencode>>{}, {}});
+    }
+
+    void ValueBuilder::end()
+    {
+        BencodeValue container = std::move(stack_.back().container);
+        stack_.pop_back();
+        add(std::move(container));
+    }
+
+    void ValueBuilder::key(std::string_view key)
+    {
+        stack_.back().key.assign(key.data(), key.size());
+    }
+
+    void ValueBuilder::integer(int64_t value)
+    {
+        add(value);
+    }
+
+    void ValueBuilder::begin_string(size_t length)
+    {
+        string_.clear();
+        // Length comes off the wire, don't let it force a huge allocation up front
+        string_.reserve(std::min<size_t>(length, 1 << 20));
+    }
+
+    void ValueBuilder::string_data(std::string_view data)
+    {
+        string_.append(data.data(), data.size());
+    }
+
+    void ValueBuilder::end_string()
+    {
+        add(std::move(string_));
+        string_.clear();
+    }
+
+}
@@ -0,0 +1,305 @@
+#include "bencode_view.hpp"
+#include "bencode_scan.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace bencode
+{
+
+    // Deeper nesting than this is treated as malformed input rather than
+    // risking the stack on hostile tracker replies.
+    static constexpr size_t max_depth = 512;
+
+    // ----------------- Parser -----------------
+    class Document::Parser
+    {
+    public:
+        Parser(Document &doc, std::string_view input)
+            : doc_(doc), p_(input.data()), end_(input.data() + input.size())
+        {
+        }
+
+        uint32_t parse_value(size_t depth)
+        {
+            if (p_ == end_)
+                throw std::runtime_error("Unexpected end of input");
+            if (depth > max_depth)
+                throw std::runtime_error("Nesting too deep");
+
+            const char *start = p_;
+            uint32_t index = static_cast<uint32_t>(doc_.nodes_.size());
+            doc_.nodes_.emplace_back();
+
+            char c = *p_;
+            if (c == 'i')
+            {
+                ++p_;
+                int64_t val = parse_int();
+                doc_.nodes_[index].type = NodeType::Int;
+                doc_.nodes_[index].integer = val;
+            }
+            else if (c >= '0' && c <= '9')
+            {
+                std::string_view str = parse_string();
+                doc_.nodes_[index].type = NodeType::String;
+                doc_.nodes_[index].string = str;
+            }
+            else if (c == 'l')
+            {
+                ++p_;
+                size_t mark = item_stack_.size();
+                while (p_ != end_ && *p_ != 'e')
+                {
+                    uint32_t child = parse_value(depth + 1);
+                    item_stack_.push_back(child);
+                }
+                if (p_ == end_)
+                    throw std::runtime_error("Unterminated list");
+                ++p_; // skip 'e'
+
+                Node &node = doc_.nodes_[index];
+                node.type = NodeType::List;
+                node.first = static_cast<uint32_t>(doc_.items_.size());
+                node.count = static_cast<uint32_t>(item_stack_.size() - mark);
+                doc_.items_.insert(doc_.items_.end(), item_stack_.begin() + mark, item_stack_.end());
+                item_stack_.resize(mark);
+            }
+            else if (c == 'd')
+            {
+                ++p_;
+                size_t mark = entry_stack_.size();
+                while (p_ != end_ && *p_ != 'e')
+                {
+                    if (*p_ < '0' || *p_ > '9')
+                        throw std::runtime_error("Invalid dictionary key");
+                    std::string_view key = parse_string();
+                    uint32_t child = parse_value(depth + 1);
+                    entry_stack_.push_back(DictEntry{key, child});
+                }
+                if (p_ == end_)
+                    throw std::runtime_error("Unterminated dict");
+                ++p_; // skip 'e'
+
+                size_t count = sort_entries(mark);
+                Node &node = doc_.nodes_[index];
+                node.type = NodeType::Dict;
+                node.first = static_cast<uint32_t>(doc_.entries_.size());
+                node.count = static_cast<uint32_t>(count);
+                doc_.entries_.insert(doc_.entries_.end(), entry_stack_.begin() + mark, entry_stack_.begin() + mark + count);
+                entry_stack_.resize(mark);
+            }
+            else
+            {
+                throw std::runtime_error(std::string("Unknown type: ") + c);
+            }
+
+            doc_.nodes_[index].raw = std::string_view(start, p_ - start);
+            return index;
+        }
+
+    private:
+        // Parses digits up to the 'e' terminator, the 'i' is already consumed
+        int64_t parse_int()
+        {
+            bool negative = false;
+            if (p_ != end_ && *p_ == '-')
+            {
+                negative = true;
+                ++p_;
+            }
+
+            const uint64_t limit = negative ? uint64_t(std::numeric_limits<int64_t>::max()) + 1
+                                            : uint64_t(std::numeric_limits<int64_t>::max());
+            const char *digits = p_;
+            auto run = scan::parse_digits(p_, end_);
+            if (run.overflow || run.value > limit)
+                throw std::runtime_error("Integer out of range");
+            uint64_t val = run.value;
+            p_ = run.end;
+            if (p_ == end_)
+                throw std::runtime_error("Unterminated integer");
+            if (p_ == digits || *p_ != 'e')
+                throw std::runtime_error("Invalid integer");
+            ++p_; // skip 'e'
+
+            return negative ? int64_t(0 - val) : int64_t(val);
+        }
+
+        std::string_view parse_string()
+        {
+            auto run = scan::parse_digits(p_, end_);
+            p_ = run.end;
+            if (p_ == end_ || *p_ != ':')
+                throw std::runtime_error("Invalid string format");
+            ++p_; // skip ':'
+            if (run.overflow || uint64_t(end_ - p_) < run.value)
+                throw std::runtime_error("Not enough characters for string");
+            uint64_t len = run.value;
+
+            std::string_view str(p_, static_cast<size_t>(len));
+            p_ += len;
+            return str;
+        }
+
+        // Sorts the entries collected since `mark` by key. Duplicate keys keep
+        // the last occurrence, matching decode(). Returns the entry count.
+        size_t sort_entries(size_t mark)
+        {
+            auto first = entry_stack_.begin() + mark;
+            auto last = entry_stack_.end();
+            auto strictly_less = [](const DictEntry &a, const DictEntry &b)
+            { return a.key < b.key; };
+
+            // Well formed input is already strictly ascending
+            if (std::adjacent_find(first, last, [](const DictEntry &a, const DictEntry &b)
+                                   { return !(a.key < b.key); }) == last)
+                return entry_stack_.size() - mark;
+
+            std::stable_sort(first, last, strictly_less);
+            auto out = first;
+            for (auto it = first; it != last; ++it)
+            {
+                if (it + 1 != last && it[1].key == it->key)
+                    continue;
+                *out++ = *it;
+            }
+            return static_cast<size_t>(out - first);
+        }
+
+        Document &doc_;
+        const char *p_;
+        const char *end_;
+        std::vector<uint32_t> item_stack_;
+        std::vector<DictEntry> entry_stack_;
+    };
+
+    Document decode_view(std::string_view input)
+    {
+        Document doc;
+        // Rough guess to avoid regrowing the arena on typical metainfo files
+        doc.nodes_.reserve(input.size() / 32 + 4);
+
+        Document::Parser parser(doc, input);
+        parser.parse_value(0);
+        return doc;
+    }
+
+    // ----------------- View -----------------
+    const Node &View::node() const
+    {
+        if (!doc_)
+            throw std::runtime_error("Missing bencode value");
+        return doc_->nodes_[index_];
+    }
+
+    NodeType View::type() const
+    {
+        return node().type;
+    }
+
+    int64_t View::as_int() const
+    {
+        const Node &n = node();
+        if (n.type != NodeType::Int)
+            throw std::runtime_error("Bencode value is not an integer");
+        return n.integer;
+    }
+
+    std::string_view View::as_string() const
+    {
+        const Node &n = node();
+        if (n.type != NodeType::String)
+            throw std::runtime_error("Bencode value is not a string");
+        return n.string;
+    }
+
+    std::string_view View::raw() const
+    {
+        return node().raw;
+    }
+
+    size_t View::size() const
+    {
+        return node().count;
+    }
+
+    View View::operator[](size_t i) const
+    {
+        const Node &n = node();
+        if (n.type != NodeType::List)
+            throw std::runtime_error("Bencode value is not a list");
+        if (i >= n.count)
+            throw std::out_of_range("List index out of range");
+        return View(doc_, doc_->items_[n.first + i]);
+    }
+
+    std::string_view View::key_at(size_t i) const
+    {
+        const Node &n = node();
+        if (n.type != NodeType::Dict)
+            throw std::runtime_error("Bencode value is not a dictionary");
+        if (i >= n.count)
+            throw std::out_of_range("Dictionary index out of range");
+        return doc_->entries_[n.first + i].key;
+    }
+
+    View View::value_at(size_t i) const
+    {
+        const Node &n = node();
+        if (n.type != NodeType::Dict)
+            throw std::runtime_error("Bencode value is not a dictionary");
+        if (i >= n.count)
+            throw std::out_of_range("Dictionary index out of range");
+        return View(doc_, doc_->entries_[n.first + i].value);
+    }
+
+    View View::find(std::string_view key) const
+    {
+        const Node &n = node();
+        if (n.type != NodeType::Dict)
+            throw std::runtime_error("Bencode value is not a dictionary");
+
+        auto first = doc_->entries_.begin() + n.first;
+        auto last = first + n.count;
+        auto it = std::lower_bound(first, last, key, [](const DictEntry &e, std::string_view k)
+                                   { return e.key < k; });
+        if (it == last || it->key != key)
+            return View();
+        return View(doc_, it->value);
+    }
+
+    // ----------------- Conversion -----------------
+    BencodeValue to_value(const View &view)
+    {
+        switch (view.type())
+        {
+        case NodeType::Int:
+            return view.as_int();
+        case NodeType::String:
+            return std::string(view.as_string());
+        case NodeType::List:
+        {
+            std::vector<std::shared_ptr<Bencode>> list;
+            list.reserve(view.size());
+            for (size_t i = 0; i < view.size(); ++i)
+            {
+                list.push_back(std::make_shared<Bencode>(Bencode{to_value(view[i])}));
+            }
+            return list;
+        }
+        case NodeType::Dict:
+        {
+            std::map<std::string, std::shared_ptr<Bencode>> dict;
+            for (size_t i = 0; i < view.size(); ++i)
+            {
+                // Keys arrive sorted, so hinting at end() keeps insertion O(1)
+                dict.emplace_hint(dict.end(), std::string(view.key_at(i)),
+                                  std::make_shared<Bencode>(Bencode{to_value(view.value_at(i))}));
+            }
+            return dict;
+        }
+        }
+        throw std::runtime_error("Unknown bencode node type");
+    }
+
+}
@@ -0,0 +1,254 @@
+#include "bitfield.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BITFIELD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace torrent
+{
+    static uint64_t load_be64(const char *p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return __builtin_bswap64(v);
+    }
+
+    // Mask of the used bits in the last word
+    static uint64_t tail_mask(size_t bits)
+    {
+        size_t used = bits & 63;
+        return used == 0 ? ~uint64_t(0) : ~uint64_t(0) << (64 - used);
+    }
+
+    // ----------------- Kernels -----------------
+
+    struct Kernel
+    {
+        const char *name;
+        size_t (*count)(const uint64_t *words, size_t n);
+        size_t (*count_andnot)(const uint64_t *theirs, const uint64_t *ours, size_t n);
+        bool (*any_andnot)(const uint64_t *theirs, const uint64_t *ours, size_t n);
+    };
+
+    __attribute__((always_inline)) static inline size_t count_impl(const uint64_t *words, size_t n)
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < n; ++i)
+            total += __builtin_popcountll(words[i]);
+        return total;
+    }
+
+    __attribute__((always_inline)) static inline size_t count_andnot_impl(const uint64_t *theirs, const uint64_t *ours, size_t n)
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < n; ++i)
+            total += __builtin_popcountll(theirs[i] & ~ours[i]);
+        return total;
+    }
+
+    __attribute__((always_inline)) static inline bool any_andnot_impl(const uint64_t *theirs, const uint64_t *ours, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            if (theirs[i] & ~ours[i])
+                return true;
+        return false;
+    }
+
+    static size_t count_scalar(const uint64_t *words, size_t n) { return count_impl(words, n); }
+    static size_t count_andnot_scalar(const uint64_t *t, const uint64_t *o, size_t n) { return count_andnot_impl(t, o, n); }
+    static bool any_andnot_scalar(const uint64_t *t, const uint64_t *o, size_t n) { return any_andnot_impl(t, o, n); }
+
+#ifdef BITFIELD_X86
+    // Same loops, but with the popcnt instruction instead of a library call
+    __attribute__((target("popcnt"))) static size_t count_popcnt(const uint64_t *words, size_t n)
+    {
+        return count_impl(words, n);
+    }
+
+    __attribute__((target("popcnt"))) static size_t count_andnot_popcnt(const uint64_t *t, const uint64_t *o, size_t n)
+    {
+        return count_andnot_impl(t, o, n);
+    }
+
+    // Population count of 32 bytes at once: a nibble lookup table per byte,
+    // then sums of absolute differences fold the bytes into four 64-bit lanes
+    __attribute__((target("avx2"), always_inline)) static inline __m256i popcount256(__m256i v)
+    {
+        const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                               0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low_mask));
+        __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask));
+        return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+    }
+
+    __attribute__((target("avx2,popcnt"))) static size_t horizontal_sum(__m256i acc)
+    {
+        __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        return static_cast<size_t>(_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+    }
+
+    __attribute__((target("avx2,popcnt"))) static size_t count_avx2(const uint64_t *words, size_t n)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            acc = _mm256_add_epi64(acc, popcount256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i))));
+        return horizontal_sum(acc) + count_impl(words + i, n - i);
+    }
+
+    __attribute__((target("avx2,popcnt"))) static size_t count_andnot_avx2(const uint64_t *t, const uint64_t *o, size_t n)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i theirs = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(t + i));
+            __m256i ours = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(o + i));
+            acc = _mm256_add_epi64(acc, popcount256(_mm256_andnot_si256(ours, theirs)));
+        }
+        return horizontal_sum(acc) + count_andnot_impl(t + i, o + i, n - i);
+    }
+
+    __attribute__((target("avx2"))) static bool any_andnot_avx2(const uint64_t *t, const uint64_t *o, size_t n)
+    {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i theirs = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(t + i));
+            __m256i ours = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(o + i));
+            // testc is set when theirs & ~ours is all zero
+            if (!_mm256_testc_si256(ours, theirs))
+                return true;
+        }
+        return any_andnot_impl(t + i, o + i, n - i);
+    }
+#endif
+
+    static Kernel select_kernel()
+    {
+#ifdef BITFIELD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+            return {"avx2", count_avx2, count_andnot_avx2, any_andnot_avx2};
+        if (__builtin_cpu_supports("popcnt"))
+            return {"popcnt", count_popcnt, count_andnot_popcnt, any_andnot_scalar};
+#endif
+        return {"scalar", count_scalar, count_andnot_scalar, any_andnot_scalar};
+    }
+
+    static const Kernel &kernel()
+    {
+        static const Kernel instance = select_kernel();
+        return instance;
+    }
+
+    // ----------------- Bitfield -----------------
+
+    Bitfield::Bitfield(size_t bits, bool value)
+        : words_((bits + 63) / 64, 0), bits_(bits)
+    {
+        if (value)
+            set_all();
+    }
+
+    Bitfield Bitfield::from_bytes(std::string_view bytes, size_t bits)
+    {
+        if (bytes.size() != (bits + 7) / 8)
+            throw std::runtime_error("Invalid bitfield length");
+
+        Bitfield field(bits);
+        size_t full = bytes.size() / 8;
+        for (size_t w = 0; w < full; ++w)
+            field.words_[w] = load_be64(bytes.data() + w * 8);
+        if (full < field.words_.size())
+        {
+            char last[8] = {};
+            std::memcpy(last, bytes.data() + full * 8, bytes.size() - full * 8);
+            field.words_[full] = load_be64(last);
+        }
+        // BEP 3 says spare bits must be zero; clear them rather than drop
+        // an otherwise useful peer
+        if (!field.words_.empty())
+            field.words_.back() &= tail_mask(bits);
+
+        field.count_ = kernel().count(field.words_.data(), field.words_.size());
+        return field;
+    }
+
+    std::string Bitfield::to_bytes() const
+    {
+        std::string out(words_.size() * 8, '\0');
+        for (size_t w = 0; w < words_.size(); ++w)
+        {
+            uint64_t be = __builtin_bswap64(words_[w]);
+            std::memcpy(&out[w * 8], &be, 8);
+        }
+        out.resize((bits_ + 7) / 8);
+        return out;
+    }
+
+    bool Bitfield::set(size_t i)
+    {
+        uint64_t bit = uint64_t(1) << (63 - (i & 63));
+        uint64_t &word = words_[i >> 6];
+        if (word & bit)
+            return false;
+        word |= bit;
+        ++count_;
+        return true;
+    }
+
+    bool Bitfield::reset(size_t i)
+    {
+        uint64_t bit = uint64_t(1) << (63 - (i & 63));
+        uint64_t &word = words_[i >> 6];
+        if (!(word & bit))
+            return false;
+        word &= ~bit;
+        --count_;
+        return true;
+    }
+
+    void Bitfield::set_all()
+    {
+        std::fill(words_.begin(), words_.end(), ~uint64_t(0));
+        if (!words_.empty())
+            words_.back() &= tail_mask(bits_);
+        count_ = bits_;
+    }
+
+    void Bitfield::reset_all()
+    {
+        std::fill(words_.begin(), words_.end(), 0);
+        count_ = 0;
+    }
+
+    // ----------------- Comparison -----------------
+
+    size_t count_missing(const Bitfield &ours, const Bitfield &theirs)
+    {
+        if (ours.size() != theirs.size())
+            throw std::runtime_error("Bitfield sizes differ");
+        return kernel().count_andnot(theirs.words(), ours.words(), ours.num_words());
+    }
+
+    bool has_missing(const Bitfield &ours, const Bitfield &theirs)
+    {
+        if (ours.size() != theirs.size())
+            throw std::runtime_error("Bitfield sizes differ");
+        if (theirs.none() || ours.all())
+            return false;
+        return kernel().any_andnot(theirs.words(), ours.words(), ours.num_words());
+    }
+
+    const char *bitfield_kernel()
+    {
+        return kernel().name;
+    }
+
+}
@@ -0,0 +1,493 @@
+#include "block_scheduler.hpp"
+#include "sha1.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace torrent
+{
+    // Block latencies are sampled against a minimum that expires after this
+    // long, so a route change that raises the RTT is eventually picked up
+    static constexpr auto min_rtt_window = std::chrono::seconds(10);
+
+    static double seconds(std::chrono::steady_clock::duration d)
+    {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    static size_t piece_count(const TorrentMetadata &metadata)
+    {
+        if (metadata.pieceLength <= 0 || metadata.length < 0)
+            return 0;
+        return static_cast<size_t>((metadata.length + metadata.pieceLength - 1) / metadata.pieceLength);
+    }
+
+    BlockScheduler::BlockScheduler(Reactor &reactor, const TorrentMetadata &metadata, Storage &storage,
+                                   SchedulerConfig config)
+        : reactor_(reactor), storage_(storage), config_(config), total_length_(metadata.length),
+          piece_length_(static_cast<uint32_t>(metadata.pieceLength)), hashes_(metadata.pieces),
+          picker_(piece_count(metadata))
+    {
+        if (metadata.pieceLength <= 0 || metadata.pieceLength > UINT32_MAX)
+            throw std::runtime_error("Invalid piece length");
+        if (config_.block_size == 0 || config_.min_queue_depth == 0 ||
+            config_.max_queue_depth < config_.min_queue_depth)
+            throw std::runtime_error("Invalid scheduler configuration");
+        if (hashes_.empty() && total_length_ > 0)
+            throw std::runtime_error("Block scheduler needs v1 piece hashes");
+
+        if (hashes_.size() != num_pieces() * sha1_digest_size)
+            throw std::runtime_error("Piece hashes don't match the torrent length");
+
+        last_tick_ = Clock::now();
+        tick_timer_ = reactor_.schedule(config_.tick_interval, [this]
+                                        { tick(); });
+    }
+
+    BlockScheduler::~BlockScheduler()
+    {
+        if (tick_timer_)
+            reactor_.cancel(tick_timer_);
+    }
+
+    uint32_t BlockScheduler::piece_size(uint32_t index) const
+    {
+        int64_t begin = int64_t(index) * piece_length_;
+        return static_cast<uint32_t>(std::min<int64_t>(piece_length_, total_length_ - begin));
+    }
+
+    uint32_t BlockScheduler::block_count(uint32_t index) const
+    {
+        return (piece_size(index) + config_.block_size - 1) / config_.block_size;
+    }
+
+    uint32_t BlockScheduler::block_length(uint32_t index, uint32_t block) const
+    {
+        uint32_t begin = block * config_.block_size;
+        return std::min(config_.block_size, piece_size(index) - begin);
+    }
+
+    void BlockScheduler::mark_have(uint32_t index)
+    {
+        if (index >= num_pieces() || has_piece(index))
+            return;
+        picker_.mark_have(index);
+        if (partial_.erase(index))
+            storage_.discard_piece(index);
+    }
+
+    // ----------------- Peers -----------------
+
+    void BlockScheduler::add_peer(PeerSession &session)
+    {
+        if (session.bitfield().size() != num_pieces())
+            throw std::runtime_error("Peer session piece count differs from the torrent");
+        if (peers_.count(&session))
+            return;
+        Peer &peer = peers_[&session];
+        peer.depth = config_.min_queue_depth;
+        count_peer(session, peer);
+        if (may_request(session))
+            fill(session, peer);
+    }
+
+    void BlockScheduler::remove_peer(PeerSession &session)
+    {
+        auto it = peers_.find(&session);
+        if (it == peers_.end())
+            return;
+        drop_requests(it->second);
+        uncount_peer(it->second);
+        peers_.erase(it);
+    }
+
+    // Seeds are counted once instead of per piece
+    void BlockScheduler::count_peer(PeerSession &session, Peer &peer)
+    {
+        peer.counted = session.bitfield();
+        peer.seed = peer.counted.all() && peer.counted.size() > 0;
+        if (peer.seed)
+            picker_.add_seed();
+        else
+            picker_.add_peer(peer.counted);
+    }
+
+    void BlockScheduler::uncount_peer(Peer &peer)
+    {
+        if (peer.seed)
+            picker_.remove_seed();
+        else
+            picker_.remove_peer(peer.counted);
+        peer.counted = Bitfield();
+        peer.seed = false;
+    }
+
+    void BlockScheduler::peer_state_changed(PeerSession &session)
+    {
+        auto it = peers_.find(&session);
+        if (it == peers_.end())
+            return;
+
+        switch (session.state())
+        {
+        case PeerSession::State::Unchoked:
+            fill(session, it->second);
+            break;
+        case PeerSession::State::Closed:
+            remove_peer(session);
+            break;
+        default:
+            // A choking peer discards whatever we had asked for; under the
+            // fast extension it rejects each request instead, and may still
+            // serve pieces it allowed us
+            if (!session.fast_extension())
+                drop_requests(it->second);
+            else if (may_request(session))
+                fill(session, it->second);
+            break;
+        }
+    }
+
+    void BlockScheduler::handle(PeerSession &session, const wire::Message &msg)
+    {
+        auto it = peers_.find(&session);
+        if (it == peers_.end())
+            return;
+
+        switch (msg.type())
+        {
+        case wire::MessageType::Piece:
+            on_block(it->second, msg);
+            break;
+        case wire::MessageType::Have:
+            if (!it->second.seed && msg.index < num_pieces() && it->second.counted.set(msg.index))
+                picker_.add_have(msg.index);
+            break;
+        case wire::MessageType::Bitfield:
+        case wire::MessageType::HaveAll:
+        case wire::MessageType::HaveNone:
+            uncount_peer(it->second);
+            count_peer(session, it->second);
+            break;
+        case wire::MessageType::AllowedFast:
+            break;
+        case wire::MessageType::RejectRequest:
+            // Not refilled here: a peer rejecting everything would be asked
+            // for the same blocks again straight away
+            on_reject(it->second, msg);
+            return;
+        default:
+            return;
+        }
+        if (may_request(session))
+            fill(session, it->second);
+    }
+
+    size_t BlockScheduler::queue_depth(const PeerSession &session) const
+    {
+        auto it = peers_.find(const_cast<PeerSession *>(&session));
+        return it == peers_.end() ? 0 : it->second.depth;
+    }
+
+    size_t BlockScheduler::outstanding(const PeerSession &session) const
+    {
+        auto it = peers_.find(const_cast<PeerSession *>(&session));
+        return it == peers_.end() ? 0 : it->second.requests.size();
+    }
+
+    double BlockScheduler::download_rate(const PeerSession &session) const
+    {
+        auto it = peers_.find(const_cast<PeerSession *>(&session));
+        return it == peers_.end() ? 0 : it->second.rate;
+    }
+
+    // ----------------- Requests -----------------
+
+    // Requests go to unchoked peers, and to choking ones for the pieces they
+    // allow fast
+    bool BlockScheduler::may_request(const PeerSession &session)
+    {
+        return session.state() == PeerSession::State::Unchoked ||
+               (session.state() == PeerSession::State::Interested && !session.allowed_fast().empty());
+    }
+
+    // Tops the peer's pipeline up to its depth in one write. Uncorking can
+    // close the session, and with it remove the peer, so it comes last.
+    void BlockScheduler::fill(PeerSession &session, Peer &peer)
+    {
+        if (peer.requests.size() >= peer.depth || !storage_error_.empty())
+            return;
+
+        session.cork();
+        uint32_t piece, block;
+        while (peer.requests.size() < peer.depth && pick(session, piece, block))
+        {
+            partial_[piece].blocks[block] = BlockState::Requested;
+            peer.requests.push_back({piece, block, Clock::now()});
+            session.request_block(piece, block * config_.block_size, block_length(piece, block));
+        }
+        session.uncork();
+    }
+
+    // Finishes pieces already under way before starting new ones, so data
+    // reaches the hash check (and the disk) as early as possible; new pieces
+    // come from the picker, rarest first
+    bool BlockScheduler::pick(const PeerSession &session, uint32_t &piece, uint32_t &block)
+    {
+        const Bitfield &bits = session.bitfield();
+        if (session.state() != PeerSession::State::Unchoked)
+            return pick_allowed_fast(session, piece, block);
+        for (auto &[index, partial] : partial_)
+        {
+            if (!bits.test(index))
+                continue;
+            auto free = std::find(partial.blocks.begin(), partial.blocks.end(), BlockState::Free);
+            if (free != partial.blocks.end())
+            {
+                piece = index;
+                block = static_cast<uint32_t>(free - partial.blocks.begin());
+                return true;
+            }
+        }
+
+        auto next = picker_.pick(bits);
+        if (!next || !start_piece(*next))
+            return false;
+        piece = *next;
+        block = 0;
+        return true;
+    }
+
+    // While choked, only the peer's allowed fast pieces may be requested
+    bool BlockScheduler::pick_allowed_fast(const PeerSession &session, uint32_t &piece, uint32_t &block)
+    {
+        for (uint32_t index : session.allowed_fast())
+        {
+            if (!session.bitfield().test(index) || has_piece(index))
+                continue;
+            auto it = partial_.find(index);
+            if (it == partial_.end())
+            {
+                if (!start_piece(index))
+                    continue;
+                it = partial_.find(index);
+            }
+            auto free = std::find(it->second.blocks.begin(), it->second.blocks.end(), BlockState::Free);
+            if (free != it->second.blocks.end())
+            {
+                piece = index;
+                block = static_cast<uint32_t>(free - it->second.blocks.begin());
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool BlockScheduler::start_piece(uint32_t index)
+    {
+        try
+        {
+            if (!storage_.begin_piece(index))
+                return false;
+        }
+        catch (const std::exception &e)
+        {
+            storage_failed(e.what());
+            return false;
+        }
+        PartialPiece &partial = partial_[index];
+        partial.blocks.assign(block_count(index), BlockState::Free);
+        partial.received = 0;
+        picker_.mark_downloading(index);
+        return true;
+    }
+
+    void BlockScheduler::release(uint32_t piece, uint32_t block)
+    {
+        auto it = partial_.find(piece);
+        if (it != partial_.end() && it->second.blocks[block] == BlockState::Requested)
+            it->second.blocks[block] = BlockState::Free;
+    }
+
+    void BlockScheduler::drop_requests(Peer &peer)
+    {
+        for (const Request &req : peer.requests)
+            release(req.piece, req.block);
+        peer.requests.clear();
+    }
+
+    // The request is off the peer's queue, so its block is free again
+    void BlockScheduler::on_reject(Peer &peer, const wire::Message &msg)
+    {
+        if (msg.begin % config_.block_size != 0)
+            return;
+        uint32_t block = msg.begin / config_.block_size;
+        auto req = std::find_if(peer.requests.begin(), peer.requests.end(), [&](const Request &r)
+                                { return r.piece == msg.index && r.block == block; });
+        if (req == peer.requests.end())
+            return;
+        release(req->piece, req->block);
+        peer.requests.erase(req);
+    }
+
+    void BlockScheduler::on_block(Peer &peer, const wire::Message &msg)
+    {
+        if (msg.index >= num_pieces() || msg.begin % config_.block_size != 0)
+            return;
+        uint32_t block = msg.begin / config_.block_size;
+        if (block >= block_count(msg.index) || msg.payload.size() != block_length(msg.index, block))
+            return;
+
+        // Usually the oldest request; anything else means the peer reordered
+        // or the request had already timed out
+        auto req = std::find_if(peer.requests.begin(), peer.requests.end(), [&](const Request &r)
+                                { return r.piece == msg.index && r.block == block; });
+        if (req != peer.requests.end())
+        {
+            auto now = Clock::now();
+            double latency = seconds(now - req->sent);
+            peer.srtt = peer.srtt == 0 ? latency : 0.875 * peer.srtt + 0.125 * latency;
+            if (peer.min_rtt == 0 || latency < peer.min_rtt || now - peer.min_rtt_stamp > min_rtt_window)
+            {
+                peer.min_rtt = latency;
+                peer.min_rtt_stamp = now;
+            }
+            peer.requests.erase(req);
+        }
+        peer.bytes_since_tick += msg.payload.size();
+
+        // A late block for a piece still being assembled is as good as any
+        auto it = partial_.find(msg.index);
+        if (it == partial_.end() || it->second.blocks[block] == BlockState::Received)
+            return;
+        PartialPiece &partial = it->second;
+        storage_.write_block(msg.index, msg.begin, msg.payload);
+        partial.blocks[block] = BlockState::Received;
+        if (++partial.received == partial.blocks.size())
+            finish_piece(msg.index);
+    }
+
+    void BlockScheduler::finish_piece(uint32_t index)
+    {
+        std::string_view data = storage_.piece_data(index);
+        unsigned char digest[sha1_digest_size];
+        sha1_digest(data.data(), data.size(), digest);
+        if (std::memcmp(digest, hashes_.data() + size_t(index) * sha1_digest_size, sha1_digest_size) != 0)
+        {
+            abandon_piece(index);
+            if (on_failure_)
+                on_failure_(index);
+            return;
+        }
+
+        // Nothing is marked done until Storage has taken the piece
+        try
+        {
+            storage_.commit_piece(index);
+        }
+        catch (const std::exception &e)
+        {
+            abandon_piece(index);
+            storage_failed(e.what());
+            return;
+        }
+        partial_.erase(index);
+        picker_.mark_have(index);
+        if (on_piece_)
+            on_piece_(index);
+    }
+
+    // Drops a piece's buffer and progress so it can be downloaded afresh;
+    // any requests still out for it are simply ignored
+    void BlockScheduler::abandon_piece(uint32_t index)
+    {
+        partial_.erase(index);
+        for (auto &[session, peer] : peers_)
+            peer.requests.erase(std::remove_if(peer.requests.begin(), peer.requests.end(), [&](const Request &r)
+                                               { return r.piece == index; }),
+                                peer.requests.end());
+        storage_.discard_piece(index);
+        picker_.abort_download(index);
+    }
+
+    // Write errors stick in Storage, so downloading more would only fill
+    // the cache; stop requesting and let the owner decide
+    void BlockScheduler::storage_failed(const std::string &error)
+    {
+        if (!storage_error_.empty())
+            return;
+        storage_error_ = error;
+        if (on_storage_error_)
+            on_storage_error_(error);
+    }
+
+    // ----------------- Adaptation -----------------
+
+    // Depth is the bandwidth-delay product in blocks, times the gain. While
+    // the pipeline is what limits a peer, rate * min_rtt comes out at about
+    // the current depth, so the gain doubles it each tick until the link
+    // itself becomes the limit.
+    void BlockScheduler::update_depth(Peer &peer)
+    {
+        if (peer.rate <= 0 || peer.min_rtt <= 0)
+            return;
+        double bdp_blocks = peer.rate * peer.min_rtt / config_.block_size;
+        double depth = std::ceil(config_.bdp_gain * bdp_blocks);
+        peer.depth = std::clamp(static_cast<size_t>(depth), config_.min_queue_depth, config_.max_queue_depth);
+    }
+
+    void BlockScheduler::tick()
+    {
+        tick_timer_ = 0;
+        auto now = Clock::now();
+        double elapsed = seconds(now - last_tick_);
+        last_tick_ = now;
+
+        // Filling can close sessions and remove peers, so walk a snapshot
+        std::vector<PeerSession *> sessions;
+        sessions.reserve(peers_.size());
+        for (auto &[session, peer] : peers_)
+            sessions.push_back(session);
+
+        for (PeerSession *session : sessions)
+        {
+            auto it = peers_.find(session);
+            if (it == peers_.end())
+                continue;
+            Peer &peer = it->second;
+
+            if (elapsed > 0)
+            {
+                double sample = peer.bytes_since_tick / elapsed;
+                peer.rate = peer.rate == 0 ? sample : 0.7 * peer.rate + 0.3 * sample;
+                peer.bytes_since_tick = 0;
+            }
+            update_depth(peer);
+
+            // Requests are answered in order, so only the oldest can time out
+            double timeout = std::max(seconds(config_.min_request_timeout), config_.timeout_multiple * peer.srtt);
+            bool expired = false;
+            session->cork();
+            while (!peer.requests.empty() && seconds(now - peer.requests.front().sent) > timeout)
+            {
+                Request req = peer.requests.front();
+                peer.requests.pop_front();
+                release(req.piece, req.block);
+                session->cancel_block(req.piece, req.block * config_.block_size, block_length(req.piece, req.block));
+                expired = true;
+            }
+            // A peer that lets requests expire gets a shallower pipeline
+            if (expired)
+                peer.depth = std::max(config_.min_queue_depth, peer.depth / 2);
+
+            if (may_request(*session))
+                fill(*session, peer);
+            session->uncork();
+        }
+
+        tick_timer_ = reactor_.schedule(config_.tick_interval, [this]
+                                        { tick(); });
+    }
+
+}
@@ -0,0 +1,42 @@
+#include "buffer_pool.hpp"
+
+namespace torrent
+{
+    BufferPool::BufferPool(size_t buffer_size, size_t max_free)
+        : state_(std::make_shared<State>())
+    {
+        state_->buffer_size = buffer_size;
+        state_->max_free = max_free;
+    }
+
+    BufferPool::Buffer BufferPool::acquire()
+    {
+        std::unique_ptr<char[]> buffer;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            if (!state_->free.empty())
+            {
+                buffer = std::move(state_->free.back());
+                state_->free.pop_back();
+            }
+        }
+        if (!buffer)
+            buffer.reset(new char[state_->buffer_size]);
+        return Buffer(buffer.release(), Release{state_});
+    }
+
+    size_t BufferPool::idle() const
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->free.size();
+    }
+
+    void BufferPool::Release::operator()(char *p) const
+    {
+        std::unique_ptr<char[]> buffer(p);
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->free.size() < state->max_free)
+            state->free.push_back(std::move(buffer));
+    }
+
+}
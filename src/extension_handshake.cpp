@@ -0,0 +1,49 @@
+#include "extension_handshake.hpp"
+#include "bencode.hpp"
+#include "bencode_schema.hpp"
+
+namespace bencode
+{
+    template <>
+    struct Schema<ExtensionHandshake>
+    {
+        static constexpr auto fields = std::make_tuple(
+            optional("m", &ExtensionHandshake::extensions),
+            optional("p", &ExtensionHandshake::listen_port),
+            optional("v", &ExtensionHandshake::client),
+            optional("yourip", &ExtensionHandshake::your_ip),
+            optional("reqq", &ExtensionHandshake::request_queue),
+            optional("metadata_size", &ExtensionHandshake::metadata_size));
+    };
+}
+
+ExtensionHandshake parse_extension_handshake(std::string_view payload)
+{
+    return bencode::decode_as<ExtensionHandshake>(payload);
+}
+
+std::string encode_extension_handshake(const ExtensionHandshake &handshake)
+{
+    using namespace bencode;
+
+    std::map<std::string, std::shared_ptr<Bencode>> m;
+    for (const auto &[name, id] : handshake.extensions)
+    {
+        m[name] = std::make_shared<Bencode>(Bencode{id});
+    }
+
+    std::map<std::string, std::shared_ptr<Bencode>> dict;
+    dict["m"] = std::make_shared<Bencode>(Bencode{std::move(m)});
+    if (handshake.listen_port > 0)
+        dict["p"] = std::make_shared<Bencode>(Bencode{handshake.listen_port});
+    if (!handshake.client.empty())
+        dict["v"] = std::make_shared<Bencode>(Bencode{handshake.client});
+    if (!handshake.your_ip.empty())
+        dict["yourip"] = std::make_shared<Bencode>(Bencode{handshake.your_ip});
+    if (handshake.request_queue > 0)
+        dict["reqq"] = std::make_shared<Bencode>(Bencode{handshake.request_queue});
+    if (handshake.metadata_size > 0)
+        dict["metadata_size"] = std::make_shared<Bencode>(Bencode{handshake.metadata_size});
+
+    return encode(dict);
+}
@@ -0,0 +1,71 @@
+#include "file_layout.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace torrent
+{
+    FileLayout::FileLayout(const TorrentMetadata &metadata, const std::string &save_path)
+    {
+        if (metadata.pieceLength <= 0)
+            throw std::runtime_error("Piece length must be positive");
+        piece_length_ = static_cast<uint64_t>(metadata.pieceLength);
+
+        // Names come from the torrent, never let them climb out of save_path
+        auto check_component = [](const std::string &part)
+        {
+            if (part.empty() || part == "." || part == ".." || part.find('/') != std::string::npos)
+                throw std::runtime_error("Invalid file path in torrent");
+        };
+        check_component(metadata.name);
+
+        fs::path root = fs::path(save_path) / metadata.name;
+        if (metadata.files.empty())
+        {
+            if (metadata.length < 0)
+                throw std::runtime_error("Invalid file length");
+            files_.push_back(File{root.string(), 0, static_cast<uint64_t>(metadata.length), false});
+            total_length_ = static_cast<uint64_t>(metadata.length);
+        }
+        for (const auto &file : metadata.files)
+        {
+            if (file.length < 0)
+                throw std::runtime_error("Invalid file length");
+
+            fs::path path = root;
+            for (const auto &part : file.path)
+            {
+                check_component(part);
+                path /= part;
+            }
+            bool pad = file.attr.find('p') != std::string::npos;
+            files_.push_back(File{path.string(), total_length_, static_cast<uint64_t>(file.length), pad});
+            total_length_ += static_cast<uint64_t>(file.length);
+        }
+
+        num_pieces_ = (total_length_ + piece_length_ - 1) / piece_length_;
+    }
+
+    uint32_t FileLayout::piece_size(uint32_t piece) const
+    {
+        uint64_t begin = piece_offset(piece);
+        if (begin >= total_length_)
+            return 0;
+        return static_cast<uint32_t>(std::min(piece_length_, total_length_ - begin));
+    }
+
+    // The last file starting at or before the offset. Empty files share their
+    // offset with the next file and sort before it, so they're never chosen
+    // for an offset inside the stream.
+    size_t FileLayout::file_at(uint64_t offset) const
+    {
+        if (offset >= total_length_)
+            throw std::runtime_error("Offset past the end of the torrent");
+        auto it = std::upper_bound(files_.begin(), files_.end(), offset, [](uint64_t o, const File &f)
+                                   { return o < f.offset; });
+        return static_cast<size_t>(it - files_.begin()) - 1;
+    }
+
+}
@@ -0,0 +1,286 @@
+#include "file_source.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace torrent
+{
+    static uintptr_t page_size()
+    {
+        static const uintptr_t size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        return size;
+    }
+
+    static char *page_floor(char *p)
+    {
+        return reinterpret_cast<char *>(reinterpret_cast<uintptr_t>(p) & ~(page_size() - 1));
+    }
+
+    FileSource::FileSource(const std::string &path, size_t window_size, Mode mode)
+        : window_size_(window_size)
+    {
+        if (window_size == 0)
+            throw std::runtime_error("Window size must be positive");
+
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0)
+            throw std::runtime_error("Failed to open file: " + path);
+
+        struct stat st{};
+        if (fstat(fd_, &st) < 0)
+        {
+            ::close(fd_);
+            throw std::runtime_error("Failed to stat file: " + path);
+        }
+        bool regular = S_ISREG(st.st_mode);
+        size_ = regular ? static_cast<uint64_t>(st.st_size) : 0;
+
+        if (mode != Mode::Buffered && regular && size_ > 0)
+        {
+            void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if (map != MAP_FAILED)
+            {
+                map_ = static_cast<char *>(map);
+                madvise(map_, size_, MADV_SEQUENTIAL);
+                madvise(map_, std::min<uint64_t>(window_size_, size_), MADV_WILLNEED);
+                return;
+            }
+        }
+        if (mode == Mode::Mapped && size_ > 0)
+        {
+            ::close(fd_);
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+        paths_.push_back(path);
+        fds_.push_back(fd_);
+        opened_.push_back(1);
+        next_open_ = 1;
+        fd_ = -1; // owned by the stream now
+        start_buffered(regular ? static_cast<size_t>(std::min<uint64_t>(window_size_, size_)) : window_size_, 1);
+    }
+
+    FileSource::FileSource(std::vector<std::string> paths, size_t window_size, size_t files_in_flight)
+        : window_size_(window_size), paths_(std::move(paths))
+    {
+        if (window_size == 0)
+            throw std::runtime_error("Window size must be positive");
+
+        fds_.assign(paths_.size(), -1);
+        opened_.assign(paths_.size(), 0);
+        start_buffered(window_size_, std::max<size_t>(files_in_flight, 1));
+    }
+
+    void FileSource::start_buffered(size_t capacity, size_t files_in_flight)
+    {
+        for (auto &slot : ring_)
+            slot.data.resize(capacity);
+        files_in_flight_ = files_in_flight;
+
+        size_t openers = std::min(opener_threads, paths_.size() - next_open_);
+        for (size_t i = 0; i < openers; ++i)
+            openers_.emplace_back(&FileSource::open_ahead, this);
+        reader_ = std::thread(&FileSource::read_ahead, this);
+    }
+
+    FileSource::~FileSource()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (reader_.joinable())
+            reader_.join();
+        for (auto &t : openers_)
+            t.join();
+        for (int fd : fds_)
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+        if (map_)
+            munmap(map_, size_);
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    void FileSource::open_ahead()
+    {
+        for (;;)
+        {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&]
+                         { return stop_ || next_open_ >= paths_.size() || next_open_ < current_file_ + files_in_flight_; });
+                if (stop_ || next_open_ >= paths_.size())
+                    return;
+                index = next_open_++;
+            }
+
+            int fd = ::open(paths_[index].c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd >= 0)
+            {
+                // Start pulling the file into the page cache while earlier files are read
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                fds_[index] = fd;
+                opened_[index] = 1;
+            }
+            cv_.notify_all();
+        }
+    }
+
+    // Waits for the opener to get to file `index` and takes its descriptor
+    int FileSource::acquire_file(size_t index, std::string &error)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        current_file_ = index;
+        cv_.notify_all();
+        cv_.wait(lock, [&]
+                 { return stop_ || opened_[index]; });
+        if (stop_)
+            return -1;
+
+        int fd = fds_[index];
+        fds_[index] = -1;
+        if (fd < 0)
+            error = "Failed to open file: " + paths_[index];
+        return fd;
+    }
+
+    void FileSource::read_ahead()
+    {
+        size_t index = 0;
+        size_t file = 0;
+        int fd = -1;
+        for (;;)
+        {
+            Slot &slot = ring_[index];
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&]
+                         { return stop_ || !slot.full; });
+                if (stop_)
+                    break;
+            }
+
+            // The consumer never touches a slot until it is marked full. Files
+            // are read back to back, so a window can span several of them.
+            size_t got = 0;
+            std::string error;
+            while (got < slot.data.size())
+            {
+                if (fd < 0)
+                {
+                    if (file == paths_.size())
+                        break;
+                    fd = acquire_file(file, error);
+                    if (fd < 0)
+                        break;
+                }
+
+                ssize_t n = ::read(fd, slot.data.data() + got, slot.data.size() - got);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    error = "Failed to read file " + paths_[file] + ": " + std::strerror(errno);
+                    break;
+                }
+                if (n == 0)
+                {
+                    ::close(fd);
+                    fd = -1;
+                    ++file;
+                    continue;
+                }
+                got += static_cast<size_t>(n);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stop_)
+                    break;
+                slot.length = got;
+                slot.full = true;
+                if (!error.empty())
+                    error_ = error;
+            }
+            cv_.notify_all();
+
+            // A short (or empty) window marks the end of the stream
+            if (!error.empty() || got == 0 || got < slot.data.size())
+                break;
+            index = (index + 1) % ring_size;
+        }
+
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    std::string_view FileSource::next()
+    {
+        if (map_)
+        {
+            // Drop the pages of the window we are done with
+            if (offset_ > window_start_)
+            {
+                char *begin = page_floor(map_ + window_start_);
+                char *end = page_floor(map_ + offset_);
+                if (end > begin)
+                    madvise(begin, end - begin, MADV_DONTNEED);
+            }
+            window_start_ = offset_;
+            if (offset_ >= size_)
+                return {};
+
+            size_t len = static_cast<size_t>(std::min<uint64_t>(window_size_, size_ - offset_));
+            uint64_t next_offset = offset_ + len;
+            if (next_offset < size_)
+            {
+                char *ahead = page_floor(map_ + next_offset);
+                size_t ahead_len = static_cast<size_t>(std::min<uint64_t>(window_size_, size_ - next_offset));
+                madvise(ahead, (map_ + next_offset + ahead_len) - ahead, MADV_WILLNEED);
+            }
+
+            std::string_view window(map_ + offset_, len);
+            offset_ = next_offset;
+            return window;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (holding_)
+        {
+            ring_[consumer_slot_].full = false;
+            consumer_slot_ = (consumer_slot_ + 1) % ring_size;
+            holding_ = false;
+            cv_.notify_all();
+        }
+        if (finished_)
+            return {};
+
+        Slot &slot = ring_[consumer_slot_];
+        cv_.wait(lock, [&]
+                 { return slot.full; });
+        if (!error_.empty())
+            throw std::runtime_error(error_);
+
+        holding_ = true;
+        if (slot.length == 0 || slot.length < slot.data.size())
+            finished_ = true;
+        offset_ += slot.length;
+        return std::string_view(slot.data.data(), slot.length);
+    }
+
+}
@@ -0,0 +1,372 @@
+#include "hash_cache.hpp"
+#include "piece_hasher.hpp"
+#include "sha1.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace torrent
+{
+    // On-disk layout, native endian (the cache never leaves the machine):
+    //   header | dirty bitmap, one bit per piece | 20-byte digests
+    static constexpr char cache_magic[4] = {'B', 'L', 'H', 'C'};
+    static constexpr uint32_t cache_version = 1;
+
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t piece_length;
+        uint64_t size;
+        int64_t mtime_ns;
+        uint64_t inode;
+        uint64_t device;
+        uint64_t pieces;
+    };
+
+    // Largest run of invalidated pieces read back at once
+    static constexpr size_t rehash_window = 64 << 20;
+
+    static uint64_t piece_count(uint64_t size, uint64_t piece_length)
+    {
+        return (size + piece_length - 1) / piece_length;
+    }
+
+    static bool is_dirty(const std::vector<uint8_t> &bits, uint64_t piece)
+    {
+        return (bits[piece / 8] >> (piece % 8)) & 1;
+    }
+
+    static void mark_dirty(std::vector<uint8_t> &bits, uint64_t first, uint64_t last)
+    {
+        for (uint64_t piece = first; piece < last; ++piece)
+            bits[piece / 8] |= uint8_t(1u << (piece % 8));
+    }
+
+    bool HashCache::Identity::operator==(const Identity &other) const
+    {
+        return size == other.size && mtime_ns == other.mtime_ns && inode == other.inode && device == other.device;
+    }
+
+    HashCache::HashCache(std::string directory)
+        : directory_(std::move(directory))
+    {
+        fs::create_directories(directory_);
+    }
+
+    std::optional<HashCache::Identity> HashCache::identify(const std::string &path)
+    {
+        struct stat st{};
+        if (::stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+            return std::nullopt;
+
+        Identity id;
+        id.size = static_cast<uint64_t>(st.st_size);
+        id.mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        id.inode = static_cast<uint64_t>(st.st_ino);
+        id.device = static_cast<uint64_t>(st.st_dev);
+        return id;
+    }
+
+    // Entries are named after the SHA1 of the absolute path, so any path fits
+    std::string HashCache::key_prefix(const std::string &path) const
+    {
+        std::string absolute = fs::absolute(path).lexically_normal().string();
+        unsigned char digest[sha1_digest_size];
+        sha1_digest(absolute.data(), absolute.size(), digest);
+
+        static const char hex[] = "0123456789abcdef";
+        std::string name;
+        for (unsigned char byte : digest)
+        {
+            name += hex[byte >> 4];
+            name += hex[byte & 0xf];
+        }
+        return name + "-";
+    }
+
+    std::string HashCache::entry_path(const std::string &path, int64_t piece_length) const
+    {
+        return (fs::path(directory_) / (key_prefix(path) + std::to_string(piece_length))).string();
+    }
+
+    std::vector<std::string> HashCache::entries_for(const std::string &path) const
+    {
+        std::string prefix = key_prefix(path);
+        std::vector<std::string> entries;
+        std::error_code ec;
+        for (const auto &item : fs::directory_iterator(directory_, ec))
+        {
+            std::string name = item.path().filename().string();
+            if (name.compare(0, prefix.size(), prefix) == 0 && name.find('.') == std::string::npos)
+                entries.push_back(item.path().string());
+        }
+        return entries;
+    }
+
+    std::optional<HashCache::Entry> HashCache::load(const std::string &file)
+    {
+        std::ifstream in(file, std::ios::binary);
+        if (!in)
+            return std::nullopt;
+        std::string bytes(std::istreambuf_iterator<char>(in), {});
+
+        CacheHeader header;
+        if (bytes.size() < sizeof(header))
+            return std::nullopt;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version ||
+            header.piece_length == 0 || header.pieces != piece_count(header.size, header.piece_length) ||
+            header.pieces > bytes.size())
+            return std::nullopt;
+
+        // Anything truncated or oversized is treated as a miss, never trusted
+        size_t bitmap = static_cast<size_t>((header.pieces + 7) / 8);
+        if (bytes.size() != sizeof(header) + bitmap + header.pieces * sha1_digest_size)
+            return std::nullopt;
+
+        Entry entry;
+        entry.identity = Identity{header.size, header.mtime_ns, header.inode, header.device};
+        entry.piece_length = header.piece_length;
+        entry.dirty.assign(bytes.begin() + sizeof(header), bytes.begin() + sizeof(header) + bitmap);
+        entry.digests = bytes.substr(sizeof(header) + bitmap);
+        return entry;
+    }
+
+    // Written to a private temporary name and renamed into place, so readers
+    // in other processes see either the old entry or the new one
+    bool HashCache::save(const std::string &file, const Entry &entry)
+    {
+        CacheHeader header;
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.piece_length = entry.piece_length;
+        header.size = entry.identity.size;
+        header.mtime_ns = entry.identity.mtime_ns;
+        header.inode = entry.identity.inode;
+        header.device = entry.identity.device;
+        header.pieces = entry.digests.size() / sha1_digest_size;
+
+        std::string temp = file + "." + std::to_string(::getpid()) + "." +
+                           std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char *>(entry.dirty.data()), entry.dirty.size());
+            out.write(entry.digests.data(), entry.digests.size());
+            if (!out)
+            {
+                std::remove(temp.c_str());
+                return false;
+            }
+        }
+        if (std::rename(temp.c_str(), file.c_str()) != 0)
+        {
+            std::remove(temp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Re-hashes the dirty pieces of an entry straight from the file. False
+    // if `cancel` was set first; the pieces done are no longer dirty.
+    static bool rehash_dirty(const std::string &path, std::vector<uint8_t> &dirty, std::string &digests,
+                             uint64_t size, uint64_t piece_length, unsigned workers,
+                             const std::atomic<bool> *cancel)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open file: " + path);
+
+        const uint64_t pieces = piece_count(size, piece_length);
+        const uint64_t run_limit = std::max<uint64_t>(rehash_window / piece_length, 1);
+        std::vector<char> buffer;
+        try
+        {
+            for (uint64_t first = 0; first < pieces;)
+            {
+                if (!is_dirty(dirty, first))
+                {
+                    ++first;
+                    continue;
+                }
+                if (cancel && cancel->load(std::memory_order_relaxed))
+                {
+                    ::close(fd);
+                    return false;
+                }
+                uint64_t last = first + 1;
+                while (last < pieces && last - first < run_limit && is_dirty(dirty, last))
+                    ++last;
+
+                uint64_t offset = first * piece_length;
+                size_t length = static_cast<size_t>(std::min(last * piece_length, size) - offset);
+                buffer.resize(length);
+                size_t got = 0;
+                while (got < length)
+                {
+                    ssize_t n = ::pread(fd, buffer.data() + got, length - got, static_cast<off_t>(offset + got));
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n <= 0)
+                        throw std::runtime_error("Failed to read file: " + path);
+                    got += static_cast<size_t>(n);
+                }
+
+                hash_pieces(buffer.data(), length, static_cast<int64_t>(piece_length),
+                            &digests[first * sha1_digest_size], workers);
+                for (uint64_t piece = first; piece < last; ++piece)
+                    dirty[piece / 8] &= uint8_t(~(1u << (piece % 8)));
+                first = last;
+            }
+        }
+        catch (...)
+        {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        return true;
+    }
+
+    std::string HashCache::piece_hashes(const std::string &path, int64_t piece_length, unsigned workers,
+                                        const std::atomic<bool> *cancel)
+    {
+        if (piece_length <= 0)
+            throw std::runtime_error("Piece length must be positive");
+
+        auto before = identify(path);
+        if (!before)
+            return hash_file_pieces(path, piece_length, workers); // reports the error
+
+        std::string file = entry_path(path, piece_length);
+        std::optional<Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entry = load(file);
+        }
+
+        bool done = true;
+        if (entry && entry->identity == *before && entry->piece_length == uint64_t(piece_length))
+        {
+            if (std::none_of(entry->dirty.begin(), entry->dirty.end(), [](uint8_t b)
+                             { return b != 0; }))
+                return std::move(entry->digests);
+
+            done = rehash_dirty(path, entry->dirty, entry->digests, before->size, uint64_t(piece_length), workers,
+                                cancel);
+        }
+        else
+        {
+            const uint64_t pieces = piece_count(before->size, piece_length);
+            entry = Entry{};
+            entry->identity = *before;
+            entry->piece_length = uint64_t(piece_length);
+            entry->dirty.assign(static_cast<size_t>((pieces + 7) / 8), 0);
+            if (cancel)
+            {
+                // Every piece dirty, so a cancelled pass still keeps its work
+                entry->digests.assign(static_cast<size_t>(pieces * sha1_digest_size), '\0');
+                mark_dirty(entry->dirty, 0, pieces);
+                done = rehash_dirty(path, entry->dirty, entry->digests, before->size, uint64_t(piece_length),
+                                    workers, cancel);
+            }
+            else
+            {
+                entry->digests = hash_file_pieces(path, piece_length, workers);
+            }
+        }
+
+        // A file modified while it was read yields digests of neither version
+        auto after = identify(path);
+        if (after && *after == *before)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            save(file, *entry);
+        }
+        if (!done)
+            return {};
+        return std::move(entry->digests);
+    }
+
+    void HashCache::invalidate(const std::string &path, uint64_t offset, uint64_t length)
+    {
+        auto now = identify(path);
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &file : entries_for(path))
+        {
+            auto entry = load(file);
+            if (!entry || !now || entry->identity.inode != now->inode || entry->identity.device != now->device)
+            {
+                // Replaced or gone: nothing in the entry can be trusted
+                std::remove(file.c_str());
+                continue;
+            }
+
+            const uint64_t piece = entry->piece_length;
+            const uint64_t pieces = piece_count(now->size, piece);
+            uint64_t first = offset / piece;
+            uint64_t last = std::min(piece_count(offset + length, piece), pieces);
+
+            // A size change moves the final piece boundary; everything from
+            // the shorter end onwards has to be hashed again
+            if (now->size != entry->identity.size)
+            {
+                first = std::min(first, std::min(now->size, entry->identity.size) / piece);
+                last = pieces;
+                entry->digests.resize(static_cast<size_t>(pieces * sha1_digest_size), '\0');
+                entry->dirty.resize(static_cast<size_t>((pieces + 7) / 8), 0);
+                if (pieces % 8)
+                    entry->dirty.back() &= uint8_t((1u << (pieces % 8)) - 1);
+            }
+
+            mark_dirty(entry->dirty, first, last);
+            entry->identity = *now;
+            save(file, *entry);
+        }
+    }
+
+    void HashCache::erase(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &file : entries_for(path))
+            std::remove(file.c_str());
+    }
+
+    HashCache *default_hash_cache()
+    {
+        static HashCache *cache = []() -> HashCache *
+        {
+            fs::path base;
+            if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+                base = xdg;
+            else if (const char *home = std::getenv("HOME"); home && *home)
+                base = fs::path(home) / ".cache";
+            else
+                return nullptr;
+
+            try
+            {
+                return new HashCache((base / "bitlite" / "hashes").string());
+            }
+            catch (const std::exception &)
+            {
+                return nullptr; // an unwritable cache only costs speed
+            }
+        }();
+        return cache;
+    }
+
+}
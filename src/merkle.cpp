@@ -0,0 +1,184 @@
+#include "merkle.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <openssl/sha.h>
+
+namespace torrent
+{
+    static constexpr unsigned max_levels = 64;
+
+    Sha256Digest sha256(const void *data, size_t length)
+    {
+        Sha256Digest digest;
+        SHA256(static_cast<const unsigned char *>(data), length, digest.data());
+        return digest;
+    }
+
+    static Sha256Digest hash_pair(const Sha256Digest &left, const Sha256Digest &right)
+    {
+        unsigned char both[64];
+        std::memcpy(both, left.data(), 32);
+        std::memcpy(both + 32, right.data(), 32);
+        return sha256(both, sizeof(both));
+    }
+
+    static unsigned ceil_log2(uint64_t n)
+    {
+        unsigned level = 0;
+        while ((uint64_t(1) << level) < n)
+            ++level;
+        return level;
+    }
+
+    const Sha256Digest &merkle_pad(unsigned level)
+    {
+        static const auto pads = []
+        {
+            std::array<Sha256Digest, max_levels> p{};
+            for (unsigned i = 1; i < max_levels; ++i)
+                p[i] = hash_pair(p[i - 1], p[i - 1]);
+            return p;
+        }();
+        if (level >= max_levels)
+            throw std::runtime_error("Merkle tree too tall");
+        return pads[level];
+    }
+
+    Sha256Digest merkle_root(const Sha256Digest *leaves, size_t count, size_t width)
+    {
+        if (width == 0 || (width & (width - 1)) != 0 || count > width)
+            throw std::runtime_error("Invalid merkle tree width");
+        if (count == 0)
+            return merkle_pad(ceil_log2(width));
+
+        std::vector<Sha256Digest> level(leaves, leaves + count);
+        for (unsigned depth = 0; width > 1; ++depth, width /= 2)
+        {
+            size_t n = level.size();
+            for (size_t i = 0; i < n; i += 2)
+                level[i / 2] = hash_pair(level[i], i + 1 < n ? level[i + 1] : merkle_pad(depth));
+            level.resize((n + 1) / 2);
+        }
+        return level[0];
+    }
+
+    bool verify_block(std::string_view block, size_t index, const std::vector<Sha256Digest> &proof,
+                      const Sha256Digest &root)
+    {
+        if (block.empty() || block.size() > merkle_block_size)
+            return false;
+
+        Sha256Digest hash = sha256(block.data(), block.size());
+        for (size_t i = 0; i < proof.size(); ++i)
+        {
+            // The index's bits say on which side the sibling sits at each level
+            hash = ((index >> i) & 1) ? hash_pair(proof[i], hash) : hash_pair(hash, proof[i]);
+        }
+        return hash == root;
+    }
+
+    bool verify_piece(std::string_view piece, int64_t piece_length, const Sha256Digest &expected)
+    {
+        if (piece.empty() || piece_length <= 0 || piece.size() > static_cast<uint64_t>(piece_length))
+            return false;
+
+        std::vector<Sha256Digest> leaves;
+        leaves.reserve((piece.size() + merkle_block_size - 1) / merkle_block_size);
+        for (size_t offset = 0; offset < piece.size(); offset += merkle_block_size)
+        {
+            size_t len = std::min(merkle_block_size, piece.size() - offset);
+            leaves.push_back(sha256(piece.data() + offset, len));
+        }
+
+        size_t width = static_cast<size_t>(piece_length) / merkle_block_size;
+        return merkle_root(leaves.data(), leaves.size(), width) == expected;
+    }
+
+    // ----------------- MerkleTreeBuilder -----------------
+    MerkleTreeBuilder::MerkleTreeBuilder(int64_t piece_length)
+        : block_(merkle_block_size), piece_length_(piece_length)
+    {
+        if (piece_length < static_cast<int64_t>(merkle_block_size) || (piece_length & (piece_length - 1)) != 0)
+            throw std::runtime_error("Piece length must be a power of two of at least 16 KiB");
+        piece_level_ = ceil_log2(static_cast<uint64_t>(piece_length) / merkle_block_size);
+    }
+
+    void MerkleTreeBuilder::update(const char *data, size_t length)
+    {
+        length_ += length;
+
+        // Top up a block left over from the previous call first
+        if (block_used_ > 0)
+        {
+            size_t take = std::min(length, merkle_block_size - block_used_);
+            std::memcpy(block_.data() + block_used_, data, take);
+            block_used_ += take;
+            data += take;
+            length -= take;
+            if (block_used_ < merkle_block_size)
+                return;
+            push(sha256(block_.data(), merkle_block_size));
+            block_used_ = 0;
+        }
+
+        // Whole blocks are hashed straight from the caller's buffer
+        while (length >= merkle_block_size)
+        {
+            push(sha256(data, merkle_block_size));
+            data += merkle_block_size;
+            length -= merkle_block_size;
+        }
+
+        std::memcpy(block_.data(), data, length);
+        block_used_ = length;
+    }
+
+    void MerkleTreeBuilder::push(const Sha256Digest &leaf)
+    {
+        ++leaves_;
+        add(Node{leaf, 0});
+    }
+
+    // Adds a completed subtree, merging it with its left sibling while one is
+    // waiting. The stack's levels strictly decrease, like a binary counter.
+    void MerkleTreeBuilder::add(Node node)
+    {
+        for (;;)
+        {
+            if (node.level == piece_level_)
+                layer_.append(reinterpret_cast<const char *>(node.hash.data()), node.hash.size());
+            if (stack_.empty() || stack_.back().level != node.level)
+                break;
+            node = Node{hash_pair(stack_.back().hash, node.hash), node.level + 1};
+            stack_.pop_back();
+        }
+        stack_.push_back(node);
+    }
+
+    Sha256Digest MerkleTreeBuilder::finish()
+    {
+        // The final block is hashed as is, without padding
+        if (block_used_ > 0)
+        {
+            push(sha256(block_.data(), block_used_));
+            block_used_ = 0;
+        }
+        if (leaves_ == 0)
+            return Sha256Digest{};
+
+        // Close the right edge of the tree with zero subtrees
+        const unsigned height = ceil_log2(leaves_);
+        while (stack_.size() > 1 || stack_.back().level < height)
+        {
+            Node top = stack_.back();
+            stack_.pop_back();
+            add(Node{hash_pair(top.hash, merkle_pad(top.level)), top.level + 1});
+        }
+
+        if (length_ <= static_cast<uint64_t>(piece_length_))
+            layer_.clear();
+        return stack_.back().hash;
+    }
+
+}
@@ -1,4 +1,5 @@
 #include "network.hpp"
+#include "peer_wire.hpp"
 
 std::string url_encode(const std::string &value)
 {
@@ -140,7 +141,7 @@ std::string send_https_request(const std::string &host, int port, const std::str
 // Splits the announce URL into its components: protocol, host, port, and path
 std::vector<std::string> split_announce_url(const std::string &announce_url)
 {
-    std::regex url_regex(R"((\w+)://([^:/]+)(:(\d+))?(.*))");
+    static const std::regex url_regex(R"((\w+)://([^:/]+)(:(\d+))?(.*))");
     std::smatch match;
 
     std::string protocol, host, port = "80", path = "/announce"; // defaults
@@ -219,7 +220,8 @@ int connect_to_peer_http(const std::string &ip, int port)
     return sockfd; // -1 if all connections failed
 }
 
-void send_handshake(int sockfd, const std::string &info_hash, const std::string &peer_id)
+std::array<uint8_t, 68> build_handshake(const std::string &info_hash, const std::string &peer_id,
+                                        bool fast_extension)
 {
     std::array<uint8_t, 68> handshake;
 
@@ -228,8 +230,12 @@ void send_handshake(int sockfd, const std::string &info_hash, const std::string
 
     std::memcpy(&handshake[1], pstr.c_str(), pstr.size());
 
-    // Reserved bytes (8 zeros)
+    // Reserved bytes: extension bits, all clear unless offered
     std::memset(&handshake[1 + pstr.size()], 0, 8);
+    if (fast_extension)
+    {
+        handshake[1 + pstr.size() + torrent::wire::fast_extension_byte] |= torrent::wire::fast_extension_bit;
+    }
 
     // Copy info_hash (20 bytes)
     std::memcpy(&handshake[1 + pstr.size() + 8], info_hash.data(), 20);
@@ -237,6 +243,13 @@ void send_handshake(int sockfd, const std::string &info_hash, const std::string
     // Copy peer_id (20 bytes)
     std::memcpy(&handshake[1 + pstr.size() + 8 + 20], peer_id.data(), 20);
 
+    return handshake;
+}
+
+void send_handshake(int sockfd, const std::string &info_hash, const std::string &peer_id)
+{
+    std::array<uint8_t, 68> handshake = build_handshake(info_hash, peer_id);
+
     // Send the handshake
     ssize_t sent = send(sockfd, handshake.data(), handshake.size(), 0);
     if (sent != static_cast<ssize_t>(handshake.size()))
@@ -0,0 +1,555 @@
+#include "peer_session.hpp"
+#include "network.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+
+namespace torrent
+{
+    // Most allowed fast pieces remembered from one peer
+    static constexpr size_t max_allowed_fast = 64;
+
+    const char *peer_state_name(PeerSession::State state)
+    {
+        switch (state)
+        {
+        case PeerSession::State::Connecting:
+            return "connecting";
+        case PeerSession::State::Handshaking:
+            return "handshaking";
+        case PeerSession::State::AwaitingBitfield:
+            return "awaiting bitfield";
+        case PeerSession::State::Idle:
+            return "idle";
+        case PeerSession::State::Interested:
+            return "interested";
+        case PeerSession::State::Unchoked:
+            return "unchoked";
+        case PeerSession::State::Closed:
+            return "closed";
+        }
+        return "unknown";
+    }
+
+    PeerSession::PeerSession(Reactor &reactor, std::string ip, uint16_t port, std::string info_hash,
+                             std::string peer_id, size_t num_pieces, PeerSessionConfig config)
+        : reactor_(reactor), ip_(std::move(ip)), port_(port), info_hash_(std::move(info_hash)),
+          peer_id_(std::move(peer_id)), config_(config), decoder_(config.max_message), bitfield_(num_pieces)
+    {
+        if (info_hash_.size() != 20 || peer_id_.size() != 20)
+            throw std::runtime_error("Info hash and peer id must be 20 bytes");
+    }
+
+    PeerSession::~PeerSession()
+    {
+        // Nobody is left to tell
+        on_state_ = nullptr;
+        close("Session destroyed");
+    }
+
+    void PeerSession::start()
+    {
+        // Peers come from trackers as numeric addresses, so nothing here can
+        // block on name resolution
+        sockaddr_storage addr{};
+        socklen_t addr_len = 0;
+        auto *v4 = reinterpret_cast<sockaddr_in *>(&addr);
+        auto *v6 = reinterpret_cast<sockaddr_in6 *>(&addr);
+        if (inet_pton(AF_INET, ip_.c_str(), &v4->sin_addr) == 1)
+        {
+            v4->sin_family = AF_INET;
+            v4->sin_port = htons(port_);
+            addr_len = sizeof(sockaddr_in);
+        }
+        else if (inet_pton(AF_INET6, ip_.c_str(), &v6->sin6_addr) == 1)
+        {
+            v6->sin6_family = AF_INET6;
+            v6->sin6_port = htons(port_);
+            addr_len = sizeof(sockaddr_in6);
+        }
+        else
+        {
+            close("Invalid peer address: " + ip_);
+            return;
+        }
+
+        fd_ = ::socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd_ < 0)
+        {
+            close(std::string("Failed to create socket: ") + std::strerror(errno));
+            return;
+        }
+        int one = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        arm(step_timer_, config_.handshake_timeout, "Handshake timed out");
+        reactor_.add(fd_, EPOLLIN | EPOLLOUT | EPOLLRDHUP, [this](uint32_t events)
+                     { on_events(events); });
+
+        if (::connect(fd_, reinterpret_cast<sockaddr *>(&addr), addr_len) == 0)
+            on_connected();
+        else if (errno != EINPROGRESS)
+            close(std::string("Connection failed: ") + std::strerror(errno));
+    }
+
+    void PeerSession::on_events(uint32_t events)
+    {
+        if (state_ == State::Closed)
+            return;
+
+        if (state_ == State::Connecting)
+        {
+            if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+                return;
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0)
+            {
+                close(std::string("Connection failed: ") + std::strerror(err));
+                return;
+            }
+            on_connected();
+            if (state_ == State::Closed)
+                return;
+        }
+
+        if (events & EPOLLOUT)
+            flush();
+        if (state_ != State::Closed && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+            receive();
+    }
+
+    void PeerSession::on_connected()
+    {
+        // Messages queued while connecting go out behind the handshake
+        auto handshake = build_handshake(info_hash_, peer_id_, config_.fast_extension);
+        send_queue_.prepend(std::string_view(reinterpret_cast<const char *>(handshake.data()), handshake.size()));
+        set_state(State::Handshaking);
+        flush();
+    }
+
+    void PeerSession::send(uint8_t id, std::string_view payload)
+    {
+        if (state_ == State::Closed)
+            return;
+        wire::write_raw(send_queue_.bytes(), id, payload);
+        if (state_ != State::Connecting && !corked_)
+            flush();
+    }
+
+    void PeerSession::request_block(uint32_t index, uint32_t begin, uint32_t length)
+    {
+        if (state_ == State::Closed)
+            return;
+        wire::write_request(send_queue_.bytes(), index, begin, length);
+        if (state_ != State::Connecting && !corked_)
+            flush();
+    }
+
+    void PeerSession::cancel_block(uint32_t index, uint32_t begin, uint32_t length)
+    {
+        if (state_ == State::Closed)
+            return;
+        wire::write_cancel(send_queue_.bytes(), index, begin, length);
+        if (state_ != State::Connecting && !corked_)
+            flush();
+    }
+
+    void PeerSession::send_piece(uint32_t index, uint32_t begin, const std::vector<FileRange> &ranges)
+    {
+        if (state_ == State::Closed)
+            return;
+        send_queue_.push_piece(index, begin, ranges);
+        if (state_ != State::Connecting && !corked_)
+            flush();
+    }
+
+    void PeerSession::send_piece(uint32_t index, uint32_t begin, BufferPool::Buffer buffer, size_t length)
+    {
+        if (state_ == State::Closed)
+            return;
+        send_queue_.push_piece(index, begin, std::move(buffer), length);
+        if (state_ != State::Connecting && !corked_)
+            flush();
+    }
+
+    bool PeerSession::cancel_piece(uint32_t index, uint32_t begin, uint32_t length)
+    {
+        return send_queue_.cancel_piece(index, begin, length);
+    }
+
+    void PeerSession::set_choking(bool choking)
+    {
+        if (state_ == State::Closed || am_choking_ == choking)
+            return;
+        am_choking_ = choking;
+        wire::write_message(send_queue_.bytes(), choking ? wire::MessageType::Choke : wire::MessageType::Unchoke);
+        // A choke discards the peer's outstanding requests, so pieces that
+        // haven't started going out are dropped with them, except those we
+        // let the peer fetch while choked. Under the fast extension the
+        // peer is told about each one.
+        if (choking)
+        {
+            std::vector<SendQueue::Block> cancelled;
+            send_queue_.cancel_pieces(fast_ ? &cancelled : nullptr, &granted_fast_);
+            for (const auto &block : cancelled)
+                wire::write_reject_request(send_queue_.bytes(), block.index, block.begin, block.length);
+        }
+        if (state_ != State::Connecting && !corked_)
+            flush();
+    }
+
+    void PeerSession::send_have_set(const Bitfield &have)
+    {
+        if (state_ == State::Closed)
+            return;
+        // Which message fits depends on the peer's handshake; until it
+        // arrives, hold on to the set
+        if (state_ == State::Connecting || state_ == State::Handshaking)
+        {
+            pending_have_ = have;
+            have_pending_ = true;
+            return;
+        }
+        write_have_set(have);
+        if (!corked_)
+            flush();
+    }
+
+    void PeerSession::write_have_set(const Bitfield &have)
+    {
+        if (fast_ && have.all())
+            wire::write_message(send_queue_.bytes(), wire::MessageType::HaveAll);
+        else if (fast_ && have.none())
+            wire::write_message(send_queue_.bytes(), wire::MessageType::HaveNone);
+        else if (!have.none())
+            wire::write_bitfield(send_queue_.bytes(), have.to_bytes());
+        else
+            return;
+        sent_have_set_ = true;
+    }
+
+    void PeerSession::reject_request(uint32_t index, uint32_t begin, uint32_t length)
+    {
+        if (state_ == State::Closed || !fast_)
+            return;
+        wire::write_reject_request(send_queue_.bytes(), index, begin, length);
+        if (!corked_)
+            flush();
+    }
+
+    void PeerSession::suggest_piece(uint32_t index)
+    {
+        if (state_ == State::Closed || !fast_)
+            return;
+        wire::write_suggest_piece(send_queue_.bytes(), index);
+        if (!corked_)
+            flush();
+    }
+
+    void PeerSession::allow_fast(uint32_t index)
+    {
+        if (state_ == State::Closed || !fast_ || granted_fast(index))
+            return;
+        granted_fast_.push_back(index);
+        wire::write_allowed_fast(send_queue_.bytes(), index);
+        if (!corked_)
+            flush();
+    }
+
+    bool PeerSession::granted_fast(uint32_t index) const
+    {
+        return std::find(granted_fast_.begin(), granted_fast_.end(), index) != granted_fast_.end();
+    }
+
+    void PeerSession::uncork()
+    {
+        if (corked_ > 0 && --corked_ == 0 && state_ != State::Closed && state_ != State::Connecting)
+            flush();
+    }
+
+    // Writes until the queue is empty or the socket is full; with edge
+    // triggering, EPOLLOUT fires again once there is room
+    void PeerSession::flush()
+    {
+        if (send_queue_.flush(fd_) == SendQueue::Result::Error)
+            close(std::string("Send failed: ") + std::strerror(errno));
+    }
+
+    // Drains the socket completely, as edge triggering requires. Each fill
+    // takes as much as the ring has room for, which is usually many messages
+    // per recv.
+    void PeerSession::receive()
+    {
+        for (;;)
+        {
+            auto result = decoder_.fill(fd_);
+            if (result == wire::Decoder::FillResult::Error)
+            {
+                close(std::string("Receive failed: ") + std::strerror(errno));
+                return;
+            }
+
+            process();
+            if (state_ == State::Closed)
+                return;
+            if (result == wire::Decoder::FillResult::Closed)
+            {
+                close("Connection closed by peer");
+                return;
+            }
+            if (result == wire::Decoder::FillResult::Drained)
+                return;
+        }
+    }
+
+    void PeerSession::process()
+    {
+        try
+        {
+            if (state_ == State::Handshaking)
+            {
+                auto handshake = decoder_.next_handshake();
+                if (!handshake || !handle_handshake(*handshake))
+                    return;
+            }
+
+            while (state_ != State::Closed)
+            {
+                auto msg = decoder_.next();
+                if (!msg)
+                    break;
+                if (!msg->keep_alive)
+                    handle_message(*msg);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            close(e.what());
+        }
+    }
+
+    bool PeerSession::handle_handshake(const wire::Handshake &handshake)
+    {
+        if (handshake.info_hash != info_hash_)
+        {
+            close("Info hash mismatch");
+            return false;
+        }
+        remote_peer_id_.assign(handshake.peer_id);
+        fast_ = config_.fast_extension && handshake.fast_extension();
+
+        if (have_pending_)
+        {
+            write_have_set(pending_have_);
+            pending_have_ = Bitfield();
+            have_pending_ = false;
+        }
+
+        disarm(step_timer_);
+        set_state(State::AwaitingBitfield);
+        // The fast extension has every peer open with what it has
+        if (fast_ && !sent_have_set_ && state_ != State::Closed)
+            write_have_set(Bitfield(bitfield_.size()));
+        if (state_ != State::Closed)
+            flush();
+        if (state_ == State::AwaitingBitfield)
+            arm(step_timer_, config_.interested_timeout, nullptr);
+        schedule_keepalive();
+        return state_ != State::Closed;
+    }
+
+    void PeerSession::handle_message(const wire::Message &msg)
+    {
+        if (!fast_ && msg.id >= uint8_t(wire::MessageType::SuggestPiece) &&
+            msg.id <= uint8_t(wire::MessageType::AllowedFast))
+        {
+            close("Fast extension message without the extension");
+            return;
+        }
+
+        switch (msg.type())
+        {
+        case wire::MessageType::Choke:
+            peer_choking_ = true;
+            if (state_ == State::Unchoked)
+            {
+                set_state(State::Interested);
+                arm(step_timer_, config_.unchoke_timeout, "Timed out waiting for unchoke");
+            }
+            break;
+        case wire::MessageType::Unchoke:
+            peer_choking_ = false;
+            if (state_ == State::Interested)
+            {
+                disarm(step_timer_);
+                set_state(State::Unchoked);
+            }
+            break;
+        case wire::MessageType::Interested:
+            peer_interested_ = true;
+            break;
+        case wire::MessageType::NotInterested:
+            peer_interested_ = false;
+            break;
+        case wire::MessageType::Have:
+            if (msg.index < bitfield_.size())
+                bitfield_.set(msg.index);
+            if (state_ == State::AwaitingBitfield || state_ == State::Idle)
+                decide_interest();
+            break;
+        case wire::MessageType::Bitfield:
+            bitfield_ = Bitfield::from_bytes(msg.payload, bitfield_.size());
+            if (state_ == State::AwaitingBitfield || state_ == State::Idle)
+                decide_interest();
+            break;
+        case wire::MessageType::HaveAll:
+            bitfield_.set_all();
+            if (state_ == State::AwaitingBitfield || state_ == State::Idle)
+                decide_interest();
+            break;
+        case wire::MessageType::HaveNone:
+            bitfield_.reset_all();
+            if (state_ == State::AwaitingBitfield || state_ == State::Idle)
+                decide_interest();
+            break;
+        case wire::MessageType::AllowedFast:
+            // Peers grant about ten; the cap keeps a hostile one from
+            // growing the list without bound
+            if (msg.index < bitfield_.size() && allowed_fast_.size() < max_allowed_fast &&
+                std::find(allowed_fast_.begin(), allowed_fast_.end(), msg.index) == allowed_fast_.end())
+                allowed_fast_.push_back(msg.index);
+            break;
+        default:
+            break;
+        }
+
+        if (state_ != State::Closed && on_message_)
+            on_message_(*this, msg);
+    }
+
+    void PeerSession::set_our_pieces(const Bitfield &ours)
+    {
+        if (ours.size() != bitfield_.size())
+            throw std::runtime_error("Piece count differs from the session's");
+        ours_ = &ours;
+    }
+
+    // For the owner, once our pieces changed; while the peer's pieces are
+    // still unknown the decision waits for them
+    void PeerSession::update_interest()
+    {
+        if (state_ == State::Idle || state_ == State::Interested || state_ == State::Unchoked)
+            decide_interest();
+    }
+
+    void PeerSession::decide_interest()
+    {
+        bool want = !ours_ || has_missing(*ours_, bitfield_);
+        if (want && !am_interested_)
+            declare_interest();
+        else if (!want && state_ != State::Idle)
+            lose_interest();
+    }
+
+    void PeerSession::declare_interest()
+    {
+        disarm(step_timer_);
+        am_interested_ = true;
+        wire::write_message(send_queue_.bytes(), wire::MessageType::Interested);
+        flush();
+        if (state_ == State::Closed)
+            return;
+
+        // Some peers unchoke before we ask
+        if (!peer_choking_)
+        {
+            set_state(State::Unchoked);
+            return;
+        }
+        set_state(State::Interested);
+        if (state_ == State::Interested)
+            arm(step_timer_, config_.unchoke_timeout, "Timed out waiting for unchoke");
+    }
+
+    // Nothing to wait for from the peer, so no unchoke deadline either; the
+    // connection stays up for uploading
+    void PeerSession::lose_interest()
+    {
+        disarm(step_timer_);
+        if (am_interested_)
+        {
+            am_interested_ = false;
+            wire::write_message(send_queue_.bytes(), wire::MessageType::NotInterested);
+            flush();
+            if (state_ == State::Closed)
+                return;
+        }
+        set_state(State::Idle);
+    }
+
+    void PeerSession::schedule_keepalive()
+    {
+        keepalive_timer_ = reactor_.schedule(config_.keepalive_interval, [this]
+                                             {
+            keepalive_timer_ = 0;
+            if (state_ == State::Closed)
+                return;
+            wire::write_keep_alive(send_queue_.bytes());
+            flush();
+            if (state_ != State::Closed)
+                schedule_keepalive(); });
+    }
+
+    // A step timer with no reason moves the session on instead of failing it:
+    // that's the interested timer, after which interest is decided anyway
+    void PeerSession::arm(Reactor::TimerId &timer, std::chrono::milliseconds delay, const char *reason)
+    {
+        disarm(timer);
+        timer = reactor_.schedule(delay, [this, &timer, reason]
+                                  {
+            timer = 0;
+            if (reason)
+                close(reason);
+            else if (state_ == State::AwaitingBitfield)
+                decide_interest(); });
+    }
+
+    void PeerSession::disarm(Reactor::TimerId &timer)
+    {
+        if (timer)
+            reactor_.cancel(timer);
+        timer = 0;
+    }
+
+    void PeerSession::set_state(State state)
+    {
+        if (state_ == state)
+            return;
+        state_ = state;
+        if (on_state_)
+            on_state_(*this);
+    }
+
+    void PeerSession::close(const std::string &reason)
+    {
+        if (state_ == State::Closed)
+            return;
+
+        disarm(step_timer_);
+        disarm(keepalive_timer_);
+        if (fd_ >= 0)
+        {
+            reactor_.remove(fd_);
+            ::close(fd_);
+            fd_ = -1;
+        }
+        send_queue_.clear();
+        error_ = reason;
+        set_state(State::Closed);
+    }
+
+}
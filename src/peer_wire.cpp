@@ -0,0 +1,305 @@
+#include "peer_wire.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace torrent
+{
+namespace wire
+{
+    static const char protocol_prefix[] = "\x13"
+                                          "BitTorrent protocol";
+
+    static uint32_t read_u32(const char *p)
+    {
+        const auto *b = reinterpret_cast<const unsigned char *>(p);
+        return (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | uint32_t(b[3]);
+    }
+
+    static void append_u32(std::string &out, uint32_t v)
+    {
+        char b[4] = {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+        out.append(b, 4);
+    }
+
+    static void append_header(std::string &out, uint32_t length, MessageType type)
+    {
+        append_u32(out, length);
+        out.push_back(static_cast<char>(type));
+    }
+
+    // ----------------- RingBuffer -----------------
+
+    RingBuffer::RingBuffer(size_t min_capacity)
+    {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        capacity_ = (std::max<size_t>(min_capacity, 1) + page - 1) / page * page;
+
+        int fd = memfd_create("peer_wire_ring", MFD_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error(std::string("Failed to create ring buffer: ") + std::strerror(errno));
+        if (ftruncate(fd, static_cast<off_t>(capacity_)) != 0)
+        {
+            int err = errno;
+            ::close(fd);
+            throw std::runtime_error(std::string("Failed to size ring buffer: ") + std::strerror(err));
+        }
+
+        // Reserve twice the capacity, then map the same pages into both halves
+        void *region = mmap(nullptr, 2 * capacity_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED)
+        {
+            int err = errno;
+            ::close(fd);
+            throw std::runtime_error(std::string("Failed to reserve ring buffer: ") + std::strerror(err));
+        }
+        base_ = static_cast<char *>(region);
+        for (int half = 0; half < 2; ++half)
+        {
+            void *p = mmap(base_ + half * capacity_, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                int err = errno;
+                munmap(base_, 2 * capacity_);
+                ::close(fd);
+                throw std::runtime_error(std::string("Failed to map ring buffer: ") + std::strerror(err));
+            }
+        }
+        // The mappings keep the memory alive
+        ::close(fd);
+    }
+
+    RingBuffer::~RingBuffer()
+    {
+        if (base_)
+            munmap(base_, 2 * capacity_);
+    }
+
+    // ----------------- Decoder -----------------
+
+    // Room for at least two maximal messages, so a full one always fits
+    // behind a partial one and a single recv can pick up several
+    Decoder::Decoder(uint32_t max_message)
+        : ring_(2 * (size_t(max_message) + 4)), max_message_(max_message)
+    {
+    }
+
+    Decoder::FillResult Decoder::fill(int fd)
+    {
+        for (;;)
+        {
+            size_t room = ring_.writable();
+            if (room == 0)
+                return FillResult::Full;
+            ssize_t n = ::recv(fd, ring_.write_ptr(), room, 0);
+            if (n > 0)
+            {
+                ring_.commit(static_cast<size_t>(n));
+                continue;
+            }
+            if (n == 0)
+                return FillResult::Closed;
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return FillResult::Drained;
+            return FillResult::Error;
+        }
+    }
+
+    size_t Decoder::feed(std::string_view data)
+    {
+        size_t n = std::min(data.size(), ring_.writable());
+        std::memcpy(ring_.write_ptr(), data.data(), n);
+        ring_.commit(n);
+        return n;
+    }
+
+    std::optional<Handshake> Decoder::next_handshake()
+    {
+        ring_.consume(pending_);
+        pending_ = 0;
+        if (ring_.readable() < handshake_size)
+            return std::nullopt;
+
+        const char *p = ring_.read_ptr();
+        if (std::memcmp(p, protocol_prefix, 20) != 0)
+            throw std::runtime_error("Unexpected protocol string");
+        pending_ = handshake_size;
+        return Handshake{std::string_view(p + 20, 8), std::string_view(p + 28, 20), std::string_view(p + 48, 20)};
+    }
+
+    std::optional<Message> Decoder::next()
+    {
+        ring_.consume(pending_);
+        pending_ = 0;
+
+        size_t available = ring_.readable();
+        if (available < 4)
+            return std::nullopt;
+        const char *p = ring_.read_ptr();
+        uint32_t length = read_u32(p);
+        if (length > max_message_)
+            throw std::runtime_error("Message too long");
+        if (available < 4 + size_t(length))
+            return std::nullopt;
+
+        Message msg;
+        if (length == 0)
+        {
+            msg.keep_alive = true;
+            pending_ = 4;
+            return msg;
+        }
+
+        msg.id = static_cast<uint8_t>(p[4]);
+        const char *body = p + 5;
+        size_t size = length - 1;
+        switch (msg.type())
+        {
+        case MessageType::Choke:
+        case MessageType::Unchoke:
+        case MessageType::Interested:
+        case MessageType::NotInterested:
+        case MessageType::HaveAll:
+        case MessageType::HaveNone:
+            if (size != 0)
+                throw std::runtime_error("Invalid state message");
+            break;
+        case MessageType::Have:
+        case MessageType::SuggestPiece:
+        case MessageType::AllowedFast:
+            if (size != 4)
+                throw std::runtime_error(msg.type() == MessageType::Have ? "Invalid have message"
+                                         : msg.type() == MessageType::SuggestPiece ? "Invalid suggest piece message"
+                                                                                    : "Invalid allowed fast message");
+            msg.index = read_u32(body);
+            break;
+        case MessageType::Bitfield:
+            msg.payload = std::string_view(body, size);
+            break;
+        case MessageType::Request:
+        case MessageType::Cancel:
+        case MessageType::RejectRequest:
+            if (size != 12)
+                throw std::runtime_error(msg.type() == MessageType::Request  ? "Invalid request message"
+                                         : msg.type() == MessageType::Cancel ? "Invalid cancel message"
+                                                                             : "Invalid reject request message");
+            msg.index = read_u32(body);
+            msg.begin = read_u32(body + 4);
+            msg.length = read_u32(body + 8);
+            break;
+        case MessageType::Piece:
+            if (size < 8)
+                throw std::runtime_error("Invalid piece message");
+            msg.index = read_u32(body);
+            msg.begin = read_u32(body + 4);
+            msg.payload = std::string_view(body + 8, size - 8);
+            msg.length = static_cast<uint32_t>(msg.payload.size());
+            break;
+        case MessageType::Port:
+            if (size != 2)
+                throw std::runtime_error("Invalid port message");
+            msg.port = static_cast<uint16_t>((uint8_t(body[0]) << 8) | uint8_t(body[1]));
+            break;
+        default:
+            msg.payload = std::string_view(body, size);
+            break;
+        }
+
+        pending_ = 4 + size_t(length);
+        return msg;
+    }
+
+    // ----------------- Encoders -----------------
+
+    void write_keep_alive(std::string &out)
+    {
+        out.append(4, '\0');
+    }
+
+    void write_message(std::string &out, MessageType type)
+    {
+        append_header(out, 1, type);
+    }
+
+    void write_have(std::string &out, uint32_t index)
+    {
+        append_header(out, 5, MessageType::Have);
+        append_u32(out, index);
+    }
+
+    void write_bitfield(std::string &out, std::string_view bits)
+    {
+        append_header(out, static_cast<uint32_t>(bits.size() + 1), MessageType::Bitfield);
+        out.append(bits.data(), bits.size());
+    }
+
+    void write_request(std::string &out, uint32_t index, uint32_t begin, uint32_t length)
+    {
+        append_header(out, 13, MessageType::Request);
+        append_u32(out, index);
+        append_u32(out, begin);
+        append_u32(out, length);
+    }
+
+    void write_cancel(std::string &out, uint32_t index, uint32_t begin, uint32_t length)
+    {
+        append_header(out, 13, MessageType::Cancel);
+        append_u32(out, index);
+        append_u32(out, begin);
+        append_u32(out, length);
+    }
+
+    void write_port(std::string &out, uint16_t port)
+    {
+        append_header(out, 3, MessageType::Port);
+        out.push_back(static_cast<char>(port >> 8));
+        out.push_back(static_cast<char>(port));
+    }
+
+    void write_suggest_piece(std::string &out, uint32_t index)
+    {
+        append_header(out, 5, MessageType::SuggestPiece);
+        append_u32(out, index);
+    }
+
+    void write_reject_request(std::string &out, uint32_t index, uint32_t begin, uint32_t length)
+    {
+        append_header(out, 13, MessageType::RejectRequest);
+        append_u32(out, index);
+        append_u32(out, begin);
+        append_u32(out, length);
+    }
+
+    void write_allowed_fast(std::string &out, uint32_t index)
+    {
+        append_header(out, 5, MessageType::AllowedFast);
+        append_u32(out, index);
+    }
+
+    void write_piece_header(std::string &out, uint32_t index, uint32_t begin, uint32_t block_length)
+    {
+        append_header(out, 9 + block_length, MessageType::Piece);
+        append_u32(out, index);
+        append_u32(out, begin);
+    }
+
+    void write_piece(std::string &out, uint32_t index, uint32_t begin, std::string_view block)
+    {
+        write_piece_header(out, index, begin, static_cast<uint32_t>(block.size()));
+        out.append(block.data(), block.size());
+    }
+
+    void write_raw(std::string &out, uint8_t id, std::string_view payload)
+    {
+        append_header(out, static_cast<uint32_t>(payload.size() + 1), static_cast<MessageType>(id));
+        out.append(payload.data(), payload.size());
+    }
+
+}
+}
@@ -0,0 +1,179 @@
+#include "piece_hasher.hpp"
+#include "file_source.hpp"
+#include "merkle.hpp"
+#include "sha1.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <openssl/sha.h>
+
+namespace torrent
+{
+    // Pieces handed to a worker at a time. Keeps small pieces from turning
+    // into contention on the shared counter, and is a multiple of every
+    // multi-buffer SHA-1 lane count so each claim fills whole lane groups.
+    static constexpr size_t pieces_per_claim = 16;
+
+    // Bytes of the file in flight at once while streaming
+    static constexpr size_t stream_window = 64 << 20;
+
+    unsigned default_hash_workers()
+    {
+        unsigned n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    void hash_pieces(const char *data, size_t size, int64_t piece_length, char *out, unsigned workers)
+    {
+        if (piece_length <= 0)
+            throw std::runtime_error("Piece length must be positive");
+
+        const size_t piece = static_cast<size_t>(piece_length);
+        const size_t num_pieces = (size + piece - 1) / piece;
+        if (num_pieces == 0)
+            return;
+
+        std::atomic<size_t> next{0};
+        auto worker = [&]()
+        {
+            for (;;)
+            {
+                size_t first = next.fetch_add(pieces_per_claim, std::memory_order_relaxed);
+                if (first >= num_pieces)
+                    return;
+                size_t last = std::min(first + pieces_per_claim, num_pieces);
+
+                // Full-length pieces go through the multi-buffer engine together
+                const char *ptrs[pieces_per_claim];
+                size_t full = 0;
+                for (size_t i = first; i < last && (i + 1) * piece <= size; ++i)
+                    ptrs[full++] = data + i * piece;
+                sha1_many(ptrs, full, piece, reinterpret_cast<unsigned char *>(out + first * SHA_DIGEST_LENGTH));
+
+                // Only the file's final piece can be short
+                if (first + full < last)
+                {
+                    size_t offset = (first + full) * piece;
+                    sha1_digest(data + offset, size - offset,
+                                reinterpret_cast<unsigned char *>(out + (first + full) * SHA_DIGEST_LENGTH));
+                }
+            }
+        };
+
+        if (workers == 0)
+            workers = default_hash_workers();
+        size_t claims = (num_pieces + pieces_per_claim - 1) / pieces_per_claim;
+        size_t extra = std::min<size_t>(workers, claims) - 1;
+
+        std::vector<std::thread> threads;
+        threads.reserve(extra);
+        for (size_t i = 0; i < extra; ++i)
+            threads.emplace_back(worker);
+        worker();
+        for (auto &t : threads)
+            t.join();
+    }
+
+    std::string hash_pieces(const char *data, size_t size, int64_t piece_length, unsigned workers)
+    {
+        if (piece_length <= 0)
+            throw std::runtime_error("Piece length must be positive");
+
+        size_t num_pieces = (size + piece_length - 1) / piece_length;
+        std::string digests(num_pieces * SHA_DIGEST_LENGTH, '\0');
+        hash_pieces(data, size, piece_length, &digests[0], workers);
+        return digests;
+    }
+
+    // Hashes every window of the source; windows hold whole pieces only
+    static std::string hash_source(FileSource &source, size_t piece, unsigned workers, size_t expected_pieces)
+    {
+        std::string digests;
+        digests.reserve(expected_pieces * SHA_DIGEST_LENGTH);
+        for (auto window = source.next(); !window.empty(); window = source.next())
+        {
+            size_t offset = digests.size();
+            digests.resize(offset + (window.size() + piece - 1) / piece * SHA_DIGEST_LENGTH);
+            hash_pieces(window.data(), window.size(), static_cast<int64_t>(piece), &digests[offset], workers);
+        }
+        return digests;
+    }
+
+    std::string hash_file_pieces(const std::string &path, int64_t piece_length, unsigned workers)
+    {
+        if (piece_length <= 0)
+            throw std::runtime_error("Piece length must be positive");
+
+        // Whole pieces per window so no piece straddles two windows
+        const size_t piece = static_cast<size_t>(piece_length);
+        FileSource source(path, std::max<size_t>(stream_window / piece, 1) * piece);
+        return hash_source(source, piece, workers, (source.size() + piece - 1) / piece);
+    }
+
+    std::string hash_files_pieces(const std::vector<std::string> &paths, uint64_t total_length,
+                                  int64_t piece_length, unsigned workers)
+    {
+        if (piece_length <= 0)
+            throw std::runtime_error("Piece length must be positive");
+
+        // Don't size the read-ahead ring beyond what the files hold
+        const size_t piece = static_cast<size_t>(piece_length);
+        const size_t total_pieces = static_cast<size_t>((total_length + piece - 1) / piece);
+        size_t window = std::max<size_t>(std::min(stream_window / piece, total_pieces), 1) * piece;
+
+        FileSource source(paths, window);
+        return hash_source(source, piece, workers, total_pieces);
+    }
+
+    FileHashes hash_file_v2(const std::string &path, int64_t piece_length, bool v1, bool pad_last,
+                            unsigned workers)
+    {
+        MerkleTreeBuilder tree(piece_length);
+
+        const size_t piece = static_cast<size_t>(piece_length);
+        FileSource source(path, std::max<size_t>(stream_window / piece, 1) * piece);
+
+        FileHashes hashes;
+        if (v1)
+            hashes.pieces.reserve((source.size() + piece - 1) / piece * SHA_DIGEST_LENGTH);
+
+        for (auto window = source.next(); !window.empty(); window = source.next())
+        {
+            if (!v1)
+            {
+                tree.update(window.data(), window.size());
+                continue;
+            }
+
+            // The merkle tree is inherently serial; build it next to the
+            // parallel SHA1 pass instead of after it
+            std::thread merkle([&]
+                               { tree.update(window.data(), window.size()); });
+
+            size_t size = window.size();
+            size_t tail = pad_last ? size % piece : 0;
+            size_t offset = hashes.pieces.size();
+            hashes.pieces.resize(offset + (size + piece - 1) / piece * SHA_DIGEST_LENGTH);
+            hash_pieces(window.data(), size - tail, piece_length, &hashes.pieces[offset], workers);
+            if (tail > 0)
+            {
+                std::vector<char> padded(piece, '\0');
+                std::copy(window.end() - tail, window.end(), padded.begin());
+                sha1_digest(padded.data(), piece,
+                            reinterpret_cast<unsigned char *>(&hashes.pieces[hashes.pieces.size() - SHA_DIGEST_LENGTH]));
+            }
+            merkle.join();
+        }
+
+        if (tree.length() > 0)
+        {
+            Sha256Digest root = tree.finish();
+            hashes.pieces_root.assign(reinterpret_cast<const char *>(root.data()), root.size());
+            hashes.piece_layer = tree.piece_layer();
+        }
+        return hashes;
+    }
+
+}
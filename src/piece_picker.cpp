@@ -0,0 +1,220 @@
+#include "piece_picker.hpp"
+#include <stdexcept>
+
+namespace torrent
+{
+    static constexpr int32_t none = -1;
+
+    PiecePicker::PiecePicker(size_t num_pieces, uint64_t seed)
+        : avail_(num_pieces, 0), prev_(num_pieces, none), next_(num_pieces, none),
+          status_(num_pieces, Status::Wanted), head_(1, none), tail_(1, none), have_(num_pieces),
+          listed_(num_pieces), rng_(seed ? seed : 0x9e3779b97f4a7c15ULL ^ reinterpret_cast<uintptr_t>(this))
+    {
+        if (num_pieces > size_t(INT32_MAX))
+            throw std::runtime_error("Too many pieces");
+        for (size_t i = 0; i < num_pieces; ++i)
+            link(static_cast<uint32_t>(i));
+    }
+
+    // xorshift64: only needs to be cheap and not the same across instances
+    bool PiecePicker::coin()
+    {
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 7;
+        rng_ ^= rng_ << 17;
+        return rng_ & 1;
+    }
+
+    // ----------------- Lists -----------------
+
+    void PiecePicker::link(uint32_t index)
+    {
+        uint32_t count = avail_[index];
+        if (count >= head_.size())
+        {
+            head_.resize(count + 1, none);
+            tail_.resize(count + 1, none);
+        }
+
+        int32_t i = static_cast<int32_t>(index);
+        if (head_[count] == none)
+        {
+            prev_[index] = next_[index] = none;
+            head_[count] = tail_[count] = i;
+        }
+        else if (coin())
+        {
+            prev_[index] = none;
+            next_[index] = head_[count];
+            prev_[head_[count]] = i;
+            head_[count] = i;
+        }
+        else
+        {
+            next_[index] = none;
+            prev_[index] = tail_[count];
+            next_[tail_[count]] = i;
+            tail_[count] = i;
+        }
+    }
+
+    void PiecePicker::unlink(uint32_t index)
+    {
+        uint32_t count = avail_[index];
+        int32_t p = prev_[index], n = next_[index];
+        if (p == none)
+            head_[count] = n;
+        else
+            next_[p] = n;
+        if (n == none)
+            tail_[count] = p;
+        else
+            prev_[n] = p;
+        prev_[index] = next_[index] = none;
+    }
+
+    void PiecePicker::raise(uint32_t index)
+    {
+        bool listed = status_[index] == Status::Wanted;
+        if (listed)
+            unlink(index);
+        ++avail_[index];
+        if (listed)
+            link(index);
+    }
+
+    void PiecePicker::lower(uint32_t index)
+    {
+        if (avail_[index] == 0)
+            throw std::runtime_error("Piece availability underflow");
+        bool listed = status_[index] == Status::Wanted;
+        if (listed)
+            unlink(index);
+        --avail_[index];
+        if (listed)
+            link(index);
+    }
+
+    // ----------------- Availability -----------------
+
+    void PiecePicker::remove_seed()
+    {
+        if (seeds_ == 0)
+            throw std::runtime_error("No seed to remove");
+        --seeds_;
+    }
+
+    void PiecePicker::add_peer(const Bitfield &bits)
+    {
+        if (bits.size() != avail_.size())
+            throw std::runtime_error("Bitfield sizes differ");
+        bits.for_each_set([this](size_t i)
+                          { raise(static_cast<uint32_t>(i)); });
+    }
+
+    void PiecePicker::remove_peer(const Bitfield &bits)
+    {
+        if (bits.size() != avail_.size())
+            throw std::runtime_error("Bitfield sizes differ");
+        bits.for_each_set([this](size_t i)
+                          { lower(static_cast<uint32_t>(i)); });
+    }
+
+    void PiecePicker::add_have(uint32_t index)
+    {
+        if (index >= avail_.size())
+            throw std::runtime_error("Piece index out of range");
+        raise(index);
+    }
+
+    void PiecePicker::remove_have(uint32_t index)
+    {
+        if (index >= avail_.size())
+            throw std::runtime_error("Piece index out of range");
+        lower(index);
+    }
+
+    // ----------------- Our side -----------------
+
+    void PiecePicker::mark_downloading(uint32_t index)
+    {
+        if (status_[index] != Status::Wanted)
+            return;
+        unlink(index);
+        --listed_;
+        status_[index] = Status::Downloading;
+    }
+
+    void PiecePicker::abort_download(uint32_t index)
+    {
+        if (status_[index] != Status::Downloading)
+            return;
+        status_[index] = Status::Wanted;
+        link(index);
+        ++listed_;
+    }
+
+    void PiecePicker::mark_have(uint32_t index)
+    {
+        if (status_[index] == Status::Have)
+            return;
+        if (status_[index] == Status::Wanted)
+        {
+            unlink(index);
+            --listed_;
+        }
+        status_[index] = Status::Have;
+        have_.set(index);
+    }
+
+    // ----------------- Picking -----------------
+
+    // The walk stops at the first listed piece the peer has. For a seed that
+    // is the head of the lowest non-empty list; for others it is the rarest
+    // piece they can actually give us. A peer with fewer pieces than are
+    // listed is searched directly instead, with ties going to the first
+    // piece after a position that moves with the tie-break state.
+    std::optional<uint32_t> PiecePicker::pick(const Bitfield &peer) const
+    {
+        if (peer.size() != avail_.size())
+            throw std::runtime_error("Bitfield sizes differ");
+
+        bool seed = peer.all();
+        if (!seed && !has_missing(have_, peer))
+            return std::nullopt;
+
+        if (!seed && peer.count() < listed_)
+        {
+            const size_t n = avail_.size();
+            const size_t start = static_cast<size_t>(rng_ % n);
+            int32_t best = none;
+            uint32_t best_avail = 0;
+            size_t best_order = 0;
+            peer.for_each_set([&](size_t i)
+                              {
+                if (status_[i] != Status::Wanted)
+                    return;
+                size_t order = (i + n - start) % n;
+                if (best == none || avail_[i] < best_avail || (avail_[i] == best_avail && order < best_order))
+                {
+                    best = static_cast<int32_t>(i);
+                    best_avail = avail_[i];
+                    best_order = order;
+                } });
+            if (best == none)
+                return std::nullopt;
+            return static_cast<uint32_t>(best);
+        }
+
+        for (size_t count = 0; count < head_.size(); ++count)
+        {
+            for (int32_t i = head_[count]; i != none; i = next_[i])
+            {
+                if (seed || peer.test(static_cast<size_t>(i)))
+                    return static_cast<uint32_t>(i);
+            }
+        }
+        return std::nullopt;
+    }
+
+}
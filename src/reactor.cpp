@@ -0,0 +1,133 @@
+#include "reactor.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace torrent
+{
+    static constexpr int max_events = 256;
+
+    Reactor::Reactor()
+    {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0)
+            throw std::runtime_error(std::string("Failed to create epoll instance: ") + std::strerror(errno));
+    }
+
+    Reactor::~Reactor()
+    {
+        if (epoll_fd_ >= 0)
+            ::close(epoll_fd_);
+    }
+
+    void Reactor::add(int fd, uint32_t events, IoHandler handler)
+    {
+        // The generation tells a stale event for a closed descriptor apart
+        // from one for a new descriptor that reused the number
+        uint32_t generation = ++generation_;
+        epoll_event ev{};
+        ev.events = events | EPOLLET;
+        ev.data.u64 = (uint64_t(generation) << 32) | uint32_t(fd);
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+            throw std::runtime_error(std::string("Failed to watch descriptor: ") + std::strerror(errno));
+
+        handlers_[fd] = Watch{generation, std::make_shared<IoHandler>(std::move(handler))};
+    }
+
+    void Reactor::remove(int fd)
+    {
+        if (handlers_.erase(fd))
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    Reactor::TimerId Reactor::schedule(Clock::duration delay, std::function<void()> fn)
+    {
+        TimerId id = next_timer_++;
+        timers_.push(Timer{Clock::now() + delay, id});
+        timer_fns_.emplace(id, std::move(fn));
+        return id;
+    }
+
+    void Reactor::cancel(TimerId id)
+    {
+        // The heap entry stays behind and is skipped when it comes due
+        timer_fns_.erase(id);
+    }
+
+    void Reactor::post(std::function<void()> fn)
+    {
+        posted_.push_back(std::move(fn));
+    }
+
+    void Reactor::run_timers()
+    {
+        const auto now = Clock::now();
+        while (!timers_.empty() && timers_.top().deadline <= now)
+        {
+            TimerId id = timers_.top().id;
+            timers_.pop();
+            auto it = timer_fns_.find(id);
+            if (it == timer_fns_.end())
+                continue;
+            auto fn = std::move(it->second);
+            timer_fns_.erase(it);
+            fn();
+        }
+    }
+
+    void Reactor::run_posted()
+    {
+        // Callbacks may post more work; that runs in the next round
+        std::vector<std::function<void()>> batch;
+        batch.swap(posted_);
+        for (auto &fn : batch)
+            fn();
+    }
+
+    void Reactor::poll(Clock::duration timeout)
+    {
+        // Drop cancelled timers so they don't cut the wait short
+        while (!timers_.empty() && !timer_fns_.count(timers_.top().id))
+            timers_.pop();
+
+        if (!posted_.empty())
+            timeout = Clock::duration::zero();
+        else if (!timers_.empty())
+            timeout = std::min(timeout, std::max(timers_.top().deadline - Clock::now(), Clock::duration::zero()));
+
+        // Round up so a timer isn't woken for a fraction of a millisecond early
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+        int wait = static_cast<int>(std::min<int64_t>(ms, 1 << 30));
+
+        epoll_event events[max_events];
+        int n = epoll_wait(epoll_fd_, events, max_events, wait);
+        if (n < 0 && errno != EINTR)
+            throw std::runtime_error(std::string("epoll_wait failed: ") + std::strerror(errno));
+
+        for (int i = 0; i < n; ++i)
+        {
+            int fd = static_cast<int>(events[i].data.u64 & 0xffffffffu);
+            uint32_t generation = static_cast<uint32_t>(events[i].data.u64 >> 32);
+            auto it = handlers_.find(fd);
+            if (it == handlers_.end() || it->second.generation != generation)
+                continue; // removed by an earlier handler in this round
+
+            auto handler = it->second.handler;
+            (*handler)(events[i].events);
+        }
+
+        run_timers();
+        run_posted();
+    }
+
+    void Reactor::run()
+    {
+        stopped_ = false;
+        while (!stopped_ && (!handlers_.empty() || !timer_fns_.empty() || !posted_.empty()))
+            poll(std::chrono::hours(1));
+    }
+
+}
@@ -0,0 +1,200 @@
+#include "send_queue.hpp"
+#include "peer_wire.hpp"
+#include "sigpipe_guard.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <optional>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace torrent
+{
+    // Memory chunks gathered into one sendmsg
+    static constexpr size_t max_gather = 64;
+
+    std::string &SendQueue::bytes()
+    {
+        if (chunks_.empty() || chunks_.back().kind != Kind::Bytes || chunks_.back().piece)
+            chunks_.emplace_back();
+        return chunks_.back().bytes;
+    }
+
+    void SendQueue::prepend(std::string_view data)
+    {
+        if (chunks_.empty() || chunks_.front().kind != Kind::Bytes || chunks_.front().piece)
+            chunks_.emplace_front();
+        chunks_.front().bytes.insert(0, data.data(), data.size());
+    }
+
+    SendQueue::Chunk &SendQueue::piece_header(uint32_t index, uint32_t begin, uint32_t length, size_t payload_chunks)
+    {
+        Chunk &header = chunks_.emplace_back();
+        wire::write_piece_header(header.bytes, index, begin, length);
+        header.piece = true;
+        header.index = index;
+        header.begin = begin;
+        header.block_length = length;
+        header.payload_chunks = payload_chunks;
+        ++queued_pieces_;
+        return header;
+    }
+
+    void SendQueue::push_piece(uint32_t index, uint32_t begin, const std::vector<FileRange> &ranges)
+    {
+        size_t length = 0;
+        for (const auto &range : ranges)
+            length += range.length;
+        piece_header(index, begin, static_cast<uint32_t>(length), ranges.size());
+        for (const auto &range : ranges)
+        {
+            Chunk &chunk = chunks_.emplace_back();
+            chunk.kind = Kind::File;
+            chunk.file = range;
+            chunk.length = range.length;
+            chunk.payload = true;
+        }
+    }
+
+    void SendQueue::push_piece(uint32_t index, uint32_t begin, BufferPool::Buffer buffer, size_t length)
+    {
+        piece_header(index, begin, static_cast<uint32_t>(length), 1);
+        Chunk &chunk = chunks_.emplace_back();
+        chunk.kind = Kind::Buffer;
+        chunk.buffer = std::move(buffer);
+        chunk.length = length;
+        chunk.payload = true;
+    }
+
+    bool SendQueue::cancel_piece(uint32_t index, uint32_t begin, uint32_t length)
+    {
+        for (auto it = chunks_.begin(); it != chunks_.end(); ++it)
+        {
+            if (!it->piece || it->sent != 0 || it->index != index || it->begin != begin || it->block_length != length)
+                continue;
+            chunks_.erase(it, it + 1 + static_cast<std::ptrdiff_t>(it->payload_chunks));
+            --queued_pieces_;
+            return true;
+        }
+        return false;
+    }
+
+    size_t SendQueue::cancel_pieces(std::vector<Block> *blocks, const std::vector<uint32_t> *keep)
+    {
+        size_t cancelled = 0;
+        for (auto it = chunks_.begin(); it != chunks_.end();)
+        {
+            if (it->piece && it->sent == 0 &&
+                !(keep && std::find(keep->begin(), keep->end(), it->index) != keep->end()))
+            {
+                if (blocks)
+                    blocks->push_back({it->index, it->begin, it->block_length});
+                it = chunks_.erase(it, it + 1 + static_cast<std::ptrdiff_t>(it->payload_chunks));
+                --queued_pieces_;
+                ++cancelled;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return cancelled;
+    }
+
+    void SendQueue::clear()
+    {
+        chunks_.clear();
+        queued_pieces_ = 0;
+    }
+
+    size_t SendQueue::chunk_size(const Chunk &chunk) const
+    {
+        return chunk.kind == Kind::Bytes ? chunk.bytes.size() : chunk.length;
+    }
+
+    void SendQueue::pop_front()
+    {
+        if (chunks_.front().piece)
+            --queued_pieces_;
+        chunks_.pop_front();
+    }
+
+    SendQueue::Result SendQueue::flush(int fd)
+    {
+        // sendfile() can't take MSG_NOSIGNAL; held from the first file range
+        // on, so a reset peer yields EPIPE instead of killing the process
+        std::optional<SigpipeGuard> sigpipe;
+        while (!chunks_.empty())
+        {
+            Chunk &front = chunks_.front();
+            if (front.kind == Kind::File)
+            {
+                if (!sigpipe)
+                    sigpipe.emplace();
+                off_t offset = static_cast<off_t>(front.file.offset + front.sent);
+                ssize_t n = ::sendfile(fd, front.file.fd, &offset, front.length - front.sent);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return errno == EAGAIN || errno == EWOULDBLOCK ? Result::Blocked : Result::Error;
+                }
+                if (n == 0)
+                {
+                    // The file is shorter than it was when the range was queued
+                    errno = EIO;
+                    return Result::Error;
+                }
+                front.sent += static_cast<size_t>(n);
+                bytes_zero_copy_ += static_cast<uint64_t>(n);
+                if (front.sent == front.length)
+                    pop_front();
+                continue;
+            }
+
+            // Gather the run of in-memory chunks up to the next file range
+            iovec iov[max_gather];
+            size_t count = 0;
+            for (; count < chunks_.size() && count < max_gather; ++count)
+            {
+                Chunk &chunk = chunks_[count];
+                if (chunk.kind == Kind::File)
+                    break;
+                char *base = chunk.kind == Kind::Bytes ? &chunk.bytes[0] : chunk.buffer.get();
+                iov[count] = iovec{base + chunk.sent, chunk_size(chunk) - chunk.sent};
+            }
+            // More is coming right behind, so let the kernel hold a partial
+            // segment for it
+            bool more = count < chunks_.size();
+
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK ? Result::Blocked : Result::Error;
+            }
+
+            for (size_t left = static_cast<size_t>(n); left > 0;)
+            {
+                Chunk &chunk = chunks_.front();
+                size_t take = std::min(left, chunk_size(chunk) - chunk.sent);
+                chunk.sent += take;
+                left -= take;
+                if (chunk.payload)
+                    bytes_copied_ += take;
+                if (chunk.sent == chunk_size(chunk))
+                    pop_front();
+            }
+            // Empty byte chunks can be left behind by bytes()
+            while (!chunks_.empty() && chunks_.front().kind != Kind::File &&
+                   chunks_.front().sent == chunk_size(chunks_.front()))
+                pop_front();
+        }
+        return Result::Done;
+    }
+
+}
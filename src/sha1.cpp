@@ -0,0 +1,391 @@
+#include "sha1.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <openssl/sha.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SHA1_X86 1
+#include <immintrin.h>
+#endif
+
+namespace torrent
+{
+    static const uint32_t initial_state[5] = {0x67452301u, 0xEFCDAB89u, 0x98BADCFEu, 0x10325476u, 0xC3D2E1F0u};
+
+    static inline uint32_t load_be32(const unsigned char *p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return __builtin_bswap32(v);
+    }
+
+    static inline void store_be32(unsigned char *p, uint32_t v)
+    {
+        v = __builtin_bswap32(v);
+        std::memcpy(p, &v, sizeof(v));
+    }
+
+    // Writes the final one or two padded blocks of a message into tail (128
+    // bytes) and returns how many blocks were used
+    static size_t pad_tail(const char *message, size_t length, unsigned char *tail)
+    {
+        size_t full = length / 64 * 64;
+        size_t rem = length - full;
+        size_t blocks = rem + 9 <= 64 ? 1 : 2;
+
+        std::memset(tail, 0, 128);
+        std::memcpy(tail, message + full, rem);
+        tail[rem] = 0x80;
+        uint64_t bits = static_cast<uint64_t>(length) * 8;
+        for (int i = 0; i < 8; ++i)
+            tail[blocks * 64 - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+        return blocks;
+    }
+
+    // ----------------- OpenSSL -----------------
+    static void hash_openssl(const char *const *data, size_t count, size_t length, unsigned char *out)
+    {
+        for (size_t i = 0; i < count; ++i)
+            SHA1(reinterpret_cast<const unsigned char *>(data[i]), length, out + i * sha1_digest_size);
+    }
+
+#ifdef SHA1_X86
+    // ----------------- SHA-NI -----------------
+    // One group of four rounds. Message words rotate through msg[0..3] and the
+    // E accumulators alternate between e[0] and e[1].
+    template <int I>
+    __attribute__((target("sha,sse4.1"), always_inline)) static inline void shani_group(__m128i &abcd, __m128i *e, __m128i *msg)
+    {
+        __m128i &cur = e[I % 2];
+        __m128i &nxt = e[(I + 1) % 2];
+
+        if constexpr (I == 0)
+            cur = _mm_add_epi32(cur, msg[0]);
+        else
+            cur = _mm_sha1nexte_epu32(cur, msg[I % 4]);
+        nxt = abcd;
+        if constexpr (I >= 3 && I <= 18)
+            msg[(I + 1) % 4] = _mm_sha1msg2_epu32(msg[(I + 1) % 4], msg[I % 4]);
+        abcd = _mm_sha1rnds4_epu32(abcd, cur, I / 5);
+        if constexpr (I >= 1 && I <= 16)
+            msg[(I + 3) % 4] = _mm_sha1msg1_epu32(msg[(I + 3) % 4], msg[I % 4]);
+        if constexpr (I >= 2 && I <= 17)
+            msg[(I + 2) % 4] = _mm_xor_si128(msg[(I + 2) % 4], msg[I % 4]);
+    }
+
+    // The first four groups also bring in the message block
+    template <int I>
+    __attribute__((target("sha,sse4.1"), always_inline)) static inline void shani_step(__m128i &abcd, __m128i *e, __m128i *msg,
+                                                                                       const unsigned char *block)
+    {
+        if constexpr (I < 4)
+        {
+            const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+            msg[I] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * I)), mask);
+        }
+        shani_group<I>(abcd, e, msg);
+    }
+
+    template <int... I>
+    __attribute__((target("sha,sse4.1"), always_inline)) static inline void shani_rounds(__m128i &abcd, __m128i *e, __m128i *msg,
+                                                                                         const unsigned char *block, std::integer_sequence<int, I...>)
+    {
+        (shani_step<I>(abcd, e, msg, block), ...);
+    }
+
+    __attribute__((target("sha,sse4.1"))) static void shani_compress(uint32_t state[5], const unsigned char *blocks, size_t count)
+    {
+        __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1B);
+        __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+
+        for (size_t b = 0; b < count; ++b)
+        {
+            __m128i abcd_save = abcd;
+            __m128i e_save = e0;
+            __m128i e[2] = {e0, _mm_setzero_si128()};
+            __m128i msg[4];
+
+            shani_rounds(abcd, e, msg, blocks + 64 * b, std::make_integer_sequence<int, 20>{});
+
+            // Group 19 leaves the next E in e[0]
+            e0 = _mm_sha1nexte_epu32(e[0], e_save);
+            abcd = _mm_add_epi32(abcd, abcd_save);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_shuffle_epi32(abcd, 0x1B));
+        state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+    }
+
+    static void hash_shani(const char *const *data, size_t count, size_t length, unsigned char *out)
+    {
+        unsigned char tail[128];
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint32_t state[5];
+            std::memcpy(state, initial_state, sizeof(state));
+            shani_compress(state, reinterpret_cast<const unsigned char *>(data[i]), length / 64);
+            shani_compress(state, tail, pad_tail(data[i], length, tail));
+            for (int w = 0; w < 5; ++w)
+                store_be32(out + i * sha1_digest_size + 4 * w, state[w]);
+        }
+    }
+
+    // ----------------- Multi-buffer -----------------
+    // Each SIMD lane carries the state of a different message. Written with
+    // GCC vector extensions and force-inlined into the per-ISA entry points
+    // below, so the same code compiles to AVX2 or AVX-512.
+    typedef uint32_t lanes8 __attribute__((vector_size(32)));
+    typedef uint32_t lanes16 __attribute__((vector_size(64)));
+
+#define SHA1_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define SHA1_ROUND(f, k)                                              \
+    do                                                                \
+    {                                                                 \
+        if (t >= 16)                                                  \
+            w[t & 15] = SHA1_ROTL(w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ \
+                                      w[(t - 14) & 15] ^ w[t & 15],   \
+                                  1);                                 \
+        V tmp = SHA1_ROTL(a, 5) + (f) + e + (k) + w[t & 15];          \
+        e = d;                                                        \
+        d = c;                                                        \
+        c = SHA1_ROTL(b, 30);                                         \
+        b = a;                                                        \
+        a = tmp;                                                      \
+    } while (0)
+
+    template <typename V, size_t Lanes>
+    __attribute__((always_inline)) static inline void mb_compress(V *state, const unsigned char *const *blocks)
+    {
+        // Transpose the big-endian message words into lane order
+        alignas(64) uint32_t words[16][Lanes];
+        for (size_t lane = 0; lane < Lanes; ++lane)
+            for (int t = 0; t < 16; ++t)
+                words[t][lane] = load_be32(blocks[lane] + 4 * t);
+
+        V w[16];
+        std::memcpy(w, words, sizeof(w));
+
+        V a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        int t = 0;
+        for (; t < 20; ++t)
+            SHA1_ROUND(d ^ (b & (c ^ d)), 0x5A827999u);
+        for (; t < 40; ++t)
+            SHA1_ROUND(b ^ c ^ d, 0x6ED9EBA1u);
+        for (; t < 60; ++t)
+            SHA1_ROUND((b & c) | (d & (b | c)), 0x8F1BBCDCu);
+        for (; t < 80; ++t)
+            SHA1_ROUND(b ^ c ^ d, 0xCA62C1D6u);
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+
+#undef SHA1_ROUND
+#undef SHA1_ROTL
+
+    // Hashes exactly Lanes messages of the same length
+    template <typename V, size_t Lanes>
+    __attribute__((always_inline)) static inline void mb_hash(const char *const *data, size_t length, unsigned char *out)
+    {
+        V state[5];
+        for (int i = 0; i < 5; ++i)
+            state[i] = V{} + initial_state[i];
+
+        const unsigned char *blocks[Lanes];
+        for (size_t offset = 0; offset + 64 <= length; offset += 64)
+        {
+            for (size_t lane = 0; lane < Lanes; ++lane)
+                blocks[lane] = reinterpret_cast<const unsigned char *>(data[lane]) + offset;
+            mb_compress<V, Lanes>(state, blocks);
+        }
+
+        alignas(64) unsigned char tail[Lanes][128];
+        size_t tail_blocks = 0;
+        for (size_t lane = 0; lane < Lanes; ++lane)
+            tail_blocks = pad_tail(data[lane], length, tail[lane]);
+        for (size_t tb = 0; tb < tail_blocks; ++tb)
+        {
+            for (size_t lane = 0; lane < Lanes; ++lane)
+                blocks[lane] = tail[lane] + 64 * tb;
+            mb_compress<V, Lanes>(state, blocks);
+        }
+
+        alignas(64) uint32_t words[5][Lanes];
+        std::memcpy(words, state, sizeof(words));
+        for (size_t lane = 0; lane < Lanes; ++lane)
+            for (int i = 0; i < 5; ++i)
+                store_be32(out + lane * sha1_digest_size + 4 * i, words[i][lane]);
+    }
+
+    __attribute__((target("avx2"))) static void hash_x8(const char *const *data, size_t length, unsigned char *out)
+    {
+        mb_hash<lanes8, 8>(data, length, out);
+    }
+
+    __attribute__((target("avx512f"))) static void hash_x16(const char *const *data, size_t length, unsigned char *out)
+    {
+        mb_hash<lanes16, 16>(data, length, out);
+    }
+#endif
+
+    // Feeds a lane kernel full groups; a short final group is padded by
+    // repeating its last buffer and only the real digests are kept
+    template <size_t Lanes>
+    static void hash_grouped(void (*kernel)(const char *const *, size_t, unsigned char *),
+                             const char *const *data, size_t count, size_t length, unsigned char *out)
+    {
+        size_t i = 0;
+        for (; i + Lanes <= count; i += Lanes)
+            kernel(data + i, length, out + i * sha1_digest_size);
+        if (i == count)
+            return;
+
+        const char *group[Lanes];
+        unsigned char digests[Lanes * sha1_digest_size];
+        for (size_t lane = 0; lane < Lanes; ++lane)
+            group[lane] = data[std::min(i + lane, count - 1)];
+        kernel(group, length, digests);
+        std::memcpy(out + i * sha1_digest_size, digests, (count - i) * sha1_digest_size);
+    }
+
+    // ----------------- Dispatch -----------------
+    bool sha1_backend_supported(Sha1Backend backend)
+    {
+        switch (backend)
+        {
+        case Sha1Backend::OpenSSL:
+            return true;
+#ifdef SHA1_X86
+        case Sha1Backend::ShaNi:
+            return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+        case Sha1Backend::Avx2:
+            return __builtin_cpu_supports("avx2");
+        case Sha1Backend::Avx512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+        }
+    }
+
+    const char *sha1_backend_name(Sha1Backend backend)
+    {
+        switch (backend)
+        {
+        case Sha1Backend::OpenSSL:
+            return "openssl";
+        case Sha1Backend::ShaNi:
+            return "sha-ni";
+        case Sha1Backend::Avx2:
+            return "avx2-x8";
+        case Sha1Backend::Avx512:
+            return "avx512-x16";
+        }
+        return "unknown";
+    }
+
+    size_t sha1_lanes(Sha1Backend backend)
+    {
+        switch (backend)
+        {
+        case Sha1Backend::Avx2:
+            return 8;
+        case Sha1Backend::Avx512:
+            return 16;
+        default:
+            return 1;
+        }
+    }
+
+    // Times every supported backend on a small batch of piece-sized buffers
+    // and keeps the fastest. Which one wins depends on the microarchitecture
+    // (SHA-NI vs. AVX-512 clocks), so this is measured rather than assumed.
+    static Sha1Backend select_backend()
+    {
+        constexpr size_t sample_length = 16384;
+        constexpr size_t sample_count = 16;
+
+        std::vector<char> sample(sample_length * sample_count, 'x');
+        const char *ptrs[sample_count];
+        for (size_t i = 0; i < sample_count; ++i)
+            ptrs[i] = sample.data() + i * sample_length;
+        unsigned char digests[sample_count * sha1_digest_size];
+
+        Sha1Backend best = Sha1Backend::OpenSSL;
+        auto best_time = std::chrono::steady_clock::duration::max();
+        for (Sha1Backend backend : {Sha1Backend::OpenSSL, Sha1Backend::ShaNi, Sha1Backend::Avx2, Sha1Backend::Avx512})
+        {
+            if (!sha1_backend_supported(backend))
+                continue;
+
+            // Best of a few runs to keep a stray interrupt from deciding
+            auto fastest = std::chrono::steady_clock::duration::max();
+            for (int run = 0; run < 3; ++run)
+            {
+                auto start = std::chrono::steady_clock::now();
+                sha1_many(backend, ptrs, sample_count, sample_length, digests);
+                fastest = std::min(fastest, std::chrono::steady_clock::now() - start);
+            }
+            if (fastest < best_time)
+            {
+                best = backend;
+                best_time = fastest;
+            }
+        }
+        return best;
+    }
+
+    Sha1Backend sha1_backend()
+    {
+        static const Sha1Backend backend = select_backend();
+        return backend;
+    }
+
+    void sha1_many(Sha1Backend backend, const char *const *data, size_t count, size_t length, unsigned char *out)
+    {
+        if (!sha1_backend_supported(backend))
+            throw std::runtime_error(std::string("SHA-1 backend not supported: ") + sha1_backend_name(backend));
+
+        switch (backend)
+        {
+#ifdef SHA1_X86
+        case Sha1Backend::ShaNi:
+            hash_shani(data, count, length, out);
+            return;
+        case Sha1Backend::Avx2:
+            hash_grouped<8>(hash_x8, data, count, length, out);
+            return;
+        case Sha1Backend::Avx512:
+            hash_grouped<16>(hash_x16, data, count, length, out);
+            return;
+#endif
+        default:
+            hash_openssl(data, count, length, out);
+            return;
+        }
+    }
+
+    void sha1_many(const char *const *data, size_t count, size_t length, unsigned char *out)
+    {
+        sha1_many(sha1_backend(), data, count, length, out);
+    }
+
+    void sha1_digest(const void *data, size_t length, unsigned char *out)
+    {
+        const char *ptr = static_cast<const char *>(data);
+        // Lane backends would waste all but one lane on a single buffer
+        Sha1Backend backend = sha1_backend();
+        if (sha1_lanes(backend) > 1)
+            backend = Sha1Backend::OpenSSL;
+        sha1_many(backend, &ptr, 1, length, out);
+    }
+
+}
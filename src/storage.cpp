@@ -0,0 +1,429 @@
+#include "storage.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace torrent
+{
+#ifdef IOV_MAX
+    static constexpr size_t max_iov = IOV_MAX;
+#else
+    static constexpr size_t max_iov = 1024;
+#endif
+
+    Storage::Storage(const TorrentMetadata &metadata, std::string save_path, StorageConfig config)
+        : layout_(metadata, save_path), config_(config), fds_(layout_.files().size(), -1)
+    {
+        if (config_.cache_bytes == 0)
+            throw std::runtime_error("Storage cache must not be empty");
+        create_files();
+        writer_ = std::thread([this]
+                              { writer_loop(); });
+    }
+
+    Storage::~Storage()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            schedule_flush();
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        writer_.join();
+        for (int fd : fds_)
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+    }
+
+    // ----------------- Files -----------------
+
+    // Creates every file, empty ones included. Preallocating reserves each
+    // file's size too, so writes land in allocated extents instead of
+    // growing the file piece by piece.
+    void Storage::create_files()
+    {
+        const auto &files = layout_.files();
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            if (files[i].pad)
+                continue;
+            int fd = file_descriptor(i, true);
+            if (fd < 0)
+                throw std::runtime_error("Failed to open " + files[i].path + ": " + std::strerror(errno));
+
+            struct stat st{};
+            if (!config_.preallocate || files[i].length == 0 ||
+                (fstat(fd, &st) == 0 && uint64_t(st.st_size) >= files[i].length))
+                continue;
+            if (::fallocate(fd, 0, 0, static_cast<off_t>(files[i].length)) != 0)
+            {
+                // Some filesystems can't reserve space; a sparse file is the
+                // next best thing
+                if ((errno != EOPNOTSUPP && errno != ENOSYS) ||
+                    ::ftruncate(fd, static_cast<off_t>(files[i].length)) != 0)
+                    throw std::runtime_error("Failed to preallocate " + files[i].path + ": " + std::strerror(errno));
+            }
+        }
+    }
+
+    int Storage::file_descriptor(size_t file, bool create)
+    {
+        std::lock_guard<std::mutex> lock(fd_mutex_);
+        if (fds_[file] >= 0)
+            return fds_[file];
+
+        const std::string &path = layout_.files()[file].path;
+        if (create)
+        {
+            std::error_code ec;
+            fs::create_directories(fs::path(path).parent_path(), ec);
+            fds_[file] = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        }
+        else
+        {
+            fds_[file] = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        }
+        return fds_[file];
+    }
+
+    // ----------------- Cache -----------------
+
+    bool Storage::begin_piece(uint32_t piece)
+    {
+        check_error();
+        if (piece >= layout_.num_pieces())
+            throw std::runtime_error("Piece index out of range");
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cache_.count(piece))
+            return cache_[piece].state == PieceState::Downloading;
+
+        uint32_t size = layout_.piece_size(piece);
+        // A piece bigger than the whole cache still gets in when nothing else is
+        if (cached_bytes_ > 0 && cached_bytes_ + size > config_.cache_bytes)
+        {
+            if (dirty_bytes_ > 0)
+                schedule_flush();
+            return false;
+        }
+
+        cache_[piece] = CachedPiece{std::unique_ptr<char[]>(new char[size]), size, PieceState::Downloading};
+        cached_bytes_ += size;
+        return true;
+    }
+
+    void Storage::write_block(uint32_t piece, uint32_t begin, std::string_view data)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = cache_.find(piece);
+        if (it == cache_.end() || it->second.state != PieceState::Downloading)
+            throw std::runtime_error("Block for a piece that isn't being downloaded");
+        if (begin > it->second.size || data.size() > it->second.size - begin)
+            throw std::runtime_error("Block past the end of its piece");
+        std::memcpy(it->second.data.get() + begin, data.data(), data.size());
+    }
+
+    std::string_view Storage::piece_data(uint32_t piece) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = cache_.find(piece);
+        if (it == cache_.end())
+            throw std::runtime_error("Piece isn't cached");
+        return std::string_view(it->second.data.get(), it->second.size);
+    }
+
+    void Storage::commit_piece(uint32_t piece)
+    {
+        check_error();
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = cache_.find(piece);
+        if (it == cache_.end() || it->second.state != PieceState::Downloading)
+            throw std::runtime_error("Piece isn't being downloaded");
+        it->second.state = PieceState::Dirty;
+        dirty_bytes_ += it->second.size;
+        if (dirty_bytes_ >= config_.flush_bytes)
+            schedule_flush();
+    }
+
+    void Storage::discard_piece(uint32_t piece)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = cache_.find(piece);
+        if (it == cache_.end() || it->second.state != PieceState::Downloading)
+            return;
+        cached_bytes_ -= it->second.size;
+        cache_.erase(it);
+    }
+
+    size_t Storage::cached_bytes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cached_bytes_;
+    }
+
+    size_t Storage::dirty_bytes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dirty_bytes_;
+    }
+
+    // ----------------- Reading -----------------
+
+    size_t Storage::read(uint32_t piece, uint32_t begin, char *out, size_t length)
+    {
+        uint32_t size = piece < layout_.num_pieces() ? layout_.piece_size(piece) : 0;
+        if (begin >= size)
+            return 0;
+        length = std::min<size_t>(length, size - begin);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = cache_.find(piece);
+            if (it != cache_.end() && it->second.state != PieceState::Downloading)
+            {
+                std::memcpy(out, it->second.data.get() + begin, length);
+                return length;
+            }
+        }
+
+        size_t done = 0;
+        bool short_read = false;
+        layout_.for_each_span(layout_.piece_offset(piece) + begin, length, [&](size_t file, uint64_t offset, uint64_t span)
+                              {
+            if (short_read)
+                return;
+            if (layout_.files()[file].pad)
+            {
+                std::memset(out + done, 0, span);
+                done += span;
+                return;
+            }
+            int fd = file_descriptor(file, false);
+            size_t got = 0;
+            while (fd >= 0 && got < span)
+            {
+                ssize_t n = ::pread(fd, out + done + got, span - got, static_cast<off_t>(offset + got));
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+                got += static_cast<size_t>(n);
+            }
+            done += got;
+            short_read = got < span; });
+        return done;
+    }
+
+    bool Storage::locate(uint32_t piece, uint32_t begin, size_t length, std::vector<FileRange> &out)
+    {
+        out.clear();
+        uint32_t size = piece < layout_.num_pieces() ? layout_.piece_size(piece) : 0;
+        if (length == 0 || begin > size || length > size - begin)
+            return false;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (cache_.count(piece))
+                return false;
+        }
+
+        bool ok = true;
+        layout_.for_each_span(layout_.piece_offset(piece) + begin, length, [&](size_t file, uint64_t offset, uint64_t span)
+                              {
+            if (!ok)
+                return;
+            int fd = layout_.files()[file].pad ? -1 : file_descriptor(file, false);
+            if (fd < 0)
+                ok = false;
+            else
+                out.push_back(FileRange{fd, offset, static_cast<size_t>(span)}); });
+        if (!ok)
+            out.clear();
+        return ok;
+    }
+
+    // ----------------- Writing -----------------
+
+    // Called with mutex_ held: hands every dirty piece to the writer
+    void Storage::schedule_flush()
+    {
+        bool any = false;
+        for (auto &[index, piece] : cache_)
+        {
+            if (piece.state != PieceState::Dirty)
+                continue;
+            piece.state = PieceState::Writing;
+            queued_.push_back(index);
+            any = true;
+        }
+        dirty_bytes_ = 0;
+        if (any)
+            cv_.notify_all();
+    }
+
+    void Storage::flush()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            schedule_flush();
+            cv_.wait(lock, [this]
+                     { return queued_.empty() && !writing_; });
+        }
+        check_error();
+    }
+
+    void Storage::sync()
+    {
+        flush();
+        std::lock_guard<std::mutex> lock(fd_mutex_);
+        for (size_t i = 0; i < fds_.size(); ++i)
+        {
+            if (fds_[i] >= 0 && ::fdatasync(fds_[i]) != 0)
+                throw std::runtime_error("Failed to sync " + layout_.files()[i].path + ": " + std::strerror(errno));
+        }
+    }
+
+    void Storage::writer_loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            cv_.wait(lock, [this]
+                     { return stopping_ || !queued_.empty(); });
+            if (queued_.empty())
+                return;
+
+            std::vector<uint32_t> batch;
+            batch.swap(queued_);
+            std::sort(batch.begin(), batch.end());
+            writing_ = true;
+
+            // Buffers in the Writing state are left alone by everyone else,
+            // so they can be read without the lock
+            std::vector<std::pair<const char *, size_t>> chunks;
+            chunks.reserve(batch.size());
+            for (uint32_t index : batch)
+            {
+                const CachedPiece &piece = cache_.at(index);
+                chunks.emplace_back(piece.data.get(), piece.size);
+            }
+            lock.unlock();
+
+            // Adjacent pieces form one run, and each run is one contiguous
+            // stretch of the byte stream
+            std::string error;
+            for (size_t start = 0; start < batch.size();)
+            {
+                size_t end = start + 1;
+                while (end < batch.size() && batch[end] == batch[end - 1] + 1)
+                    ++end;
+                try
+                {
+                    write_run(layout_.piece_offset(batch[start]),
+                              std::vector<std::pair<const char *, size_t>>(chunks.begin() + start, chunks.begin() + end));
+                }
+                catch (const std::exception &e)
+                {
+                    if (error.empty())
+                        error = e.what();
+                }
+                start = end;
+            }
+
+            lock.lock();
+            for (uint32_t index : batch)
+            {
+                auto it = cache_.find(index);
+                cached_bytes_ -= it->second.size;
+                cache_.erase(it);
+            }
+            if (!error.empty() && error_.empty())
+                error_ = error;
+            writing_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    // Writes a run of piece buffers that sit back to back in the stream:
+    // one pwritev per file the run touches, skipping pad files
+    void Storage::write_run(uint64_t offset, const std::vector<std::pair<const char *, size_t>> &chunks)
+    {
+        uint64_t total = 0;
+        for (const auto &chunk : chunks)
+            total += chunk.second;
+
+        size_t chunk = 0;
+        size_t chunk_pos = 0;
+        layout_.for_each_span(offset, total, [&](size_t file, uint64_t file_offset, uint64_t span)
+                              {
+            // Gather this span's bytes out of the piece buffers
+            std::vector<iovec> iov;
+            for (uint64_t left = span; left > 0;)
+            {
+                size_t take = static_cast<size_t>(std::min<uint64_t>(left, chunks[chunk].second - chunk_pos));
+                iov.push_back(iovec{const_cast<char *>(chunks[chunk].first + chunk_pos), take});
+                chunk_pos += take;
+                left -= take;
+                if (chunk_pos == chunks[chunk].second)
+                {
+                    ++chunk;
+                    chunk_pos = 0;
+                }
+            }
+            if (layout_.files()[file].pad)
+                return;
+
+            int fd = file_descriptor(file, true);
+            if (fd < 0)
+                throw std::runtime_error("Failed to open " + layout_.files()[file].path + ": " + std::strerror(errno));
+
+            size_t first = 0;
+            off_t pos = static_cast<off_t>(file_offset);
+            while (first < iov.size())
+            {
+                int count = static_cast<int>(std::min(iov.size() - first, max_iov));
+                ssize_t n = ::pwritev(fd, iov.data() + first, count, pos);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                {
+                    throw std::runtime_error("Failed to write " + layout_.files()[file].path + ": " + std::strerror(errno));
+                }
+                pos += n;
+                // Skip what was written, trimming a partly written vector
+                for (size_t left = static_cast<size_t>(n); left > 0;)
+                {
+                    if (left >= iov[first].iov_len)
+                    {
+                        left -= iov[first].iov_len;
+                        ++first;
+                    }
+                    else
+                    {
+                        iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + left;
+                        iov[first].iov_len -= left;
+                        left = 0;
+                    }
+                }
+            } });
+    }
+
+    void Storage::check_error()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_.empty())
+            throw std::runtime_error(error_);
+    }
+
+}
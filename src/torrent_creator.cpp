@@ -1,11 +1,15 @@
 #include "torrent_creator.hpp"
 #include "bencode.hpp"
+#include "piece_hasher.hpp"
+#include "hash_cache.hpp"
+#include "sha1.hpp"
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <openssl/sha.h>
 #include <iomanip>
 #include <filesystem>
+#include <algorithm>
 
 namespace fs = std::filesystem;
 
@@ -21,75 +25,249 @@ namespace torrent
     }
 
     std::string sha1_hash(const std::vector<char> &data)
+    {
+        return sha1_hash(data.data(), data.size());
+    }
+
+    std::string sha1_hash(const char *data, size_t size)
     {
         unsigned char hash[SHA_DIGEST_LENGTH];
-        SHA1(reinterpret_cast<const unsigned char *>(data.data()), data.size(), hash);
+        sha1_digest(data, size, hash);
         return std::string(reinterpret_cast<char *>(hash), SHA_DIGEST_LENGTH);
     }
 
-    std::string create_torrent(const std::string &input_file, const std::string &announce_url, int piece_length)
+    // The leaf of a v2 file tree: {"": {"length": n, "pieces root": root}}
+    static std::shared_ptr<bencode::Bencode> file_tree_leaf(int64_t length, std::string pieces_root)
+    {
+        using namespace bencode;
+
+        std::map<std::string, std::shared_ptr<Bencode>> attributes;
+        attributes["length"] = std::make_shared<Bencode>(Bencode{length});
+        if (!pieces_root.empty())
+            attributes["pieces root"] = std::make_shared<Bencode>(Bencode{std::move(pieces_root)});
+
+        std::map<std::string, std::shared_ptr<Bencode>> leaf;
+        leaf[""] = std::make_shared<Bencode>(Bencode{std::move(attributes)});
+        return std::make_shared<Bencode>(Bencode{std::move(leaf)});
+    }
+
+    // Takes the file by value so the pieces string can be moved into the tree
+    static std::map<std::string, std::shared_ptr<bencode::Bencode>> build_torrent_dict(TorrentFile file)
     {
         using namespace bencode;
+        using Dict = std::map<std::string, std::shared_ptr<Bencode>>;
 
-        // Read file content
-        std::vector<char> content = read_file(input_file);
-        std::string filename = fs::path(input_file).filename().string();
+        const bool v1 = file.version != TorrentVersion::V2;
+        const bool v2 = file.version != TorrentVersion::V1;
+
+        Dict info_dict;
+        info_dict["piece length"] = std::make_shared<Bencode>(Bencode{file.piece_length});
 
-        // Split file into pieces and hash
-        std::string pieces_concat;
-        for (size_t i = 0; i < content.size(); i += piece_length)
+        if (v2)
         {
-            size_t len = std::min(piece_length, static_cast<int>(content.size() - i));
-            std::vector<char> piece(content.begin() + i, content.begin() + i + len);
-            pieces_concat += sha1_hash(piece); // binary concat
+            // Directories become nested dictionaries, pad files don't exist in v2
+            Dict tree;
+            if (file.files.empty())
+            {
+                tree[file.file_name] = file_tree_leaf(file.file_length, std::move(file.pieces_root));
+            }
+            for (auto &entry : file.files)
+            {
+                if (entry.pad)
+                    continue;
+                Dict *dir = &tree;
+                for (size_t i = 0; i + 1 < entry.path.size(); ++i)
+                {
+                    auto &child = (*dir)[entry.path[i]];
+                    if (!child)
+                        child = std::make_shared<Bencode>(Bencode{Dict{}});
+                    dir = &std::get<Dict>(child->value);
+                }
+                (*dir)[entry.path.back()] = file_tree_leaf(entry.length, std::move(entry.pieces_root));
+            }
+            info_dict["file tree"] = std::make_shared<Bencode>(Bencode{std::move(tree)});
+            info_dict["meta version"] = std::make_shared<Bencode>(Bencode{int64_t(2)});
         }
 
-        // Build info dictionary
-        std::map<std::string, std::shared_ptr<Bencode>> info_dict;
-        info_dict["name"] = std::make_shared<Bencode>(Bencode{filename});
-        info_dict["length"] = std::make_shared<Bencode>(Bencode{static_cast<int64_t>(content.size())});
-        info_dict["piece length"] = std::make_shared<Bencode>(Bencode{static_cast<int64_t>(piece_length)});
-        info_dict["pieces"] = std::make_shared<Bencode>(Bencode{pieces_concat});
+        info_dict["name"] = std::make_shared<Bencode>(Bencode{std::move(file.file_name)});
 
-        // Build top-level dictionary
-        std::map<std::string, std::shared_ptr<Bencode>> torrent_dict;
-        torrent_dict["announce"] = std::make_shared<Bencode>(Bencode{announce_url});
-        torrent_dict["info"] = std::make_shared<Bencode>(Bencode{info_dict});
+        if (v1)
+        {
+            info_dict["pieces"] = std::make_shared<Bencode>(Bencode{std::move(file.piece_hashes)});
+            if (file.files.empty())
+            {
+                info_dict["length"] = std::make_shared<Bencode>(Bencode{file.file_length});
+            }
+            else
+            {
+                std::vector<std::shared_ptr<Bencode>> files;
+                files.reserve(file.files.size());
+                for (auto &entry : file.files)
+                {
+                    std::vector<std::shared_ptr<Bencode>> path;
+                    for (auto &part : entry.path)
+                        path.push_back(std::make_shared<Bencode>(Bencode{std::move(part)}));
+
+                    Dict file_dict;
+                    if (entry.pad)
+                        file_dict["attr"] = std::make_shared<Bencode>(Bencode{std::string("p")});
+                    file_dict["length"] = std::make_shared<Bencode>(Bencode{entry.length});
+                    file_dict["path"] = std::make_shared<Bencode>(Bencode{std::move(path)});
+                    files.push_back(std::make_shared<Bencode>(Bencode{std::move(file_dict)}));
+                }
+                info_dict["files"] = std::make_shared<Bencode>(Bencode{std::move(files)});
+            }
+        }
+
+        Dict torrent_dict;
+        torrent_dict["announce"] = std::make_shared<Bencode>(Bencode{std::move(file.announce)});
+        torrent_dict["info"] = std::make_shared<Bencode>(Bencode{std::move(info_dict)});
+        if (v2)
+        {
+            Dict layers;
+            for (auto &[root, layer] : file.piece_layers)
+                layers.emplace(root, std::make_shared<Bencode>(Bencode{std::move(layer)}));
+            torrent_dict["piece layers"] = std::make_shared<Bencode>(Bencode{std::move(layers)});
+        }
+
+        return torrent_dict;
+    }
+
+    std::vector<FileEntry> list_directory_files(const std::string &directory)
+    {
+        std::vector<FileEntry> files;
+        for (const auto &entry : fs::recursive_directory_iterator(directory))
+        {
+            if (!entry.is_regular_file())
+                continue;
+
+            FileEntry file;
+            for (const auto &part : fs::relative(entry.path(), directory))
+                file.path.push_back(part.string());
+            file.length = static_cast<int64_t>(entry.file_size());
+            files.push_back(std::move(file));
+        }
+
+        std::sort(files.begin(), files.end(), [](const FileEntry &a, const FileEntry &b)
+                  { return a.path < b.path; });
+        return files;
+    }
 
-        // Encode and return the bencoded string
-        return encode(torrent_dict);
+    // Full paths of a directory listing, in the same order
+    static std::vector<std::string> entry_paths(const fs::path &root, const std::vector<FileEntry> &files)
+    {
+        std::vector<std::string> paths;
+        paths.reserve(files.size());
+        for (const auto &entry : files)
+        {
+            fs::path path = root;
+            for (const auto &part : entry.path)
+                path /= part;
+            paths.push_back(path.string());
+        }
+        return paths;
     }
 
-    std::string compute_piece_hashes(const std::string &file_path, int64_t piece_length)
+    // Hashes every file of a v2 or hybrid torrent on its own, since v2 trees
+    // are per file. Hybrid torrents align each file to a piece boundary with a
+    // BEP 47 pad file so both formats describe the same pieces.
+    static void hash_v2(TorrentFile &file, const fs::path &input, unsigned workers)
     {
-        std::vector<char> content = read_file(file_path);
-        std::string pieces_concat;
+        const bool hybrid = file.version == TorrentVersion::Hybrid;
+        const int64_t piece = file.piece_length;
 
-        for (size_t i = 0; i < content.size(); i += piece_length)
+        if (file.files.empty())
         {
-            size_t len = std::min(piece_length, static_cast<int64_t>(content.size() - i));
-            std::vector<char> piece(content.begin() + i, content.begin() + i + len);
-            pieces_concat += sha1_hash(piece); // binary concatenation of SHA1 hashes
+            FileHashes hashes = hash_file_v2(input.string(), piece, hybrid, false, workers);
+            file.file_length = static_cast<int64_t>(fs::file_size(input));
+            file.piece_hashes = std::move(hashes.pieces);
+            file.pieces_root = hashes.pieces_root;
+            if (!hashes.piece_layer.empty())
+                file.piece_layers[hashes.pieces_root] = std::move(hashes.piece_layer);
+            return;
         }
 
-        return pieces_concat;
+        std::vector<std::string> paths = entry_paths(input, file.files);
+        std::vector<FileEntry> files;
+        file.file_length = 0;
+        for (size_t i = 0; i < file.files.size(); ++i)
+        {
+            FileEntry &entry = file.files[i];
+            int64_t pad = (piece - entry.length % piece) % piece;
+            bool padded = hybrid && pad > 0 && i + 1 < file.files.size();
+
+            FileHashes hashes = hash_file_v2(paths[i], piece, hybrid, padded, workers);
+            file.piece_hashes += hashes.pieces;
+            entry.pieces_root = hashes.pieces_root;
+            if (!hashes.piece_layer.empty())
+                file.piece_layers[hashes.pieces_root] = std::move(hashes.piece_layer);
+            file.file_length += entry.length;
+            files.push_back(std::move(entry));
+
+            if (padded)
+            {
+                files.push_back(FileEntry{{".pad", std::to_string(pad)}, pad, {}, true});
+                file.file_length += pad;
+            }
+        }
+        file.files = std::move(files);
     }
 
-    std::map<std::string, std::shared_ptr<bencode::Bencode>> create_torrent_dict(const TorrentFile &file)
+    std::string create_torrent(const std::string &input_file, const std::string &announce_url, int piece_length,
+                               unsigned workers, TorrentVersion version)
     {
-        using namespace bencode;
+        fs::path input = fs::path(input_file).lexically_normal();
+        if (!input.has_filename())
+            input = input.parent_path();
 
-        std::map<std::string, std::shared_ptr<Bencode>> info_dict;
-        info_dict["name"] = std::make_shared<Bencode>(Bencode{file.file_name});
-        info_dict["length"] = std::make_shared<Bencode>(Bencode{file.file_length});
-        info_dict["piece length"] = std::make_shared<Bencode>(Bencode{file.piece_length});
-        info_dict["pieces"] = std::make_shared<Bencode>(Bencode{file.piece_hashes});
+        TorrentFile file;
+        file.announce = announce_url;
+        file.file_name = input.filename().string();
+        file.piece_length = piece_length;
+        file.version = version;
 
-        std::map<std::string, std::shared_ptr<Bencode>> torrent_dict;
-        torrent_dict["announce"] = std::make_shared<Bencode>(Bencode{file.announce});
-        torrent_dict["info"] = std::make_shared<Bencode>(Bencode{info_dict});
+        if (fs::is_directory(input))
+        {
+            file.files = list_directory_files(input.string());
+            if (file.files.empty())
+                throw std::runtime_error("No files to add in directory: " + input.string());
+        }
 
-        return torrent_dict;
+        if (version != TorrentVersion::V1)
+        {
+            hash_v2(file, input, workers);
+        }
+        else if (!file.files.empty())
+        {
+            // Stream every file as one continuous run of pieces
+            std::vector<std::string> paths = entry_paths(input, file.files);
+            file.file_length = 0;
+            for (const auto &entry : file.files)
+                file.file_length += entry.length;
+            file.piece_hashes = hash_files_pieces(paths, file.file_length, piece_length, workers);
+        }
+        else
+        {
+            // Unchanged files come straight from the hash cache
+            file.piece_hashes = compute_piece_hashes(input.string(), piece_length, workers);
+            file.file_length = static_cast<int64_t>(fs::file_size(input));
+        }
+
+        // Encode in a single pass into an exactly sized buffer
+        return bencode::encode(build_torrent_dict(std::move(file)));
+    }
+
+    std::string compute_piece_hashes(const std::string &file_path, int64_t piece_length, unsigned workers)
+    {
+        // Binary concatenation of SHA1 hashes, in piece order, in constant memory
+        if (HashCache *cache = default_hash_cache())
+            return cache->piece_hashes(file_path, piece_length, workers);
+        return hash_file_pieces(file_path, piece_length, workers);
+    }
+
+    std::map<std::string, std::shared_ptr<bencode::Bencode>> create_torrent_dict(const TorrentFile &file)
+    {
+        return build_torrent_dict(file);
     }
 
     void write_to_file(const std::string &output_path, const std::string &content)
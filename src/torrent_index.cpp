@@ -0,0 +1,450 @@
+#include "torrent_index.hpp"
+#include "file_manager.hpp"
+#include "piece_hasher.hpp"
+#include "torrent_parser.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace torrent
+{
+    // On-disk layout, native endian, every offset from the start of the file:
+    //   Header | TorrentRecord[torrent_count], sorted by info-hash
+    //          | SourceRecord[source_count], sorted by file name | blob
+    // The blob holds names, announce URLs and piece hashes back to back.
+    static constexpr char index_magic[4] = {'B', 'L', 'T', 'I'};
+    static constexpr uint32_t index_version = 1;
+
+    struct TorrentIndex::Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t torrent_count;
+        uint64_t source_count;
+        uint64_t torrents_offset;
+        uint64_t sources_offset;
+        uint64_t blob_offset;
+        uint64_t file_size;
+    };
+
+    struct TorrentIndex::TorrentRecord
+    {
+        unsigned char info_hash[20];
+        uint32_t name_length;
+        uint64_t name_offset;
+        uint64_t announce_offset;
+        uint64_t announce_length;
+        int64_t length;
+        int64_t piece_length;
+        uint64_t pieces_offset;
+        uint64_t pieces_length;
+        uint64_t source; // first .torrent file (by name) holding this torrent
+    };
+
+    struct TorrentIndex::SourceRecord
+    {
+        uint64_t name_offset;
+        uint32_t name_length;
+        int32_t torrent; // index into the torrent table, -1 if the file didn't parse
+        uint64_t size;
+        int64_t mtime_ns;
+    };
+
+    namespace
+    {
+        struct SourceFile
+        {
+            std::string name;
+            uint64_t size;
+            int64_t mtime_ns;
+        };
+
+        struct Parsed
+        {
+            bool ok = false;
+            std::string info_hash;
+            std::string name;
+            std::string announce;
+            std::string pieces;
+            int64_t length = 0;
+            int64_t piece_length = 0;
+        };
+
+        // The .torrent files of a directory, sorted by name
+        std::vector<SourceFile> list_sources(const std::string &directory)
+        {
+            std::vector<SourceFile> files;
+            for (const auto &entry : fs::directory_iterator(directory))
+            {
+                if (entry.path().extension() != ".torrent")
+                    continue;
+
+                struct stat st{};
+                if (::stat(entry.path().c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+                    continue;
+                files.push_back(SourceFile{entry.path().filename().string(), static_cast<uint64_t>(st.st_size),
+                                           int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec});
+            }
+            std::sort(files.begin(), files.end(), [](const SourceFile &a, const SourceFile &b)
+                      { return a.name < b.name; });
+            return files;
+        }
+    }
+
+    // ----------------- Mapping -----------------
+    TorrentIndex::TorrentIndex(const std::string &index_path)
+    {
+        int fd = ::open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open index: " + index_path);
+
+        struct stat st{};
+        if (fstat(fd, &st) < 0 || static_cast<uint64_t>(st.st_size) < sizeof(Header))
+        {
+            ::close(fd);
+            throw std::runtime_error("Invalid index file: " + index_path);
+        }
+
+        map_size_ = static_cast<size_t>(st.st_size);
+        void *map = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+            throw std::runtime_error("Failed to map index: " + index_path);
+        map_ = static_cast<const char *>(map);
+
+        // Everything is checked once here so lookups can trust the records
+        header_ = reinterpret_cast<const Header *>(map_);
+        const Header &h = *header_;
+        const uint64_t size = map_size_;
+        bool valid = std::memcmp(h.magic, index_magic, sizeof(index_magic)) == 0 && h.version == index_version &&
+                     h.file_size == size && h.torrents_offset % 8 == 0 && h.sources_offset % 8 == 0 &&
+                     h.torrents_offset <= size && h.torrent_count <= (size - h.torrents_offset) / sizeof(TorrentRecord) &&
+                     h.sources_offset <= size && h.source_count <= (size - h.sources_offset) / sizeof(SourceRecord) &&
+                     h.blob_offset <= size;
+        if (valid)
+        {
+            torrents_ = reinterpret_cast<const TorrentRecord *>(map_ + h.torrents_offset);
+            sources_ = reinterpret_cast<const SourceRecord *>(map_ + h.sources_offset);
+        }
+
+        auto in_blob = [&](uint64_t offset, uint64_t length)
+        {
+            return offset >= h.blob_offset && offset <= size && length <= size - offset;
+        };
+        for (uint64_t i = 0; valid && i < h.torrent_count; ++i)
+        {
+            const TorrentRecord &t = torrents_[i];
+            valid = in_blob(t.name_offset, t.name_length) && in_blob(t.announce_offset, t.announce_length) &&
+                    in_blob(t.pieces_offset, t.pieces_length) && t.source < h.source_count &&
+                    (i == 0 || std::memcmp(torrents_[i - 1].info_hash, t.info_hash, sizeof(t.info_hash)) < 0);
+        }
+        for (uint64_t i = 0; valid && i < h.source_count; ++i)
+        {
+            const SourceRecord &s = sources_[i];
+            valid = in_blob(s.name_offset, s.name_length) && s.torrent >= -1 &&
+                    (s.torrent < 0 || uint64_t(s.torrent) < h.torrent_count);
+        }
+
+        if (!valid)
+        {
+            unmap();
+            throw std::runtime_error("Invalid index file: " + index_path);
+        }
+    }
+
+    TorrentIndex::TorrentIndex(TorrentIndex &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    TorrentIndex &TorrentIndex::operator=(TorrentIndex &&other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            std::swap(map_, other.map_);
+            std::swap(map_size_, other.map_size_);
+            std::swap(header_, other.header_);
+            std::swap(torrents_, other.torrents_);
+            std::swap(sources_, other.sources_);
+        }
+        return *this;
+    }
+
+    TorrentIndex::~TorrentIndex()
+    {
+        unmap();
+    }
+
+    void TorrentIndex::unmap()
+    {
+        if (map_)
+            munmap(const_cast<char *>(map_), map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+        header_ = nullptr;
+        torrents_ = nullptr;
+        sources_ = nullptr;
+    }
+
+    std::string_view TorrentIndex::blob(uint64_t offset, uint64_t length) const
+    {
+        return std::string_view(map_ + offset, static_cast<size_t>(length));
+    }
+
+    size_t TorrentIndex::size() const
+    {
+        return header_ ? static_cast<size_t>(header_->torrent_count) : 0;
+    }
+
+    IndexedTorrent TorrentIndex::operator[](size_t i) const
+    {
+        if (i >= size())
+            throw std::out_of_range("Torrent index out of range");
+
+        const TorrentRecord &t = torrents_[i];
+        IndexedTorrent torrent;
+        torrent.info_hash = std::string_view(reinterpret_cast<const char *>(t.info_hash), sizeof(t.info_hash));
+        torrent.name = blob(t.name_offset, t.name_length);
+        torrent.announce = blob(t.announce_offset, t.announce_length);
+        torrent.length = t.length;
+        torrent.piece_length = t.piece_length;
+        torrent.pieces = blob(t.pieces_offset, t.pieces_length);
+        const SourceRecord &source = sources_[t.source];
+        torrent.source = blob(source.name_offset, source.name_length);
+        return torrent;
+    }
+
+    std::optional<IndexedTorrent> TorrentIndex::find(std::string_view info_hash) const
+    {
+        if (info_hash.size() != sizeof(TorrentRecord::info_hash))
+            return std::nullopt;
+
+        const TorrentRecord *first = torrents_;
+        const TorrentRecord *last = torrents_ + size();
+        auto it = std::lower_bound(first, last, info_hash, [](const TorrentRecord &t, std::string_view key)
+                                   { return std::memcmp(t.info_hash, key.data(), sizeof(t.info_hash)) < 0; });
+        if (it == last || std::memcmp(it->info_hash, info_hash.data(), sizeof(it->info_hash)) != 0)
+            return std::nullopt;
+        return (*this)[static_cast<size_t>(it - first)];
+    }
+
+    bool TorrentIndex::matches(const std::string &directory) const
+    {
+        auto listing = list_sources(directory);
+        if (!header_ || listing.size() != header_->source_count)
+            return false;
+        for (size_t i = 0; i < listing.size(); ++i)
+        {
+            const SourceRecord &s = sources_[i];
+            if (blob(s.name_offset, s.name_length) != listing[i].name || s.size != listing[i].size ||
+                s.mtime_ns != listing[i].mtime_ns)
+                return false;
+        }
+        return true;
+    }
+
+    // ----------------- Building -----------------
+    void TorrentIndex::write(const std::string &directory, const std::string &index_path, unsigned workers,
+                             const TorrentIndex *previous)
+    {
+        auto listing = list_sources(directory);
+        std::vector<Parsed> parsed(listing.size());
+
+        // Unchanged files are copied over from the previous index, parse failures included
+        std::vector<size_t> todo;
+        std::map<std::string_view, const SourceRecord *> known;
+        if (previous && previous->header_)
+        {
+            for (uint64_t s = 0; s < previous->header_->source_count; ++s)
+            {
+                const SourceRecord &record = previous->sources_[s];
+                known.emplace(previous->blob(record.name_offset, record.name_length), &record);
+            }
+        }
+        for (size_t i = 0; i < listing.size(); ++i)
+        {
+            auto it = known.find(listing[i].name);
+            if (it == known.end() || it->second->size != listing[i].size || it->second->mtime_ns != listing[i].mtime_ns)
+            {
+                todo.push_back(i);
+                continue;
+            }
+            if (it->second->torrent < 0)
+                continue;
+
+            IndexedTorrent old = (*previous)[static_cast<size_t>(it->second->torrent)];
+            Parsed &p = parsed[i];
+            p.ok = true;
+            p.info_hash = std::string(old.info_hash);
+            p.name = std::string(old.name);
+            p.announce = std::string(old.announce);
+            p.pieces = std::string(old.pieces);
+            p.length = old.length;
+            p.piece_length = old.piece_length;
+        }
+
+        // The rest are read and parsed in parallel, one file per claim
+        std::atomic<size_t> next{0};
+        auto worker = [&]()
+        {
+            for (size_t n; (n = next.fetch_add(1, std::memory_order_relaxed)) < todo.size();)
+            {
+                size_t i = todo[n];
+                Parsed &p = parsed[i];
+                try
+                {
+                    auto content = read_file_to_string((fs::path(directory) / listing[i].name).string());
+                    auto metadata = TorrentParser::parse_content(content);
+                    p.info_hash = std::move(metadata->infoHash);
+                    p.name = std::move(metadata->name);
+                    p.announce = std::move(metadata->announce);
+                    p.pieces = std::move(metadata->pieces);
+                    p.length = metadata->length;
+                    p.piece_length = metadata->pieceLength;
+                    p.ok = p.info_hash.size() == sizeof(TorrentRecord::info_hash);
+                }
+                catch (const std::exception &)
+                {
+                    p.ok = false;
+                }
+            }
+        };
+
+        if (workers == 0)
+            workers = default_hash_workers();
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < std::min<size_t>(workers, todo.size()); ++i)
+            threads.emplace_back(worker);
+        worker();
+        for (auto &t : threads)
+            t.join();
+
+        // One record per info-hash; the first file by name wins
+        std::vector<size_t> order;
+        for (size_t i = 0; i < parsed.size(); ++i)
+        {
+            if (parsed[i].ok)
+                order.push_back(i);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                         { return parsed[a].info_hash < parsed[b].info_hash; });
+        order.erase(std::unique(order.begin(), order.end(), [&](size_t a, size_t b)
+                                { return parsed[a].info_hash == parsed[b].info_hash; }),
+                    order.end());
+
+        std::map<std::string_view, int32_t> slot;
+        uint64_t blob_size = 0;
+        for (size_t t = 0; t < order.size(); ++t)
+        {
+            const Parsed &p = parsed[order[t]];
+            slot.emplace(p.info_hash, static_cast<int32_t>(t));
+            blob_size += p.name.size() + p.announce.size() + p.pieces.size();
+        }
+        for (const auto &source : listing)
+            blob_size += source.name.size();
+
+        Header header{};
+        std::memcpy(header.magic, index_magic, sizeof(index_magic));
+        header.version = index_version;
+        header.torrent_count = order.size();
+        header.source_count = listing.size();
+        header.torrents_offset = sizeof(Header);
+        header.sources_offset = header.torrents_offset + order.size() * sizeof(TorrentRecord);
+        header.blob_offset = header.sources_offset + listing.size() * sizeof(SourceRecord);
+        header.file_size = header.blob_offset + blob_size;
+
+        std::string out(static_cast<size_t>(header.file_size), '\0');
+        std::memcpy(&out[0], &header, sizeof(header));
+        uint64_t cursor = header.blob_offset;
+        auto append = [&](const std::string &bytes)
+        {
+            uint64_t offset = cursor;
+            std::memcpy(&out[static_cast<size_t>(cursor)], bytes.data(), bytes.size());
+            cursor += bytes.size();
+            return offset;
+        };
+
+        for (size_t t = 0; t < order.size(); ++t)
+        {
+            const Parsed &p = parsed[order[t]];
+            TorrentRecord record{};
+            std::memcpy(record.info_hash, p.info_hash.data(), sizeof(record.info_hash));
+            record.name_length = static_cast<uint32_t>(p.name.size());
+            record.name_offset = append(p.name);
+            record.announce_length = p.announce.size();
+            record.announce_offset = append(p.announce);
+            record.length = p.length;
+            record.piece_length = p.piece_length;
+            record.pieces_length = p.pieces.size();
+            record.pieces_offset = append(p.pieces);
+            record.source = order[t];
+            std::memcpy(&out[static_cast<size_t>(header.torrents_offset + t * sizeof(TorrentRecord))], &record, sizeof(record));
+        }
+        for (size_t s = 0; s < listing.size(); ++s)
+        {
+            SourceRecord record{};
+            record.name_length = static_cast<uint32_t>(listing[s].name.size());
+            record.name_offset = append(listing[s].name);
+            record.torrent = parsed[s].ok ? slot.at(parsed[s].info_hash) : -1;
+            record.size = listing[s].size;
+            record.mtime_ns = listing[s].mtime_ns;
+            std::memcpy(&out[static_cast<size_t>(header.sources_offset + s * sizeof(SourceRecord))], &record, sizeof(record));
+        }
+
+        // Replace the old index atomically; existing mappings keep the old file
+        std::string temp = index_path + "." + std::to_string(::getpid()) + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            file.write(out.data(), out.size());
+            if (!file)
+            {
+                std::remove(temp.c_str());
+                throw std::runtime_error("Failed to write index: " + index_path);
+            }
+        }
+        if (std::rename(temp.c_str(), index_path.c_str()) != 0)
+        {
+            std::remove(temp.c_str());
+            throw std::runtime_error("Failed to write index: " + index_path);
+        }
+    }
+
+    void TorrentIndex::build(const std::string &directory, const std::string &index_path, unsigned workers)
+    {
+        write(directory, index_path, workers, nullptr);
+    }
+
+    TorrentIndex TorrentIndex::load(const std::string &directory, const std::string &index_path, unsigned workers)
+    {
+        TorrentIndex previous;
+        try
+        {
+            previous = TorrentIndex(index_path);
+        }
+        catch (const std::exception &)
+        {
+            // Missing or unreadable: rebuilt from scratch below
+        }
+
+        if (previous.matches(directory))
+            return previous;
+
+        write(directory, index_path, workers, &previous);
+        return TorrentIndex(index_path);
+    }
+
+}
@@ -1,4 +1,7 @@
 #include "torrent_parser.hpp"
+#include "bencode_view.hpp"
+#include "bencode_schema.hpp"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -7,82 +10,179 @@
 
 using namespace bencode;
 
-std::string generate_info_hash(const BencodeValue &torrent_dict)
+namespace
 {
-    if (!is_dict(torrent_dict))
-        throw std::runtime_error("Top-level Bencode is not a dictionary");
-
-    const auto &dict = as_dict(torrent_dict);
-
-    auto it = dict.find("info");
-    if (it == dict.end())
-        throw std::runtime_error("'info' dictionary not found");
+    // Wire layout of a metainfo file, decoded directly without a tree
+    struct InfoSection
+    {
+        std::string name;
+        int64_t piece_length = 0;
+        std::optional<std::string> pieces;
+        int64_t length = 0;
+        std::vector<TorrentFileInfo> files;
+        int64_t meta_version = 1;
+        std::optional<RawValue> file_tree;
+    };
+
+    struct MetainfoFile
+    {
+        std::string announce;
+        Spanned<InfoSection> info;
+        std::map<std::string, std::string> piece_layers;
+    };
+}
 
-    std::string bencoded_info = encode(it->second->value);
+namespace bencode
+{
+    template <>
+    struct Schema<TorrentFileInfo>
+    {
+        static constexpr auto fields = std::make_tuple(
+            required("length", &TorrentFileInfo::length),
+            required("path", &TorrentFileInfo::path),
+            optional("attr", &TorrentFileInfo::attr));
+    };
+
+    template <>
+    struct Schema<InfoSection>
+    {
+        static constexpr auto fields = std::make_tuple(
+            required("name", &InfoSection::name),
+            required("piece length", &InfoSection::piece_length),
+            optional("pieces", &InfoSection::pieces),
+            optional("length", &InfoSection::length),
+            optional("files", &InfoSection::files),
+            optional("meta version", &InfoSection::meta_version),
+            optional("file tree", &InfoSection::file_tree));
+    };
+
+    template <>
+    struct Schema<MetainfoFile>
+    {
+        static constexpr auto fields = std::make_tuple(
+            optional("announce", &MetainfoFile::announce),
+            required("info", &MetainfoFile::info),
+            optional("piece layers", &MetainfoFile::piece_layers));
+    };
+}
 
-    // SHA1 hash
+// SHA1 over the info dictionary exactly as it appears in the file. Hashing the
+// original bytes avoids re-encoding and stays correct for torrents whose
+// encoding isn't canonical.
+static std::string hash_info_span(std::string_view bencoded_info)
+{
     unsigned char hash[SHA_DIGEST_LENGTH];
-    SHA1(reinterpret_cast<const unsigned char *>(bencoded_info.c_str()), bencoded_info.size(), hash);
+    SHA1(reinterpret_cast<const unsigned char *>(bencoded_info.data()), bencoded_info.size(), hash);
 
     return std::string(reinterpret_cast<char *>(hash), SHA_DIGEST_LENGTH);
 }
 
-std::shared_ptr<TorrentMetadata> TorrentParser::parse(const std::string &filepath)
+// Flattens a v2 file tree. Files are {name: {"": {"length", "pieces root"}}},
+// directories are plain nested dictionaries.
+static void walk_file_tree(const View &dir, std::vector<std::string> &path, std::vector<TorrentFileInfo> &out)
 {
-    auto content = read_file_to_string(filepath);
-    auto bencode_value = decode(content);
+    if (!dir.is_dict())
+        throw std::runtime_error("Invalid file tree");
 
-    if (!std::holds_alternative<std::map<std::string, std::shared_ptr<Bencode>>>(bencode_value))
+    for (size_t i = 0; i < dir.size(); ++i)
     {
-        throw std::runtime_error("Invalid torrent file format");
+        std::string_view name = dir.key_at(i);
+        View node = dir.value_at(i);
+        if (name.empty() || !node.is_dict())
+            throw std::runtime_error("Invalid file tree");
+
+        path.emplace_back(name);
+        if (auto attributes = node.find(""))
+        {
+            TorrentFileInfo file;
+            file.path = path;
+            auto length = attributes.find("length");
+            if (!length)
+                throw std::runtime_error("Missing required field: length");
+            file.length = length.as_int();
+            if (auto root = attributes.find("pieces root"))
+                file.pieces_root = std::string(root.as_string());
+            if (file.length < 0 || (file.length > 0 && file.pieces_root.size() != SHA256_DIGEST_LENGTH))
+                throw std::runtime_error("Invalid pieces root for file: " + file.path.back());
+            out.push_back(std::move(file));
+        }
+        else
+        {
+            walk_file_tree(node, path, out);
+        }
+        path.pop_back();
     }
+}
 
-    auto dict = std::get<std::map<std::string, std::shared_ptr<Bencode>>>(bencode_value);
-    auto metadata = std::make_shared<TorrentMetadata>();
+std::shared_ptr<TorrentMetadata> TorrentParser::parse(const std::string &filepath)
+{
+    auto content = read_file_to_string(filepath);
+    return parse_content(content);
+}
 
-    if (dict.find("announce") != dict.end())
+std::shared_ptr<TorrentMetadata> TorrentParser::parse_content(std::string_view content)
+{
+    if (content.empty() || content.front() != 'd')
     {
-        metadata->announce = std::get<std::string>(dict["announce"]->value);
+        throw std::runtime_error("Invalid torrent file format");
     }
 
-    auto infoDict = std::get<std::map<std::string, std::shared_ptr<Bencode>>>(dict["info"]->value);
+    auto file = decode_as<MetainfoFile>(content);
+    auto &info = file.info.value;
+    auto metadata = std::make_shared<TorrentMetadata>();
 
-    if (infoDict.find("name") != infoDict.end())
+    metadata->announce = std::move(file.announce);
+    metadata->name = std::move(info.name);
+    metadata->pieceLength = info.piece_length;
+    metadata->length = info.length;
+    metadata->files = std::move(info.files);
+    if (!metadata->files.empty())
     {
-        metadata->name = std::get<std::string>(infoDict["name"]->value);
+        metadata->length = 0;
+        for (const auto &entry : metadata->files)
+            metadata->length += entry.length;
     }
+    metadata->infoHash = hash_info_span(file.info.raw);
 
-    if (infoDict.find("piece length") != infoDict.end())
+    metadata->metaVersion = info.meta_version;
+    if (info.meta_version == 2)
     {
-        metadata->pieceLength = std::get<int64_t>(infoDict["piece length"]->value);
+        if (!info.file_tree)
+            throw std::runtime_error("Missing required field: file tree");
+        auto tree = decode_view(info.file_tree->bytes);
+        std::vector<std::string> path;
+        walk_file_tree(tree.root(), path, metadata->fileTree);
+
+        metadata->pieceLayers = std::move(file.piece_layers);
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const unsigned char *>(file.info.raw.data()), file.info.raw.size(), hash);
+        metadata->infoHashV2.assign(reinterpret_cast<char *>(hash), SHA256_DIGEST_LENGTH);
+
+        if (!info.pieces)
+        {
+            // v2-only: trackers and peers know it by its truncated v2 hash
+            metadata->infoHash = metadata->infoHashV2.substr(0, SHA_DIGEST_LENGTH);
+            metadata->length = 0;
+            for (const auto &entry : metadata->fileTree)
+                metadata->length += entry.length;
+        }
     }
-
-    if (infoDict.find("pieces") != infoDict.end())
+    else if (info.meta_version != 1)
     {
-        metadata->pieces = std::get<std::string>(infoDict["pieces"]->value);
+        throw std::runtime_error("Unsupported meta version: " + std::to_string(info.meta_version));
     }
 
-    if (infoDict.find("length") != infoDict.end())
-    {
-        metadata->length = std::get<int64_t>(infoDict["length"]->value);
-    }
+    if (info.pieces)
+        metadata->pieces = std::move(*info.pieces);
+    else if (info.meta_version == 1)
+        throw std::runtime_error("Missing required field: pieces");
 
     return metadata;
 }
 
 std::string TorrentParser::parse_and_calculate_info_hash(const std::string &filepath)
 {
-    auto content = read_file_to_string(filepath);
-    auto bencode_value = decode(content);
-
-    if (!std::holds_alternative<std::map<std::string, std::shared_ptr<Bencode>>>(bencode_value))
-    {
-        throw std::runtime_error("Invalid torrent file format");
-    }
-
-    auto dict = std::get<std::map<std::string, std::shared_ptr<Bencode>>>(bencode_value);
-
-    return generate_info_hash(dict);
+    return parse(filepath)->infoHash;
 }
 
 void TorrentMetadata::print() const
@@ -91,5 +191,11 @@ void TorrentMetadata::print() const
               << "Name: " << name << "\n"
               << "Piece Length: " << pieceLength << "\n"
               << "Total Length: " << length << "\n"
+              << "Files: " << std::max<size_t>(files.empty() ? fileTree.size() : files.size(), 1) << "\n"
               << "Pieces (SHA1s combined): " << pieces.size() << " bytes\n";
+    if (metaVersion == 2)
+    {
+        std::cout << "Meta Version: 2 (" << (pieces.empty() ? "v2 only" : "hybrid") << ")\n"
+                  << "Piece Layers: " << pieceLayers.size() << "\n";
+    }
 }
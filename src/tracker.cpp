@@ -0,0 +1,1034 @@
+#include "tracker.hpp"
+#include "network.hpp"
+#include "sigpipe_guard.hpp"
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    // One entry of the dictionary peer list
+    struct DictPeer
+    {
+        std::string_view ip;
+        int64_t port = 0;
+    };
+
+    struct ScrapeReply
+    {
+        std::map<std::string, ScrapeStats> files;
+        std::string failure_reason;
+    };
+}
+
+namespace bencode
+{
+    template <>
+    struct Schema<ScrapeStats>
+    {
+        static constexpr auto fields = std::make_tuple(
+            optional("complete", &ScrapeStats::complete),
+            optional("downloaded", &ScrapeStats::downloaded),
+            optional("incomplete", &ScrapeStats::incomplete));
+    };
+
+    template <>
+    struct Schema<ScrapeReply>
+    {
+        static constexpr auto fields = std::make_tuple(
+            optional("files", &ScrapeReply::files),
+            optional("failure reason", &ScrapeReply::failure_reason));
+    };
+
+    template <>
+    struct Schema<DictPeer>
+    {
+        static constexpr auto fields = std::make_tuple(
+            optional("ip", &DictPeer::ip),
+            optional("port", &DictPeer::port));
+    };
+
+    template <>
+    struct Schema<AnnounceResponse>
+    {
+        static constexpr auto fields = std::make_tuple(
+            optional("failure reason", &AnnounceResponse::failure_reason),
+            optional("warning message", &AnnounceResponse::warning_message),
+            optional("interval", &AnnounceResponse::interval),
+            optional("min interval", &AnnounceResponse::min_interval),
+            optional("tracker id", &AnnounceResponse::tracker_id),
+            optional("complete", &AnnounceResponse::complete),
+            optional("incomplete", &AnnounceResponse::incomplete),
+            optional("peers", &AnnounceResponse::peers),
+            optional("peers6", &AnnounceResponse::peers6));
+    };
+}
+
+AnnounceResponse parse_announce_response(std::string_view body)
+{
+    auto response = bencode::decode_as<AnnounceResponse>(body);
+
+    // A failed announce carries only the reason, anything else must say when to come back
+    if (response.failure_reason.empty() && response.interval <= 0)
+    {
+        throw std::runtime_error("Missing required field: interval");
+    }
+
+    return response;
+}
+
+// ----------------- Peers -----------------
+
+namespace
+{
+    const uint8_t v4_mapped_prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+    // A literal IPv4 or IPv6 address; host names are rejected
+    bool parse_address(std::string_view text, PeerEndpoint &peer)
+    {
+        char buffer[INET6_ADDRSTRLEN];
+        if (text.empty() || text.size() >= sizeof(buffer))
+        {
+            return false;
+        }
+        std::memcpy(buffer, text.data(), text.size());
+        buffer[text.size()] = '\0';
+
+        if (inet_pton(AF_INET, buffer, peer.ip + 12) == 1)
+        {
+            std::memcpy(peer.ip, v4_mapped_prefix, sizeof(v4_mapped_prefix));
+            return true;
+        }
+        return inet_pton(AF_INET6, buffer, peer.ip) == 1;
+    }
+}
+
+bool PeerEndpoint::is_v4() const
+{
+    return std::memcmp(ip, v4_mapped_prefix, sizeof(v4_mapped_prefix)) == 0;
+}
+
+std::string PeerEndpoint::address() const
+{
+    char buffer[INET6_ADDRSTRLEN];
+    if (is_v4())
+    {
+        inet_ntop(AF_INET, ip + 12, buffer, sizeof(buffer));
+    }
+    else
+    {
+        inet_ntop(AF_INET6, ip, buffer, sizeof(buffer));
+    }
+    return buffer;
+}
+
+size_t PeerEndpointHash::operator()(const PeerEndpoint &peer) const
+{
+    uint64_t hi, lo;
+    std::memcpy(&hi, peer.ip, 8);
+    std::memcpy(&lo, peer.ip + 8, 8);
+    uint64_t h = (hi * 0x9e3779b97f4a7c15ULL) ^ (lo + peer.port);
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return static_cast<size_t>(h ^ (h >> 32));
+}
+
+// Decodes straight into the output array; duplicates and port 0 are
+// dropped by not advancing over them
+size_t parse_compact_peers(std::string_view compact, bool ipv6, PeerSet *known, std::vector<PeerEndpoint> &out)
+{
+    const size_t entry = ipv6 ? 18 : 6;
+    const size_t count = compact.size() / entry;
+    const size_t before = out.size();
+    out.resize(before + count);
+    if (known)
+    {
+        known->reserve(known->size() + count);
+    }
+
+    const auto *p = reinterpret_cast<const uint8_t *>(compact.data());
+    PeerEndpoint *dst = out.data() + before;
+    for (size_t i = 0; i < count; ++i, p += entry)
+    {
+        if (ipv6)
+        {
+            std::memcpy(dst->ip, p, 16);
+        }
+        else
+        {
+            std::memcpy(dst->ip, v4_mapped_prefix, sizeof(v4_mapped_prefix));
+            std::memcpy(dst->ip + 12, p, 4);
+        }
+        dst->port = static_cast<uint16_t>((p[entry - 2] << 8) | p[entry - 1]);
+        if (dst->port == 0 || (known && !known->insert(*dst)))
+        {
+            continue;
+        }
+        ++dst;
+    }
+
+    out.resize(static_cast<size_t>(dst - out.data()));
+    return out.size() - before;
+}
+
+size_t collect_peers(const AnnounceResponse &response, PeerSet *known, std::vector<PeerEndpoint> &out)
+{
+    size_t added = 0;
+
+    std::string_view peers = response.peers.bytes;
+    if (!peers.empty() && peers.front() == 'l')
+    {
+        bencode::Reader r(peers);
+        r.expect('l');
+        r.enter();
+        while (!r.consume_end())
+        {
+            DictPeer entry;
+            bencode::read_value(r, entry);
+            PeerEndpoint peer;
+            if (entry.port <= 0 || entry.port > 65535 || !parse_address(entry.ip, peer))
+            {
+                continue;
+            }
+            peer.port = static_cast<uint16_t>(entry.port);
+            if (known && !known->insert(peer))
+            {
+                continue;
+            }
+            out.push_back(peer);
+            ++added;
+        }
+        r.leave();
+    }
+    else if (!peers.empty())
+    {
+        bencode::Reader r(peers);
+        added += parse_compact_peers(r.read_string(), false, known, out);
+    }
+
+    if (!response.peers6.bytes.empty())
+    {
+        bencode::Reader r(response.peers6.bytes);
+        added += parse_compact_peers(r.read_string(), true, known, out);
+    }
+    return added;
+}
+
+// ----------------- Raw HTTP responses -----------------
+
+namespace
+{
+    // "HTTP/1.x NNN ..." into the status code; false if it isn't one
+    bool parse_status_line(std::string_view line, int &status, bool &http11)
+    {
+        if (line.size() < 12 || line.substr(0, 7) != "HTTP/1." || line[8] != ' ' ||
+            !std::isdigit(static_cast<unsigned char>(line[9])) ||
+            !std::isdigit(static_cast<unsigned char>(line[10])) ||
+            !std::isdigit(static_cast<unsigned char>(line[11])))
+        {
+            return false;
+        }
+        http11 = line[7] != '0';
+        status = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+        return true;
+    }
+
+    bool iequals(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string_view trim(std::string_view s)
+    {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+            s.remove_suffix(1);
+        return s;
+    }
+
+    // Takes the next "Name: value" line off `headers`, both parts trimmed.
+    // False once they run out; throws on a line that isn't a header.
+    bool next_header(std::string_view &headers, std::string_view &name, std::string_view &value)
+    {
+        if (headers.empty())
+        {
+            return false;
+        }
+        size_t end = headers.find("\r\n");
+        std::string_view line = headers.substr(0, end);
+        headers = end == std::string_view::npos ? std::string_view() : headers.substr(end + 2);
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+        {
+            throw std::runtime_error("Malformed HTTP header");
+        }
+        name = trim(line.substr(0, colon));
+        value = trim(line.substr(colon + 1));
+        return true;
+    }
+
+    // Value of the first header called `name`
+    std::string_view find_header(std::string_view headers, std::string_view name)
+    {
+        std::string_view key, value;
+        while (next_header(headers, key, value))
+        {
+            if (iequals(key, name))
+            {
+                return value;
+            }
+        }
+        return {};
+    }
+
+    bool contains_token(std::string_view value, std::string_view token)
+    {
+        for (size_t i = 0; i + token.size() <= value.size(); ++i)
+        {
+            if (iequals(value.substr(i, token.size()), token))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // One HTTP/1.x response found at the start of a buffer
+    struct HttpFrame
+    {
+        int status = 0; // 0 until the final response head is in
+        bool http11 = true;
+        bool until_close = false; // unframed: the body ends with the connection
+        std::string_view headers; // header lines, without the status line
+        std::string_view body;    // into the buffer, or the scratch string if chunked
+        size_t length = 0;        // bytes of the buffer the response takes up
+    };
+
+    // Frames the response at the start of `data`, skipping interim 1xx
+    // responses. Returns false while `data` holds only part of it, with
+    // `wanted` set to the buffer size worth trying again at; an unframed body
+    // is only complete once `closed`. Chunked bodies are reassembled in
+    // `scratch`. Throws std::runtime_error if the response is malformed or
+    // its body is larger than `max_body`.
+    bool frame_http_response(std::string_view data, bool closed, size_t max_body, HttpFrame &frame,
+                             std::string &scratch, size_t &wanted)
+    {
+        frame = HttpFrame{};
+        wanted = data.size() + 1;
+        size_t pos = 0;
+        for (;;)
+        {
+            size_t head_end = data.find("\r\n\r\n", pos);
+            if (head_end == std::string_view::npos)
+            {
+                return false;
+            }
+            std::string_view head = data.substr(pos, head_end - pos);
+            size_t line_end = head.find("\r\n");
+            int status;
+            if (!parse_status_line(head.substr(0, line_end), status, frame.http11))
+            {
+                throw std::runtime_error("Malformed HTTP status line");
+            }
+            frame.headers = line_end == std::string_view::npos ? std::string_view() : head.substr(line_end + 2);
+            std::string_view rest = frame.headers, name, value;
+            while (next_header(rest, name, value))
+            {
+            }
+            pos = head_end + 4;
+            // Interim responses such as 100 Continue come before the real one
+            if (status >= 200)
+            {
+                frame.status = status;
+                break;
+            }
+        }
+
+        if (frame.status == 204 || frame.status == 304)
+        {
+            // No body
+        }
+        else if (contains_token(find_header(frame.headers, "transfer-encoding"), "chunked"))
+        {
+            scratch.clear();
+            for (;;)
+            {
+                size_t line_end = data.find("\r\n", pos);
+                if (line_end == std::string_view::npos)
+                {
+                    return false;
+                }
+                std::string size_line(data.substr(pos, line_end - pos));
+                char *end = nullptr;
+                unsigned long long size = std::strtoull(size_line.c_str(), &end, 16);
+                if (end == size_line.c_str() || (*end && *end != ';' && *end != ' ' && *end != '\t'))
+                {
+                    throw std::runtime_error("Malformed chunk size");
+                }
+                pos = line_end + 2;
+                if (size == 0)
+                {
+                    break;
+                }
+                if (size > max_body - scratch.size())
+                {
+                    throw std::runtime_error("HTTP response too large");
+                }
+                if (size > data.size() - pos || data.size() - pos - size < 2)
+                {
+                    wanted = pos + size + 2;
+                    return false;
+                }
+                if (data.substr(pos + size, 2) != "\r\n")
+                {
+                    throw std::runtime_error("Malformed chunked body");
+                }
+                scratch.append(data.data() + pos, size);
+                pos += size + 2;
+            }
+            // Trailers, up to the empty line
+            for (;;)
+            {
+                size_t line_end = data.find("\r\n", pos);
+                if (line_end == std::string_view::npos)
+                {
+                    return false;
+                }
+                bool last = line_end == pos;
+                pos = line_end + 2;
+                if (last)
+                {
+                    break;
+                }
+            }
+            frame.body = scratch;
+        }
+        else if (std::string_view length_header = find_header(frame.headers, "content-length"); !length_header.empty())
+        {
+            std::string digits(length_header);
+            char *end = nullptr;
+            unsigned long long length = std::strtoull(digits.c_str(), &end, 10);
+            if (!std::isdigit(static_cast<unsigned char>(digits[0])) || *end)
+            {
+                throw std::runtime_error("Malformed Content-Length");
+            }
+            if (length > max_body)
+            {
+                throw std::runtime_error("HTTP response too large");
+            }
+            if (length > data.size() - pos)
+            {
+                wanted = pos + length;
+                return false;
+            }
+            frame.body = data.substr(pos, length);
+            pos += length;
+        }
+        else
+        {
+            frame.until_close = true;
+            if (data.size() - pos > max_body)
+            {
+                throw std::runtime_error("HTTP response too large");
+            }
+            if (!closed)
+            {
+                return false;
+            }
+            frame.body = data.substr(pos);
+            pos = data.size();
+        }
+        frame.length = pos;
+        return true;
+    }
+}
+
+HttpResponseView split_http_response(std::string_view raw, std::string &scratch)
+{
+    HttpFrame frame;
+    size_t wanted;
+    if (!frame_http_response(raw, true, std::string::npos, frame, scratch, wanted))
+    {
+        throw std::runtime_error(frame.status ? "Truncated HTTP body" : "Incomplete HTTP response");
+    }
+    HttpResponseView view;
+    view.status = frame.status;
+    view.headers = frame.headers;
+    view.body = frame.body;
+    return view;
+}
+
+std::string_view HttpResponse::header(std::string_view name) const
+{
+    for (const auto &[key, value] : headers)
+    {
+        if (key == name)
+        {
+            return value;
+        }
+    }
+    return {};
+}
+
+// ----------------- TrackerClient -----------------
+
+namespace
+{
+    // Longest response head accepted before the body
+    constexpr size_t max_header = 64 * 1024;
+
+    using torrent::SigpipeGuard;
+
+    std::string lowercase(std::string_view s)
+    {
+        std::string out(s);
+        for (char &c : out)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return out;
+    }
+
+    std::string tls_error()
+    {
+        unsigned long err = ERR_get_error();
+        ERR_clear_error();
+        if (!err)
+            return std::strerror(errno);
+        char buffer[256];
+        ERR_error_string_n(err, buffer, sizeof(buffer));
+        return buffer;
+    }
+}
+
+struct TrackerClient::Connection
+{
+    std::string key;
+    int fd = -1;
+    SSL *ssl = nullptr;
+    std::string in; // received but not yet consumed
+    Clock::time_point last_used;
+
+    // No close_notify is sent: every response we keep a connection for is
+    // framed, so the tracker never relies on it. Marking the connection as
+    // shut down anyway keeps OpenSSL from invalidating its session.
+    ~Connection()
+    {
+        if (ssl)
+        {
+            SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+            SSL_free(ssl);
+        }
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    // Nothing may arrive on an idle connection; readability means the
+    // tracker closed it
+    bool alive() const
+    {
+        pollfd p{fd, POLLIN | POLLRDHUP, 0};
+        return ::poll(&p, 1, 0) == 0;
+    }
+
+    // False if the tracker already dropped the connection
+    bool send_all(const std::string &data)
+    {
+        if (ssl)
+        {
+            SigpipeGuard guard;
+            ERR_clear_error();
+            errno = 0;
+            int n = SSL_write(ssl, data.data(), static_cast<int>(data.size()));
+            if (n > 0)
+                return true;
+            if (errno == EPIPE || errno == ECONNRESET)
+                return false;
+            throw std::runtime_error("Tracker send failed: " + tls_error());
+        }
+
+        for (size_t sent = 0; sent < data.size();)
+        {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EPIPE || errno == ECONNRESET)
+                    return false;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    throw TrackerUnreachable("Tracker timed out");
+                throw std::runtime_error(std::string("Tracker send failed: ") + std::strerror(errno));
+            }
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+};
+
+TrackerClient::TrackerClient(TrackerClientConfig config)
+    : config_(config)
+{
+    ctx_ = SSL_CTX_new(TLS_client_method());
+    if (!ctx_)
+    {
+        throw std::runtime_error("Unable to create SSL context");
+    }
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    // Unframed bodies end when the connection does, close_notify or not
+    SSL_CTX_set_options(ctx_, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+    if (config_.verify_certificates)
+    {
+        SSL_CTX_set_default_verify_paths(ctx_);
+        SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+    }
+
+    // Sessions are kept per tracker by on_new_session rather than in
+    // OpenSSL's internal cache, which only servers look up
+    SSL_CTX_set_app_data(ctx_, this);
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx_, &TrackerClient::on_new_session);
+}
+
+TrackerClient::~TrackerClient()
+{
+    idle_.clear();
+    for (auto &[key, session] : sessions_)
+    {
+        SSL_SESSION_free(session);
+    }
+    SSL_CTX_free(ctx_);
+}
+
+void TrackerClient::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+    dns_.clear();
+}
+
+// Called by OpenSSL whenever a server hands out a session, which with TLS 1.3
+// happens after the handshake, during the first read
+int TrackerClient::on_new_session(SSL *ssl, SSL_SESSION *session)
+{
+    auto *client = static_cast<TrackerClient *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    auto *conn = static_cast<Connection *>(SSL_get_app_data(ssl));
+
+    std::lock_guard<std::mutex> lock(client->mutex_);
+    SSL_SESSION *&slot = client->sessions_[conn->key];
+    if (slot)
+    {
+        SSL_SESSION_free(slot);
+    }
+    slot = session;
+    return 1; // we keep the reference
+}
+
+std::vector<TrackerClient::Address> TrackerClient::resolve(const std::string &host, int port)
+{
+    std::string key = host + ':' + std::to_string(port);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = dns_.find(key);
+        if (it != dns_.end() && it->second.expires > Clock::now())
+        {
+            return it->second.addresses;
+        }
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    addrinfo *result = nullptr;
+    int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result);
+    if (status != 0)
+    {
+        throw TrackerUnreachable("Host not found: " + host + " (" + gai_strerror(status) + ")");
+    }
+
+    std::vector<Address> addresses;
+    for (addrinfo *ai = result; ai; ai = ai->ai_next)
+    {
+        Address address{};
+        std::memcpy(&address.addr, ai->ai_addr, ai->ai_addrlen);
+        address.len = ai->ai_addrlen;
+        addresses.push_back(address);
+    }
+    freeaddrinfo(result);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    dns_[key] = CachedAddresses{addresses, Clock::now() + config_.dns_ttl};
+    return addresses;
+}
+
+void TrackerClient::forget_address(const std::string &host, int port)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    dns_.erase(host + ':' + std::to_string(port));
+}
+
+std::unique_ptr<TrackerClient::Connection> TrackerClient::take_idle(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = idle_.find(key);
+    if (it == idle_.end())
+    {
+        return nullptr;
+    }
+
+    auto &pool = it->second;
+    while (!pool.empty())
+    {
+        std::unique_ptr<Connection> conn = std::move(pool.back());
+        pool.pop_back();
+        if (Clock::now() - conn->last_used < config_.idle_timeout && conn->alive())
+        {
+            return conn;
+        }
+    }
+    return nullptr;
+}
+
+std::unique_ptr<TrackerClient::Connection> TrackerClient::open(const std::string &key, bool tls, const std::string &host, int port)
+{
+    timeval timeout{};
+    timeout.tv_sec = config_.timeout.count() / 1000;
+    timeout.tv_usec = (config_.timeout.count() % 1000) * 1000;
+
+    int sockfd = -1;
+    int err = 0;
+    for (const Address &address : resolve(host, port))
+    {
+        sockfd = socket(address.addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sockfd < 0)
+        {
+            err = errno;
+            continue;
+        }
+        // Linux applies the send timeout to connect() as well
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(sockfd, reinterpret_cast<const sockaddr *>(&address.addr), address.len) == 0)
+        {
+            break;
+        }
+        err = errno;
+        close(sockfd);
+        sockfd = -1;
+    }
+    if (sockfd < 0)
+    {
+        // The tracker may have moved
+        forget_address(host, port);
+        throw TrackerUnreachable("Connection to " + host + " failed: " + std::strerror(err));
+    }
+    int one = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    auto conn = std::make_unique<Connection>();
+    conn->key = key;
+    conn->fd = sockfd;
+    if (!tls)
+    {
+        return conn;
+    }
+
+    conn->ssl = SSL_new(ctx_);
+    if (!conn->ssl)
+    {
+        throw std::runtime_error("Unable to create SSL connection");
+    }
+    SSL_set_fd(conn->ssl, sockfd);
+    SSL_set_app_data(conn->ssl, conn.get());
+
+    in6_addr literal;
+    bool is_ip = inet_pton(AF_INET, host.c_str(), &literal) == 1 || inet_pton(AF_INET6, host.c_str(), &literal) == 1;
+    if (!is_ip)
+    {
+        SSL_set_tlsext_host_name(conn->ssl, host.c_str());
+    }
+    if (config_.verify_certificates)
+    {
+        if (is_ip)
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(conn->ssl), host.c_str());
+        else
+            SSL_set1_host(conn->ssl, host.c_str());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = sessions_.find(key);
+        if (it != sessions_.end())
+        {
+            SSL_set_session(conn->ssl, it->second);
+        }
+    }
+
+    SigpipeGuard guard;
+    ERR_clear_error();
+    if (SSL_connect(conn->ssl) != 1)
+    {
+        long verify = SSL_get_verify_result(conn->ssl);
+        if (verify != X509_V_OK)
+        {
+            throw std::runtime_error("SSL connection failed: " + std::string(X509_verify_cert_error_string(verify)));
+        }
+        throw std::runtime_error("SSL connection failed: " + tls_error());
+    }
+    return conn;
+}
+
+// Appends whatever arrives next to conn.in. Returns 0 once the tracker has
+// closed the connection.
+size_t TrackerClient::receive(Connection &conn)
+{
+    char buffer[16384];
+    if (conn.ssl)
+    {
+        SigpipeGuard guard;
+        ERR_clear_error();
+        errno = 0;
+        int n = SSL_read(conn.ssl, buffer, sizeof(buffer));
+        if (n > 0)
+        {
+            conn.in.append(buffer, static_cast<size_t>(n));
+            return static_cast<size_t>(n);
+        }
+        int err = SSL_get_error(conn.ssl, n);
+        if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && (n == 0 || errno == ECONNRESET)))
+        {
+            return 0;
+        }
+        if (err == SSL_ERROR_SYSCALL && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            throw TrackerUnreachable("Tracker timed out");
+        }
+        throw std::runtime_error("Tracker receive failed: " + tls_error());
+    }
+
+    for (;;)
+    {
+        ssize_t n = ::recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (n > 0)
+        {
+            conn.in.append(buffer, static_cast<size_t>(n));
+            return static_cast<size_t>(n);
+        }
+        if (n == 0 || errno == ECONNRESET)
+        {
+            return 0;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            throw TrackerUnreachable("Tracker timed out");
+        }
+        throw std::runtime_error(std::string("Tracker receive failed: ") + std::strerror(errno));
+    }
+}
+
+// Reads one HTTP/1.x response. Returns false if the connection closed before
+// any of it arrived, which on a reused connection means it went stale.
+// `reusable` tells whether the connection may carry another request.
+bool TrackerClient::read_response(Connection &conn, HttpResponse &response, bool &reusable)
+{
+    std::string &in = conn.in;
+    std::string scratch;
+    HttpFrame frame;
+    size_t wanted = 1;
+    bool closed = false;
+    for (;;)
+    {
+        if (in.size() >= wanted && frame_http_response(in, closed, config_.max_response, frame, scratch, wanted))
+        {
+            break;
+        }
+        if (closed)
+        {
+            throw std::runtime_error("Connection closed mid-response");
+        }
+        if (!frame.status && in.size() > max_header)
+        {
+            throw std::runtime_error("Tracker response header too large");
+        }
+        if (receive(conn) == 0)
+        {
+            if (in.empty())
+                return false;
+            // One last look, in case the body runs until the close
+            closed = true;
+            wanted = 0;
+        }
+    }
+
+    std::string_view connection = find_header(frame.headers, "connection");
+    bool keep_alive = !frame.until_close && (frame.http11 ? !contains_token(connection, "close")
+                                                          : contains_token(connection, "keep-alive"));
+
+    response.status = frame.status;
+    response.headers.clear();
+    std::string_view headers = frame.headers, name, value;
+    while (next_header(headers, name, value))
+    {
+        response.headers.emplace_back(lowercase(name), std::string(value));
+    }
+    response.body.assign(frame.body.data(), frame.body.size());
+
+    in.erase(0, frame.length);
+    // Anything left over wasn't asked for
+    reusable = keep_alive && in.empty();
+    return true;
+}
+
+HttpResponse TrackerClient::get(const std::string &scheme, const std::string &host, int port, const std::string &target)
+{
+    bool tls = scheme == "https";
+    if (!tls && scheme != "http")
+    {
+        throw std::runtime_error("Unsupported tracker protocol: " + scheme);
+    }
+    std::string key = scheme + "://" + host + ':' + std::to_string(port);
+
+    std::string request = "GET " + target + " HTTP/1.1\r\nHost: " + host;
+    if (port != (tls ? 443 : 80))
+    {
+        request += ':' + std::to_string(port);
+    }
+    request += "\r\nAccept: */*\r\n\r\n";
+
+    for (int attempt = 0;; ++attempt)
+    {
+        std::unique_ptr<Connection> conn = attempt == 0 ? take_idle(key) : nullptr;
+        bool reused = conn != nullptr;
+        if (!conn)
+        {
+            conn = open(key, tls, host, port);
+        }
+
+        HttpResponse response;
+        bool reusable = false;
+        if (!conn->send_all(request) || !read_response(*conn, response, reusable))
+        {
+            // A kept-alive connection the tracker closed while it sat idle
+            if (reused)
+                continue;
+            throw std::runtime_error("Connection closed by tracker");
+        }
+
+        if (reusable)
+        {
+            conn->last_used = Clock::now();
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle_[key].push_back(std::move(conn));
+        }
+        return response;
+    }
+}
+
+AnnounceResponse TrackerClient::announce(const std::string &announce_url, const AnnounceRequest &request, std::string &body)
+{
+    auto parts = split_announce_url(announce_url); // protocol, host, port, path
+    if (parts[0].empty())
+    {
+        throw std::runtime_error("Invalid announce URL: " + announce_url);
+    }
+
+    std::string target = parts[3];
+    target += target.find('?') == std::string::npos ? '?' : '&';
+    target += "info_hash=" + url_encode(request.info_hash) +
+              "&peer_id=" + url_encode(request.peer_id) +
+              "&port=" + std::to_string(request.port) +
+              "&uploaded=" + std::to_string(request.uploaded) +
+              "&downloaded=" + std::to_string(request.downloaded) +
+              "&left=" + std::to_string(request.left) +
+              "&compact=1";
+    if (!request.event.empty())
+    {
+        target += "&event=" + request.event;
+    }
+    if (request.numwant >= 0)
+    {
+        target += "&numwant=" + std::to_string(request.numwant);
+    }
+    if (!request.tracker_id.empty())
+    {
+        target += "&trackerid=" + url_encode(request.tracker_id);
+    }
+
+    HttpResponse response = get(parts[0], parts[1], std::stoi(parts[2]), target);
+    if (response.status != 200)
+    {
+        throw std::runtime_error("Tracker returned HTTP " + std::to_string(response.status));
+    }
+    body = std::move(response.body);
+    return parse_announce_response(body);
+}
+
+std::string scrape_url(const std::string &announce_url)
+{
+    size_t query = announce_url.find('?');
+    size_t slash = announce_url.rfind('/', query);
+    if (slash == std::string::npos || announce_url.compare(slash + 1, 8, "announce") != 0)
+    {
+        return {};
+    }
+    return announce_url.substr(0, slash + 1) + "scrape" + announce_url.substr(slash + 9);
+}
+
+std::map<std::string, ScrapeStats> TrackerClient::scrape(const std::string &announce_url, const std::vector<std::string> &info_hashes)
+{
+    std::string url = scrape_url(announce_url);
+    if (url.empty())
+    {
+        throw std::runtime_error("Tracker doesn't support scrape: " + announce_url);
+    }
+    auto parts = split_announce_url(url); // protocol, host, port, path
+
+    std::string target = parts[3];
+    char separator = target.find('?') == std::string::npos ? '?' : '&';
+    for (const auto &hash : info_hashes)
+    {
+        target += separator;
+        target += "info_hash=" + url_encode(hash);
+        separator = '&';
+    }
+
+    HttpResponse response = get(parts[0], parts[1], std::stoi(parts[2]), target);
+    if (response.status != 200)
+    {
+        throw std::runtime_error("Tracker returned HTTP " + std::to_string(response.status));
+    }
+    auto reply = bencode::decode_as<ScrapeReply>(response.body);
+    if (!reply.failure_reason.empty())
+    {
+        throw std::runtime_error("Scrape failed: " + reply.failure_reason);
+    }
+    return std::move(reply.files);
+}
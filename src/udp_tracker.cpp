@@ -0,0 +1,643 @@
+#include "udp_tracker.hpp"
+#include "network.hpp"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace torrent
+{
+    // Magic connection ID of every connect request
+    static constexpr uint64_t protocol_id = 0x41727101980ULL;
+
+    static void put_u16(std::string &out, uint16_t v)
+    {
+        out += static_cast<char>(v >> 8);
+        out += static_cast<char>(v);
+    }
+
+    static void put_u32(std::string &out, uint32_t v)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out += static_cast<char>(v >> shift);
+    }
+
+    static void put_u64(std::string &out, uint64_t v)
+    {
+        for (int shift = 56; shift >= 0; shift -= 8)
+            out += static_cast<char>(v >> shift);
+    }
+
+    static uint32_t get_u32(const char *p)
+    {
+        const auto *b = reinterpret_cast<const uint8_t *>(p);
+        return (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | b[3];
+    }
+
+    static uint64_t get_u64(const char *p)
+    {
+        return (uint64_t(get_u32(p)) << 32) | get_u32(p + 4);
+    }
+
+    static bool same_address(const sockaddr_storage &a, const sockaddr_storage &b)
+    {
+        if (a.ss_family != b.ss_family)
+            return false;
+        if (a.ss_family == AF_INET6)
+        {
+            const auto &x = reinterpret_cast<const sockaddr_in6 &>(a);
+            const auto &y = reinterpret_cast<const sockaddr_in6 &>(b);
+            return x.sin6_port == y.sin6_port && std::memcmp(&x.sin6_addr, &y.sin6_addr, sizeof(in6_addr)) == 0;
+        }
+        const auto &x = reinterpret_cast<const sockaddr_in &>(a);
+        const auto &y = reinterpret_cast<const sockaddr_in &>(b);
+        return x.sin_port == y.sin_port && x.sin_addr.s_addr == y.sin_addr.s_addr;
+    }
+
+    static uint32_t event_code(const std::string &event)
+    {
+        if (event == "completed")
+            return 1;
+        if (event == "started")
+            return 2;
+        if (event == "stopped")
+            return 3;
+        return 0;
+    }
+
+    UdpTracker::UdpTracker(Reactor &reactor, UdpTrackerConfig config)
+        : reactor_(reactor), config_(config), rng_(std::random_device{}())
+    {
+        // One dual-stack socket reaches trackers of either family; hosts
+        // without IPv6 get a plain IPv4 one
+        fd_ = ::socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd_ >= 0)
+        {
+            int off = 0;
+            dual_stack_ = ::setsockopt(fd_, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) == 0;
+            if (!dual_stack_)
+            {
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+        if (fd_ < 0)
+            fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd_ < 0)
+            throw std::runtime_error(std::string("Failed to create UDP socket: ") + std::strerror(errno));
+
+        wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd_ < 0)
+        {
+            ::close(fd_);
+            throw std::runtime_error(std::string("Failed to create eventfd: ") + std::strerror(errno));
+        }
+
+        key_ = rng_();
+        reactor_.add(fd_, EPOLLIN, [this](uint32_t)
+                     { on_readable(); });
+        reactor_.add(wake_fd_, EPOLLIN, [this](uint32_t)
+                     { drain_resolved(); });
+    }
+
+    UdpTracker::~UdpTracker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(resolver_mutex_);
+            stopping_ = true;
+            lookups_.clear();
+        }
+        resolver_cv_.notify_all();
+        if (resolver_.joinable())
+            resolver_.join();
+
+        for (auto &[id, request] : requests_)
+            if (request.timer)
+                reactor_.cancel(request.timer);
+        for (auto &[key, tracker] : trackers_)
+            if (tracker.connect_timer)
+                reactor_.cancel(tracker.connect_timer);
+        reactor_.remove(fd_);
+        ::close(fd_);
+        reactor_.remove(wake_fd_);
+        ::close(wake_fd_);
+    }
+
+    // ----------------- Requests -----------------
+
+    UdpTracker::RequestId UdpTracker::announce(const std::string &announce_url, const AnnounceRequest &request,
+                                               AnnounceHandler handler)
+    {
+        auto parts = split_announce_url(announce_url); // protocol, host, port, path
+        if (parts[0] != "udp")
+            throw std::runtime_error("Not a UDP tracker URL: " + announce_url);
+        return announce(parts[1], static_cast<uint16_t>(std::stoi(parts[2])), request, std::move(handler));
+    }
+
+    UdpTracker::RequestId UdpTracker::announce(const std::string &host, uint16_t port, const AnnounceRequest &request,
+                                               AnnounceHandler handler)
+    {
+        if (request.info_hash.size() != 20 || request.peer_id.size() != 20)
+            throw std::runtime_error("Info hash and peer ID must be 20 bytes");
+
+        Request r;
+        r.action = Action::Announce;
+        r.body.reserve(82);
+        r.body += request.info_hash;
+        r.body += request.peer_id;
+        put_u64(r.body, static_cast<uint64_t>(request.downloaded));
+        put_u64(r.body, static_cast<uint64_t>(request.left));
+        put_u64(r.body, static_cast<uint64_t>(request.uploaded));
+        put_u32(r.body, event_code(request.event));
+        put_u32(r.body, 0); // IP: the sender's
+        put_u32(r.body, key_);
+        put_u32(r.body, static_cast<uint32_t>(request.numwant)); // -1 for the default
+        put_u16(r.body, request.port);
+        r.on_announce = std::move(handler);
+        return submit(host, port, std::move(r));
+    }
+
+    UdpTracker::RequestId UdpTracker::scrape(const std::string &host, uint16_t port,
+                                             const std::vector<std::string> &info_hashes, ScrapeHandler handler)
+    {
+        if (info_hashes.empty() || info_hashes.size() > max_scrape_hashes)
+            throw std::runtime_error("A scrape takes 1 to 74 info hashes");
+
+        Request r;
+        r.action = Action::Scrape;
+        for (const auto &hash : info_hashes)
+        {
+            if (hash.size() != 20)
+                throw std::runtime_error("Info hash must be 20 bytes");
+            r.body += hash;
+        }
+        r.num_hashes = info_hashes.size();
+        r.on_scrape = std::move(handler);
+        return submit(host, port, std::move(r));
+    }
+
+    UdpTracker::RequestId UdpTracker::submit(const std::string &host, uint16_t port, Request request)
+    {
+        RequestId id = next_id_++;
+        request.tracker = host + ':' + std::to_string(port);
+        std::string key = request.tracker;
+        requests_.emplace(id, std::move(request));
+
+        Tracker &t = tracker(key);
+        if (!t.resolved || Clock::now() - *t.resolved >= config_.dns_ttl)
+            resolve(t);
+        if (t.addr_len == 0 && !t.resolving)
+        {
+            // The host didn't resolve within the TTL. Report it from the
+            // loop, never from inside the call
+            std::string error = t.resolve_error;
+            requests_[id].timer = reactor_.schedule(Reactor::Clock::duration::zero(), [this, id, error]
+                                                    {
+                requests_[id].timer = 0;
+                finish(id, error, true); });
+            return id;
+        }
+
+        if (t.addr_len == 0)
+        {
+            t.waiting.push_back(id); // sent once the lookup is in
+        }
+        else if (connection_valid(t))
+        {
+            send_request(id);
+        }
+        else
+        {
+            t.waiting.push_back(id);
+            connect(t);
+        }
+        return id;
+    }
+
+    void UdpTracker::cancel(RequestId id)
+    {
+        auto it = requests_.find(id);
+        if (it == requests_.end())
+            return;
+        Request &r = it->second;
+        if (r.timer)
+            reactor_.cancel(r.timer);
+        if (r.transaction)
+            transactions_.erase(r.transaction);
+        auto t = trackers_.find(r.tracker);
+        if (t != trackers_.end())
+        {
+            auto &waiting = t->second.waiting;
+            waiting.erase(std::remove(waiting.begin(), waiting.end(), id), waiting.end());
+        }
+        requests_.erase(it);
+    }
+
+    // ----------------- Trackers -----------------
+
+    UdpTracker::Tracker &UdpTracker::tracker(const std::string &key)
+    {
+        Tracker &t = trackers_[key];
+        if (t.host.empty())
+        {
+            size_t colon = key.rfind(':');
+            t.host = key.substr(0, colon);
+            t.port = static_cast<uint16_t>(std::stoi(key.substr(colon + 1)));
+        }
+        return t;
+    }
+
+    bool UdpTracker::connection_valid(const Tracker &tracker) const
+    {
+        return tracker.has_connection && Clock::now() - tracker.connected < config_.connection_id_lifetime;
+    }
+
+    void UdpTracker::connect(Tracker &tracker)
+    {
+        if (tracker.connect_transaction)
+            return;
+        std::string key = tracker.host + ':' + std::to_string(tracker.port);
+        uint32_t transaction = new_transaction();
+        tracker.connect_transaction = transaction;
+        connects_[transaction] = key;
+        send_packet(tracker, protocol_id, Action::Connect, transaction, {});
+        tracker.connect_timer = reactor_.schedule(backoff(tracker.connect_attempt), [this, key]
+                                                  { on_connect_timeout(key); });
+    }
+
+    void UdpTracker::on_connect_timeout(const std::string &key)
+    {
+        Tracker &tracker = trackers_[key];
+        tracker.connect_timer = 0;
+        connects_.erase(tracker.connect_transaction);
+        tracker.connect_transaction = 0;
+        if (++tracker.connect_attempt > config_.max_retransmits)
+        {
+            fail_tracker(tracker, "Tracker did not respond", true);
+            return;
+        }
+        connect(tracker);
+    }
+
+    // Fails every request waiting on the tracker's connect. The address is
+    // looked up again next time in case the tracker moved; until that lookup
+    // is in, the old one is still tried.
+    void UdpTracker::fail_tracker(Tracker &tracker, const std::string &error, bool unreachable)
+    {
+        tracker.connect_attempt = 0;
+        tracker.resolved.reset();
+        tracker.has_connection = false;
+        std::deque<RequestId> waiting = std::move(tracker.waiting);
+        tracker.waiting.clear();
+        // Handlers may add trackers, so `tracker` is not touched past here
+        for (RequestId id : waiting)
+            finish(id, error, unreachable);
+    }
+
+    // ----------------- Resolver -----------------
+
+    // Starts a lookup of the tracker's host unless one is in flight. The
+    // current address, if any, stays in use meanwhile.
+    void UdpTracker::resolve(Tracker &tracker)
+    {
+        if (tracker.resolving)
+            return;
+        tracker.resolving = true;
+        {
+            std::lock_guard<std::mutex> lock(resolver_mutex_);
+            lookups_.push_back(tracker.host + ':' + std::to_string(tracker.port));
+        }
+        if (!resolver_.joinable())
+            resolver_ = std::thread([this]
+                                    { resolver_loop(); });
+        resolver_cv_.notify_one();
+    }
+
+    void UdpTracker::resolver_loop()
+    {
+        for (;;)
+        {
+            std::string key;
+            {
+                std::unique_lock<std::mutex> lock(resolver_mutex_);
+                resolver_cv_.wait(lock, [this]
+                                  { return stopping_ || !lookups_.empty(); });
+                if (stopping_)
+                    return;
+                key = std::move(lookups_.front());
+                lookups_.pop_front();
+            }
+
+            Resolved result = lookup(key);
+            {
+                std::lock_guard<std::mutex> lock(resolver_mutex_);
+                if (stopping_)
+                    return;
+                resolved_.push_back(std::move(result));
+            }
+            uint64_t one = 1;
+            [[maybe_unused]] ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+        }
+    }
+
+    // Runs on the resolver thread; touches nothing but its arguments and
+    // dual_stack_, which is fixed at construction
+    UdpTracker::Resolved UdpTracker::lookup(const std::string &key) const
+    {
+        Resolved result;
+        result.key = key;
+        size_t colon = key.rfind(':');
+        std::string host = key.substr(0, colon);
+
+        addrinfo hints{};
+        hints.ai_family = dual_stack_ ? AF_UNSPEC : AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo *info = nullptr;
+        int status = getaddrinfo(host.c_str(), key.c_str() + colon + 1, &hints, &info);
+        if (status != 0 || !info)
+        {
+            result.error = "Host not found: " + host + " (" + gai_strerror(status) + ")";
+            return result;
+        }
+
+        result.ipv6 = info->ai_family == AF_INET6;
+        if (dual_stack_ && !result.ipv6)
+        {
+            // IPv4-mapped, for the AF_INET6 socket
+            const auto &v4 = *reinterpret_cast<const sockaddr_in *>(info->ai_addr);
+            auto &v6 = reinterpret_cast<sockaddr_in6 &>(result.addr);
+            v6.sin6_family = AF_INET6;
+            v6.sin6_port = v4.sin_port;
+            v6.sin6_addr.s6_addr[10] = 0xff;
+            v6.sin6_addr.s6_addr[11] = 0xff;
+            std::memcpy(&v6.sin6_addr.s6_addr[12], &v4.sin_addr, 4);
+            result.addr_len = sizeof(sockaddr_in6);
+        }
+        else
+        {
+            std::memcpy(&result.addr, info->ai_addr, info->ai_addrlen);
+            result.addr_len = info->ai_addrlen;
+        }
+        freeaddrinfo(info);
+        return result;
+    }
+
+    void UdpTracker::drain_resolved()
+    {
+        // Reset the counter before taking the batch, so a result queued
+        // after the swap raises a fresh edge
+        uint64_t count;
+        while (::read(wake_fd_, &count, sizeof(count)) > 0)
+        {
+        }
+        std::vector<Resolved> ready;
+        {
+            std::lock_guard<std::mutex> lock(resolver_mutex_);
+            ready.swap(resolved_);
+        }
+        for (const Resolved &result : ready)
+            on_resolved(result);
+    }
+
+    void UdpTracker::on_resolved(const Resolved &result)
+    {
+        auto it = trackers_.find(result.key);
+        if (it == trackers_.end())
+            return;
+        Tracker &t = it->second;
+        t.resolving = false;
+        t.resolved = Clock::now();
+
+        if (!result.error.empty())
+        {
+            // Remembered for the TTL, so requests in the meantime fail
+            // without another lookup. A tracker that resolved before keeps
+            // its old address.
+            t.resolve_error = result.error;
+            if (t.addr_len != 0)
+                return;
+            std::deque<RequestId> waiting = std::move(t.waiting);
+            t.waiting.clear();
+            // Handlers may add trackers, so `t` is not touched past here
+            for (RequestId id : waiting)
+                finish(id, result.error, true);
+            return;
+        }
+
+        // A tracker that moved doesn't know our connection ID
+        t.resolve_error.clear();
+        if (t.addr_len == 0 || !same_address(result.addr, t.addr))
+            t.has_connection = false;
+        t.addr = result.addr;
+        t.addr_len = result.addr_len;
+        t.ipv6 = result.ipv6;
+        if (!t.waiting.empty())
+            connect(t);
+    }
+
+    // ----------------- Wire -----------------
+
+    void UdpTracker::send_request(RequestId id)
+    {
+        Request &r = requests_.at(id);
+        Tracker &tracker = trackers_.at(r.tracker);
+        if (r.transaction)
+            transactions_.erase(r.transaction);
+        r.transaction = new_transaction();
+        transactions_[r.transaction] = id;
+        send_packet(tracker, tracker.connection_id, r.action, r.transaction, r.body);
+        r.timer = reactor_.schedule(backoff(r.attempt), [this, id]
+                                    { on_request_timeout(id); });
+    }
+
+    void UdpTracker::on_request_timeout(RequestId id)
+    {
+        Request &r = requests_.at(id);
+        r.timer = 0;
+        if (++r.attempt > config_.max_retransmits)
+        {
+            finish(id, "Tracker did not respond", true);
+            return;
+        }
+
+        Tracker &tracker = trackers_.at(r.tracker);
+        if (connection_valid(tracker))
+        {
+            send_request(id);
+            return;
+        }
+        transactions_.erase(r.transaction);
+        r.transaction = 0;
+        tracker.waiting.push_back(id);
+        connect(tracker);
+    }
+
+    // Losses are left to the retransmit timers, so send errors are ignored
+    void UdpTracker::send_packet(const Tracker &tracker, uint64_t connection_id, Action action, uint32_t transaction,
+                                 const std::string &body)
+    {
+        std::string packet;
+        packet.reserve(16 + body.size());
+        put_u64(packet, connection_id);
+        put_u32(packet, static_cast<uint32_t>(action));
+        put_u32(packet, transaction);
+        packet += body;
+        ::sendto(fd_, packet.data(), packet.size(), MSG_NOSIGNAL, reinterpret_cast<const sockaddr *>(&tracker.addr),
+                 tracker.addr_len);
+    }
+
+    Reactor::Clock::duration UdpTracker::backoff(int attempt) const
+    {
+        return config_.initial_timeout * (1 << std::min(attempt, 8));
+    }
+
+    uint32_t UdpTracker::new_transaction()
+    {
+        for (;;)
+        {
+            uint32_t transaction = rng_();
+            if (transaction && !transactions_.count(transaction) && !connects_.count(transaction))
+                return transaction;
+        }
+    }
+
+    void UdpTracker::on_readable()
+    {
+        char buffer[65536];
+        for (;;)
+        {
+            sockaddr_storage from{};
+            socklen_t from_len = sizeof(from);
+            ssize_t n = ::recvfrom(fd_, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr *>(&from), &from_len);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                // EAGAIN, or an ICMP error from an earlier send; either way the
+                // timers take care of it
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return;
+                continue;
+            }
+            on_datagram(buffer, static_cast<size_t>(n), from, from_len);
+        }
+    }
+
+    // Replies are matched by transaction ID and must come from the address
+    // the request went to; anything else is dropped
+    void UdpTracker::on_datagram(const char *data, size_t size, const sockaddr_storage &from, socklen_t)
+    {
+        if (size < 8)
+            return;
+        auto action = static_cast<Action>(get_u32(data));
+        uint32_t transaction = get_u32(data + 4);
+
+        auto connect_it = connects_.find(transaction);
+        if (connect_it != connects_.end())
+        {
+            Tracker &tracker = trackers_.at(connect_it->second);
+            if (!same_address(from, tracker.addr))
+                return;
+            if (action == Action::Connect && size >= 16)
+            {
+                connects_.erase(connect_it);
+                reactor_.cancel(tracker.connect_timer);
+                tracker.connect_timer = 0;
+                tracker.connect_transaction = 0;
+                tracker.connect_attempt = 0;
+                tracker.connection_id = get_u64(data + 8);
+                tracker.connected = Clock::now();
+                tracker.has_connection = true;
+                std::deque<RequestId> waiting = std::move(tracker.waiting);
+                tracker.waiting.clear();
+                for (RequestId id : waiting)
+                    send_request(id);
+            }
+            else if (action == Action::Error)
+            {
+                connects_.erase(connect_it);
+                reactor_.cancel(tracker.connect_timer);
+                tracker.connect_timer = 0;
+                tracker.connect_transaction = 0;
+                fail_tracker(tracker, std::string(data + 8, size - 8), false);
+            }
+            return;
+        }
+
+        auto request_it = transactions_.find(transaction);
+        if (request_it == transactions_.end())
+            return;
+        RequestId id = request_it->second;
+        Request &r = requests_.at(id);
+        if (!same_address(from, trackers_.at(r.tracker).addr))
+            return;
+        if (action == Action::Error)
+            finish(id, std::string(data + 8, size - 8), false);
+        else if (action == r.action)
+            finish(id, {}, false, data + 8, size - 8);
+    }
+
+    // Completes a request, with `data` being the reply after its action and
+    // transaction ID
+    void UdpTracker::finish(RequestId id, const std::string &error, bool unreachable, const char *data, size_t size)
+    {
+        auto it = requests_.find(id);
+        if (it == requests_.end())
+            return;
+        Request r = std::move(it->second);
+        requests_.erase(it);
+        if (r.timer)
+            reactor_.cancel(r.timer);
+        if (r.transaction)
+            transactions_.erase(r.transaction);
+
+        if (r.action == Action::Announce)
+        {
+            UdpAnnounceResult result;
+            result.error = error;
+            result.unreachable = unreachable;
+            if (error.empty() && size < 12)
+                result.error = "Short announce reply";
+            if (result.error.empty())
+            {
+                result.interval = get_u32(data);
+                result.leechers = get_u32(data + 4);
+                result.seeders = get_u32(data + 8);
+                result.ipv6 = trackers_[r.tracker].ipv6;
+                size_t entry = result.ipv6 ? 18 : 6;
+                size_t peers = (size - 12) / entry * entry;
+                result.peers.assign(data + 12, peers);
+            }
+            if (r.on_announce)
+                r.on_announce(result);
+            return;
+        }
+
+        UdpScrapeResult result;
+        result.error = error;
+        result.unreachable = unreachable;
+        if (error.empty() && size < r.num_hashes * 12)
+            result.error = "Short scrape reply";
+        if (result.error.empty())
+        {
+            for (size_t i = 0; i < r.num_hashes; ++i)
+            {
+                const char *p = data + i * 12;
+                ScrapeStats stats;
+                stats.complete = get_u32(p);
+                stats.downloaded = get_u32(p + 4);
+                stats.incomplete = get_u32(p + 8);
+                result.stats.push_back(stats);
+            }
+        }
+        if (r.on_scrape)
+            r.on_scrape(result);
+    }
+
+}
@@ -0,0 +1,155 @@
+#include "uploader.hpp"
+#include "sha1.hpp"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+
+namespace torrent
+{
+    std::vector<uint32_t> allowed_fast_set(const std::string &ip, std::string_view info_hash, uint32_t num_pieces,
+                                           size_t count)
+    {
+        std::vector<uint32_t> pieces;
+        count = std::min<size_t>(count, num_pieces);
+        if (count == 0)
+            return pieces;
+
+        // The masked address followed by the info hash, hashed over and over;
+        // each digest yields five candidate indices
+        unsigned char address[16];
+        size_t address_len;
+        if (inet_pton(AF_INET, ip.c_str(), address) == 1)
+        {
+            address_len = 4;
+            address[3] = 0;
+        }
+        else if (inet_pton(AF_INET6, ip.c_str(), address) == 1)
+        {
+            static const unsigned char v4_mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+            if (std::memcmp(address, v4_mapped, 12) == 0)
+            {
+                std::memmove(address, address + 12, 4);
+                address_len = 4;
+                address[3] = 0;
+            }
+            else
+            {
+                address_len = 16;
+                std::memset(address + 6, 0, 10);
+            }
+        }
+        else
+        {
+            return pieces;
+        }
+
+        unsigned char x[sha1_digest_size];
+        std::string seed(reinterpret_cast<const char *>(address), address_len);
+        seed.append(info_hash.data(), info_hash.size());
+        sha1_digest(seed.data(), seed.size(), x);
+        for (;;)
+        {
+            for (size_t i = 0; i < 5 && pieces.size() < count; ++i)
+            {
+                const unsigned char *y = x + 4 * i;
+                uint32_t index = ((uint32_t(y[0]) << 24) | (uint32_t(y[1]) << 16) | (uint32_t(y[2]) << 8) | y[3]) %
+                                 num_pieces;
+                if (std::find(pieces.begin(), pieces.end(), index) == pieces.end())
+                    pieces.push_back(index);
+            }
+            if (pieces.size() == count)
+                return pieces;
+            sha1_digest(x, sizeof(x), x);
+        }
+    }
+
+    Uploader::Uploader(Storage &storage, const Bitfield &have, UploadConfig config)
+        : storage_(storage), have_(have), config_(config), pool_(wire::max_block_size, config.pool_buffers)
+    {
+    }
+
+    void Uploader::greet(PeerSession &session)
+    {
+        // A seed is interested in nobody, so sessions it serves stay up
+        // without waiting to be unchoked
+        session.set_our_pieces(have_);
+        session.cork();
+        session.send_have_set(have_);
+        // Only pieces we have are worth offering
+        if (session.fast_extension() && config_.allowed_fast > 0 && !have_.none())
+        {
+            uint32_t pieces = static_cast<uint32_t>(storage_.layout().num_pieces());
+            for (uint32_t index : allowed_fast_set(session.ip(), session.info_hash(), pieces, config_.allowed_fast))
+                if (have_.test(index))
+                    session.allow_fast(index);
+        }
+        session.uncork();
+    }
+
+    void Uploader::handle(PeerSession &session, const wire::Message &msg)
+    {
+        switch (msg.type())
+        {
+        case wire::MessageType::Request:
+            serve(session, msg);
+            break;
+        case wire::MessageType::Cancel:
+            // BEP 6 answers every request once; a dropped block gets a reject
+            if (session.cancel_piece(msg.index, msg.begin, msg.length) && session.fast_extension())
+                session.reject_request(msg.index, msg.begin, msg.length);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void Uploader::serve(PeerSession &session, const wire::Message &msg)
+    {
+        const FileLayout &layout = storage_.layout();
+        if (msg.index >= layout.num_pieces() || !have_.test(msg.index))
+        {
+            session.close("Request for a piece we don't have");
+            return;
+        }
+        uint32_t size = layout.piece_size(msg.index);
+        if (msg.length == 0 || msg.length > wire::max_block_size || msg.begin > size || msg.length > size - msg.begin)
+        {
+            session.close("Invalid request");
+            return;
+        }
+        // Requests that crossed our choke are void, except for pieces the
+        // peer was allowed to fetch while choked
+        bool choked = session.am_choking() && !session.granted_fast(msg.index);
+        if (choked || session.send_queue().queued_pieces() >= config_.max_queued_requests)
+        {
+            drop(session, msg);
+            return;
+        }
+
+        if (config_.zero_copy && storage_.locate(msg.index, msg.begin, msg.length, ranges_))
+        {
+            session.send_piece(msg.index, msg.begin, ranges_);
+            bytes_served_ += msg.length;
+            return;
+        }
+
+        BufferPool::Buffer buffer = pool_.acquire();
+        if (storage_.read(msg.index, msg.begin, buffer.get(), msg.length) != msg.length)
+        {
+            drop(session, msg);
+            return;
+        }
+        session.send_piece(msg.index, msg.begin, std::move(buffer), msg.length);
+        bytes_served_ += msg.length;
+        bytes_copied_ += msg.length;
+    }
+
+    // Under the fast extension the peer hears that the request is gone
+    // instead of waiting for it to time out
+    void Uploader::drop(PeerSession &session, const wire::Message &msg)
+    {
+        ++requests_dropped_;
+        session.reject_request(msg.index, msg.begin, msg.length);
+    }
+
+}
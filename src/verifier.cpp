@@ -0,0 +1,319 @@
+#include "verifier.hpp"
+#include "file_layout.hpp"
+#include "hash_cache.hpp"
+#include "piece_hasher.hpp"
+#include "sha1.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace torrent
+{
+    // Bytes read per batch. Up to 16 pieces go together so the multi-buffer
+    // SHA-1 engine gets full lane groups; large pieces go fewer at a time to
+    // bound the buffers in flight.
+    static constexpr size_t batch_bytes = 8 << 20;
+    static constexpr size_t max_batch_pieces = 16;
+
+    static int64_t steady_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    Verifier::Verifier(const TorrentMetadata &metadata, std::string save_path, unsigned io_threads,
+                       unsigned hash_workers)
+        : pieces_(metadata.pieces), piece_length_(metadata.pieceLength),
+          io_threads_(std::max(io_threads, 1u)),
+          hash_workers_(hash_workers ? hash_workers : default_hash_workers())
+    {
+        if (piece_length_ <= 0)
+            throw std::runtime_error("Piece length must be positive");
+        if (pieces_.empty() && metadata.metaVersion == 2)
+            throw std::runtime_error("Torrent has no v1 piece hashes to verify against");
+
+        // Lay the files out as one byte stream, as the pieces see them
+        FileLayout layout(metadata, save_path);
+        for (const auto &file : layout.files())
+        {
+            if (file.length > 0)
+                segments_.push_back(Segment{file.path, file.offset, file.length, file.pad});
+        }
+        total_length_ = layout.total_length();
+
+        const uint64_t piece = static_cast<uint64_t>(piece_length_);
+        total_pieces_ = (total_length_ + piece - 1) / piece;
+        if (pieces_.size() != total_pieces_ * sha1_digest_size)
+            throw std::runtime_error("Piece count does not match payload length");
+
+        batch_pieces_ = static_cast<size_t>(std::clamp<uint64_t>(batch_bytes / piece, 1, max_batch_pieces));
+        total_batches_ = (total_pieces_ + batch_pieces_ - 1) / batch_pieces_;
+        fds_.assign(segments_.size(), -2);
+        valid_.assign(static_cast<size_t>(total_pieces_), 0);
+    }
+
+    Verifier::~Verifier()
+    {
+        for (int fd : fds_)
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+    }
+
+    double Verifier::throughput() const
+    {
+        int64_t started = started_ns_.load(std::memory_order_relaxed);
+        if (started == 0)
+            return 0.0;
+        double seconds = double(steady_ns() - started) / 1e9;
+        return seconds > 0 ? double(bytes_read()) / seconds : 0.0;
+    }
+
+    // Files are opened on first use and kept for the rest of the run
+    int Verifier::file_descriptor(size_t segment)
+    {
+        std::lock_guard<std::mutex> lock(fd_mutex_);
+        if (fds_[segment] == -2)
+        {
+            fds_[segment] = ::open(segments_[segment].path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fds_[segment] >= 0)
+                posix_fadvise(fds_[segment], 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        return fds_[segment];
+    }
+
+    void Verifier::read_batch(Batch &batch)
+    {
+        const uint64_t piece = static_cast<uint64_t>(piece_length_);
+        const uint64_t begin = batch.first_piece * piece;
+        const uint64_t end = std::min(begin + batch.pieces * piece, total_length_);
+        batch.length = static_cast<size_t>(end - begin);
+        std::fill(batch.readable.begin(), batch.readable.begin() + batch.pieces, 1);
+
+        auto unreadable = [&](uint64_t from, uint64_t to)
+        {
+            for (uint64_t p = (from - begin) / piece; p * piece < to - begin; ++p)
+                batch.readable[p] = 0;
+        };
+
+        auto it = std::upper_bound(segments_.begin(), segments_.end(), begin, [](uint64_t offset, const Segment &s)
+                                   { return offset < s.offset; });
+        size_t index = static_cast<size_t>(it - segments_.begin()) - 1;
+        for (uint64_t pos = begin; pos < end; ++index)
+        {
+            const Segment &segment = segments_[index];
+            uint64_t stop = std::min(end, segment.offset + segment.length);
+            char *out = batch.data.data() + (pos - begin);
+            size_t want = static_cast<size_t>(stop - pos);
+
+            if (segment.pad)
+            {
+                std::memset(out, 0, want);
+                pos = stop;
+                continue;
+            }
+
+            int fd = file_descriptor(index);
+            size_t got = 0;
+            while (fd >= 0 && got < want)
+            {
+                ssize_t n = ::pread(fd, out + got, want - got, static_cast<off_t>(pos - segment.offset + got));
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+                got += static_cast<size_t>(n);
+            }
+            bytes_read_.fetch_add(got, std::memory_order_relaxed);
+            if (got < want)
+                unreadable(pos + got, stop);
+            pos = stop;
+        }
+    }
+
+    void Verifier::read_loop()
+    {
+        for (;;)
+        {
+            uint64_t index = next_batch_.fetch_add(1, std::memory_order_relaxed);
+            if (index >= total_batches_ || cancelled_.load(std::memory_order_relaxed))
+                break;
+
+            Batch *batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&]
+                         { return !free_.empty(); });
+                batch = free_.back();
+                free_.pop_back();
+            }
+
+            batch->first_piece = index * batch_pieces_;
+            batch->pieces = static_cast<size_t>(std::min<uint64_t>(batch_pieces_, total_pieces_ - batch->first_piece));
+            read_batch(*batch);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ready_.push_back(batch);
+            }
+            cv_.notify_all();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --readers_left_;
+        }
+        cv_.notify_all();
+    }
+
+    void Verifier::hash_loop()
+    {
+        const size_t piece = static_cast<size_t>(piece_length_);
+        unsigned char digests[max_batch_pieces * sha1_digest_size];
+        const char *ptrs[max_batch_pieces];
+
+        for (;;)
+        {
+            Batch *batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&]
+                         { return !ready_.empty() || readers_left_ == 0; });
+                if (ready_.empty())
+                    return;
+                batch = ready_.front();
+                ready_.pop_front();
+            }
+
+            // Full-length pieces are hashed side by side, only the torrent's
+            // final piece can be short
+            size_t full = std::min(batch->pieces, batch->length / piece);
+            for (size_t i = 0; i < full; ++i)
+                ptrs[i] = batch->data.data() + i * piece;
+            sha1_many(ptrs, full, piece, digests);
+            if (full < batch->pieces)
+                sha1_digest(batch->data.data() + full * piece, batch->length - full * piece,
+                            digests + full * sha1_digest_size);
+
+            uint64_t passed = 0;
+            for (size_t i = 0; i < batch->pieces; ++i)
+            {
+                uint64_t p = batch->first_piece + i;
+                bool ok = batch->readable[i] &&
+                          std::memcmp(digests + i * sha1_digest_size, &pieces_[p * sha1_digest_size], sha1_digest_size) == 0;
+                valid_[p] = ok;
+                passed += ok;
+            }
+            pieces_valid_.fetch_add(passed, std::memory_order_relaxed);
+            pieces_checked_.fetch_add(batch->pieces, std::memory_order_relaxed);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                free_.push_back(batch);
+            }
+            cv_.notify_all();
+        }
+    }
+
+    // Checks a single complete file against the hash cache's digests of it.
+    // False, with nothing checked, when that doesn't apply: several files,
+    // pad files, a missing or wrongly sized file, or no usable cache.
+    bool Verifier::check_cached()
+    {
+        HashCache *cache = default_hash_cache();
+        if (!cache || segments_.size() != 1 || segments_[0].pad || segments_[0].length != total_length_)
+            return false;
+
+        const std::string &path = segments_[0].path;
+        struct stat st{};
+        if (::stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode) || uint64_t(st.st_size) != total_length_)
+            return false;
+
+        std::string digests;
+        try
+        {
+            digests = cache->piece_hashes(path, piece_length_, hash_workers_, &cancelled_);
+        }
+        catch (const std::exception &)
+        {
+            return false; // unreadable; the pipeline fails the pieces it can't read
+        }
+        // Cancelled: nothing counts as checked
+        if (cancelled_.load(std::memory_order_relaxed))
+            return true;
+        if (digests.size() != pieces_.size()) // resized in the meantime
+            return false;
+
+        uint64_t passed = 0;
+        for (uint64_t p = 0; p < total_pieces_; ++p)
+        {
+            bool ok = std::memcmp(&digests[p * sha1_digest_size], &pieces_[p * sha1_digest_size], sha1_digest_size) == 0;
+            valid_[p] = ok;
+            passed += ok;
+        }
+        pieces_valid_ = passed;
+        pieces_checked_ = total_pieces_;
+        return true;
+    }
+
+    void Verifier::read_all()
+    {
+        // Two buffers per reader keeps every reader busy while one waits to be hashed
+        size_t buffers = std::min<uint64_t>(size_t(io_threads_) * 2, std::max<uint64_t>(total_batches_, 1));
+        buffers_.assign(buffers, Batch{});
+        free_.clear();
+        ready_.clear();
+        for (auto &batch : buffers_)
+        {
+            batch.data.resize(batch_pieces_ * static_cast<size_t>(piece_length_));
+            batch.readable.resize(batch_pieces_);
+            free_.push_back(&batch);
+        }
+
+        size_t readers = std::min<uint64_t>(io_threads_, std::max<uint64_t>(total_batches_, 1));
+        readers_left_ = readers;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < readers; ++i)
+            threads.emplace_back(&Verifier::read_loop, this);
+        for (unsigned i = 1; i < hash_workers_; ++i)
+            threads.emplace_back(&Verifier::hash_loop, this);
+        hash_loop();
+        for (auto &t : threads)
+            t.join();
+
+        buffers_.clear();
+        free_.clear();
+    }
+
+    std::vector<uint8_t> Verifier::run()
+    {
+        started_ns_.store(steady_ns(), std::memory_order_relaxed);
+        next_batch_ = 0;
+        pieces_checked_ = 0;
+        pieces_valid_ = 0;
+        bytes_read_ = 0;
+        std::fill(valid_.begin(), valid_.end(), 0);
+
+        if (!cancelled_.load(std::memory_order_relaxed) && !check_cached())
+            read_all();
+        // A cancel only ever stops the run it came before or during
+        cancelled_.store(false, std::memory_order_relaxed);
+
+        std::vector<uint8_t> have(static_cast<size_t>((total_pieces_ + 7) / 8), 0);
+        for (uint64_t p = 0; p < total_pieces_; ++p)
+        {
+            if (valid_[p])
+                have[p / 8] |= uint8_t(0x80 >> (p % 8));
+        }
+        return have;
+    }
+
+}
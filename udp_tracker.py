@@ -0,0 +1,129 @@
+import argparse
+import asyncio
+import logging
+import random
+import socket
+import struct
+import sys
+import time
+
+
+logging.basicConfig(level=logging.INFO, stream=sys.stdout)
+
+PROTOCOL_ID = 0x41727101980
+CONNECT, ANNOUNCE, SCRAPE, ERROR = 0, 1, 2, 3
+EVENTS = {0: "none", 1: "completed", 2: "started", 3: "stopped"}
+CONNECTION_ID_LIFETIME = 120  # seconds; BEP 15 asks clients to reconnect after 60
+
+
+class UdpTracker(asyncio.DatagramProtocol):
+    """A small in-memory BEP 15 tracker, standing in for a real one in tests."""
+
+    def __init__(self, interval, drop):
+        self.interval = interval
+        self.drop = drop
+        self.connections = {}  # connection id -> (address, issued at)
+        self.swarms = {}       # info hash -> {(ip, port): left}
+        self.completed = {}    # info hash -> completed downloads
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        if self.drop and random.random() < self.drop:
+            logging.info(f"Dropped datagram from {addr}")
+            return
+        if len(data) < 16:
+            return
+
+        connection_id, action, transaction = struct.unpack_from("!QII", data)
+        if action == CONNECT:
+            if connection_id != PROTOCOL_ID:
+                return
+            new_id = random.getrandbits(64)
+            self.connections[new_id] = (addr, time.monotonic())
+            self.transport.sendto(struct.pack("!IIQ", CONNECT, transaction, new_id), addr)
+            return
+
+        issued = self.connections.get(connection_id)
+        if not issued or issued[0] != addr or time.monotonic() - issued[1] > CONNECTION_ID_LIFETIME:
+            self.error(addr, transaction, "Connection ID expired")
+            return
+
+        if action == ANNOUNCE:
+            self.announce(data, addr, transaction)
+        elif action == SCRAPE:
+            self.scrape(data, addr, transaction)
+        else:
+            self.error(addr, transaction, "Unknown action")
+
+    def announce(self, data, addr, transaction):
+        if len(data) < 98:
+            self.error(addr, transaction, "Short announce")
+            return
+        info_hash, peer_id = data[16:36], data[36:56]
+        downloaded, left, uploaded, event, ip, key, num_want, port = struct.unpack_from("!QQQIIIiH", data, 56)
+        logging.info(f"Announce {info_hash.hex()} from {addr} port {port} event {EVENTS.get(event, event)} left {left}")
+
+        swarm = self.swarms.setdefault(info_hash, {})
+        peer = (addr[0], port)
+        if event == 3:
+            swarm.pop(peer, None)
+        else:
+            if event == 1:
+                self.completed[info_hash] = self.completed.get(info_hash, 0) + 1
+            swarm[peer] = left
+
+        ipv6 = self.transport.get_extra_info("socket").family == socket.AF_INET6 and not addr[0].startswith("::ffff:")
+        others = [p for p in swarm if p != peer]
+        if num_want >= 0:
+            others = others[:num_want]
+        seeders = sum(1 for left in swarm.values() if left == 0)
+        reply = struct.pack("!IIIII", ANNOUNCE, transaction, self.interval, len(swarm) - seeders, seeders)
+        for ip_str, peer_port in others:
+            family = socket.AF_INET6 if ipv6 else socket.AF_INET
+            ip_str = ip_str[7:] if ip_str.startswith("::ffff:") else ip_str
+            try:
+                reply += socket.inet_pton(family, ip_str) + struct.pack("!H", peer_port)
+            except OSError:
+                continue
+        self.transport.sendto(reply, addr)
+
+    def scrape(self, data, addr, transaction):
+        hashes = [data[i:i + 20] for i in range(16, len(data) - 19, 20)]
+        reply = struct.pack("!II", SCRAPE, transaction)
+        for info_hash in hashes:
+            swarm = self.swarms.get(info_hash, {})
+            seeders = sum(1 for left in swarm.values() if left == 0)
+            reply += struct.pack("!III", seeders, self.completed.get(info_hash, 0), len(swarm) - seeders)
+        logging.info(f"Scrape of {len(hashes)} torrents from {addr}")
+        self.transport.sendto(reply, addr)
+
+    def error(self, addr, transaction, message):
+        self.transport.sendto(struct.pack("!II", ERROR, transaction) + message.encode(), addr)
+
+
+async def main():
+    """Serves the tracker until interrupted."""
+    parser = argparse.ArgumentParser(description="Local UDP tracker (BEP 15) for tests")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=6969)
+    parser.add_argument("--interval", type=int, default=1800, help="announce interval handed to clients")
+    parser.add_argument("--drop", type=float, default=0.0, help="fraction of datagrams to ignore, to exercise retransmits")
+    args = parser.parse_args()
+
+    loop = asyncio.get_running_loop()
+    family = socket.AF_INET6 if ":" in args.host else socket.AF_INET
+    transport, _ = await loop.create_datagram_endpoint(
+        lambda: UdpTracker(args.interval, args.drop), local_addr=(args.host, args.port), family=family)
+    logging.info(f"UDP tracker listening on udp://{args.host}:{args.port}")
+    try:
+        await asyncio.Event().wait()
+    finally:
+        transport.close()
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        logging.info("Tracker stopped by user via Ctrl+C.")